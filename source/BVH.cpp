@@ -0,0 +1,741 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <numeric>
+
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+namespace dae
+{
+	namespace
+	{
+		// Primitives per task when a single node is spread over the pool
+		constexpr uint32_t ParallelChunkSize{ 16384 };
+
+		uint32_t GetChunkCount(const ThreadPool* pThreadPool, uint32_t count)
+		{
+			if (pThreadPool == nullptr || pThreadPool->GetThreadCount() < 2)
+				return 1;
+
+			return std::max((count + ParallelChunkSize - 1) / ParallelChunkSize, 1u);
+		}
+
+		// Runs task(chunk, begin, end) for chunkCount even slices of [first, first + count)
+		template <typename Task>
+		void ForEachChunk(ThreadPool* pThreadPool, uint32_t first, uint32_t count, uint32_t chunkCount, Task&& task)
+		{
+			auto runChunk = [&](uint32_t chunk)
+			{
+				const uint32_t begin = first + static_cast<uint32_t>(static_cast<uint64_t>(count) * chunk / chunkCount);
+				const uint32_t end = first + static_cast<uint32_t>(static_cast<uint64_t>(count) * (chunk + 1) / chunkCount);
+				task(chunk, begin, end);
+			};
+
+			if (chunkCount > 1)
+				pThreadPool->Dispatch(chunkCount, runChunk);
+			else
+				runChunk(0);
+		}
+
+		struct Bounds
+		{
+			Vector3 minAABB{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 maxAABB{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		};
+
+		// task(begin, end, result) fills a copy of result per chunk, merge(result, chunkResult) folds them back in chunk order
+		template <typename Result, typename Task, typename Merge>
+		void ReduceChunks(ThreadPool* pThreadPool, uint32_t first, uint32_t count, Result& result, Task&& task, Merge&& merge)
+		{
+			const uint32_t chunkCount = GetChunkCount(pThreadPool, count);
+			if (chunkCount == 1)
+			{
+				task(first, first + count, result);
+				return;
+			}
+
+			std::vector<Result> chunkResults(chunkCount, result);
+			ForEachChunk(pThreadPool, first, count, chunkCount, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+				{
+					task(begin, end, chunkResults[chunk]);
+				});
+
+			for (const Result& chunkResult : chunkResults)
+				merge(result, chunkResult);
+		}
+
+		void MergeBounds(Bounds& bounds, const Bounds& other)
+		{
+			bounds.minAABB = Vector3::Min(bounds.minAABB, other.minAABB);
+			bounds.maxAABB = Vector3::Max(bounds.maxAABB, other.maxAABB);
+		}
+
+		// Spreads the low 10 bits of value so there are two zero bits between each of them
+		uint32_t ExpandBits(uint32_t value)
+		{
+			value = (value * 0x00010001u) & 0xFF0000FFu;
+			value = (value * 0x00000101u) & 0x0F00F00Fu;
+			value = (value * 0x00000011u) & 0xC30C30C3u;
+			value = (value * 0x00000005u) & 0x49249249u;
+			return value;
+		}
+	}
+
+	const char* GetBVHBuilderName(BVHBuilder builder)
+	{
+		switch (builder)
+		{
+		case BVHBuilder::SAH:
+			return "SAH";
+		case BVHBuilder::LBVH:
+			return "LBVH";
+		}
+
+		return "Unknown";
+	}
+
+	void BVH::Build(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, ThreadPool* pThreadPool, BVHBuilder builder)
+	{
+		PROFILE_ZONE("BVH::Build");
+
+		Clear();
+
+		const uint32_t primitiveCount = static_cast<uint32_t>(minBounds.size());
+		if (primitiveCount == 0)
+			return;
+
+		const auto buildStart = std::chrono::steady_clock::now();
+
+		if (pThreadPool != nullptr && (pThreadPool->GetThreadCount() < 2 || primitiveCount < MinParallelBuildPrimitives))
+			pThreadPool = nullptr;
+
+		m_Builder = builder;
+		m_MinBounds = minBounds;
+		m_MaxBounds = maxBounds;
+
+		m_Centroids.resize(primitiveCount);
+		m_PrimitiveIndices.resize(primitiveCount);
+		ForEachChunk(pThreadPool, 0, primitiveCount, GetChunkCount(pThreadPool, primitiveCount), [this](uint32_t, uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					m_Centroids[i] = (m_MinBounds[i] + m_MaxBounds[i]) * 0.5f;
+					m_PrimitiveIndices[i] = i;
+				}
+			});
+
+		if (builder == BVHBuilder::LBVH)
+			SortByMortonCode(pThreadPool);
+
+		// A binary tree never has more than 2N - 1 nodes
+		m_Nodes.reserve(2 * static_cast<size_t>(primitiveCount) - 1);
+
+		BVHNode& root = m_Nodes.emplace_back();
+		root.leftFirst = 0;
+		root.primitiveCount = primitiveCount;
+		UpdateNodeBounds(root, pThreadPool);
+
+		if (pThreadPool != nullptr)
+			BuildParallel(*pThreadPool);
+		else
+			Subdivide(m_Nodes, 0, 0);
+
+		m_Nodes.shrink_to_fit();
+		m_Centroids.clear();
+		m_MortonCodes.clear();
+
+		m_BuildStats.builder = builder;
+		m_BuildStats.buildMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+		m_BuildStats.sahCost = GetSAHCost();
+	}
+
+	void BVH::BuildFromTriangles(const std::vector<Vector3>& positions, const std::vector<int>& indices, ThreadPool* pThreadPool, BVHBuilder builder)
+	{
+		const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+
+		std::vector<Vector3> minBounds(triangleCount);
+		std::vector<Vector3> maxBounds(triangleCount);
+
+		const uint32_t chunkCount = triangleCount >= MinParallelBuildPrimitives ? GetChunkCount(pThreadPool, triangleCount) : 1;
+		ForEachChunk(pThreadPool, 0, triangleCount, chunkCount, [&](uint32_t, uint32_t begin, uint32_t end)
+			{
+				for (uint32_t triangle{ begin }; triangle < end; ++triangle)
+				{
+					const Vector3& v0 = positions[indices[triangle * 3]];
+					const Vector3& v1 = positions[indices[triangle * 3 + 1]];
+					const Vector3& v2 = positions[indices[triangle * 3 + 2]];
+
+					minBounds[triangle] = Vector3::Min(v0, Vector3::Min(v1, v2));
+					maxBounds[triangle] = Vector3::Max(v0, Vector3::Max(v1, v2));
+				}
+			});
+
+		Build(minBounds, maxBounds, pThreadPool, builder);
+	}
+
+	void BVH::Refit(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds)
+	{
+		assert(minBounds.size() == m_PrimitiveIndices.size() && "Refit needs the same primitives as the build");
+
+		m_MinBounds = minBounds;
+		m_MaxBounds = maxBounds;
+
+		// Children are stored after their parent, so walking backwards is a bottom-up pass
+		for (size_t i{ m_Nodes.size() }; i-- > 0;)
+		{
+			BVHNode& node = m_Nodes[i];
+
+			if (node.IsLeaf())
+			{
+				UpdateNodeBounds(node);
+				continue;
+			}
+
+			const BVHNode& left = m_Nodes[node.leftFirst];
+			const BVHNode& right = m_Nodes[node.leftFirst + 1];
+			node.minAABB = Vector3::Min(left.minAABB, right.minAABB);
+			node.maxAABB = Vector3::Max(left.maxAABB, right.maxAABB);
+		}
+	}
+
+	float BVH::RefitTriangles(const std::vector<Vector3>& positions, const std::vector<int>& indices, ThreadPool* pThreadPool)
+	{
+		PROFILE_ZONE("BVH::RefitTriangles");
+
+		assert(indices.size() / 3 == m_PrimitiveIndices.size() && "Refit needs the same triangles as the build");
+
+		if (m_Nodes.empty())
+			return 0.f;
+
+		// Cut the tree breadth first until there are enough subtrees, the nodes above the cut come before their children
+		std::vector<uint32_t> subtreeRoots{ 0 };
+		std::vector<uint32_t> topNodes{};
+
+		const bool isParallel = pThreadPool != nullptr && pThreadPool->GetThreadCount() > 1 && m_PrimitiveIndices.size() >= MinParallelRefitPrimitives;
+		const size_t subtreeCount = isParallel ? static_cast<size_t>(pThreadPool->GetThreadCount()) * RefitTasksPerThread : 1;
+
+		while (subtreeRoots.size() < subtreeCount)
+		{
+			std::vector<uint32_t> nextRoots{};
+			nextRoots.reserve(subtreeRoots.size() * 2);
+
+			for (const uint32_t nodeIndex : subtreeRoots)
+			{
+				const BVHNode& node = m_Nodes[nodeIndex];
+				if (node.IsLeaf())
+				{
+					nextRoots.push_back(nodeIndex);
+					continue;
+				}
+
+				topNodes.push_back(nodeIndex);
+				nextRoots.push_back(node.leftFirst);
+				nextRoots.push_back(node.leftFirst + 1);
+			}
+
+			// Only leaves left
+			if (nextRoots.size() == subtreeRoots.size())
+				break;
+
+			subtreeRoots.swap(nextRoots);
+		}
+
+		std::vector<float> subtreeCosts(subtreeRoots.size());
+		auto refitSubtree = [&](uint32_t i)
+		{
+			subtreeCosts[i] = RefitSubtree(subtreeRoots[i], positions, indices);
+		};
+
+		if (isParallel)
+			pThreadPool->Dispatch(static_cast<uint32_t>(subtreeRoots.size()), refitSubtree);
+		else
+		{
+			for (uint32_t i{}; i < subtreeRoots.size(); ++i)
+				refitSubtree(i);
+		}
+
+		float cost = std::accumulate(subtreeCosts.begin(), subtreeCosts.end(), 0.f);
+
+		for (auto it = topNodes.rbegin(); it != topNodes.rend(); ++it)
+		{
+			BVHNode& node = m_Nodes[*it];
+			const BVHNode& left = m_Nodes[node.leftFirst];
+			const BVHNode& right = m_Nodes[node.leftFirst + 1];
+			node.minAABB = Vector3::Min(left.minAABB, right.minAABB);
+			node.maxAABB = Vector3::Max(left.maxAABB, right.maxAABB);
+
+			cost += SurfaceArea(node.minAABB, node.maxAABB) * TraversalCost;
+		}
+
+		const float rootArea = SurfaceArea(m_Nodes[0].minAABB, m_Nodes[0].maxAABB);
+		if (rootArea <= 0.f)
+			return IntersectionCost * static_cast<float>(m_PrimitiveIndices.size());
+
+		return cost / rootArea;
+	}
+
+	void BVH::Assign(const BVHNode* pNodes, uint32_t nodeCount, const uint32_t* pPrimitiveIndices, uint32_t primitiveCount, BVHBuilder builder)
+	{
+		Clear();
+
+		m_Nodes.assign(pNodes, pNodes + nodeCount);
+		m_PrimitiveIndices.assign(pPrimitiveIndices, pPrimitiveIndices + primitiveCount);
+
+		m_BuildStats.builder = builder;
+		m_BuildStats.sahCost = GetSAHCost();
+	}
+
+	void BVH::Clear()
+	{
+		m_Nodes.clear();
+		m_PrimitiveIndices.clear();
+		m_MinBounds.clear();
+		m_MaxBounds.clear();
+		m_Centroids.clear();
+		m_MortonCodes.clear();
+		m_BuildStats = {};
+	}
+
+	float BVH::GetSAHCost() const
+	{
+		if (m_Nodes.empty())
+			return 0.f;
+
+		const float rootArea = SurfaceArea(m_Nodes[0].minAABB, m_Nodes[0].maxAABB);
+		if (rootArea <= 0.f)
+			return IntersectionCost * static_cast<float>(m_Nodes[0].primitiveCount);
+
+		float cost{};
+		for (const BVHNode& node : m_Nodes)
+		{
+			const float relativeArea = SurfaceArea(node.minAABB, node.maxAABB) / rootArea;
+
+			if (node.IsLeaf())
+				cost += relativeArea * IntersectionCost * static_cast<float>(node.primitiveCount);
+			else
+				cost += relativeArea * TraversalCost;
+		}
+
+		return cost;
+	}
+
+	float BVH::RefitSubtree(uint32_t nodeIndex, const std::vector<Vector3>& positions, const std::vector<int>& indices)
+	{
+		BVHNode& node = m_Nodes[nodeIndex];
+
+		if (node.IsLeaf())
+		{
+			node.minAABB = Vector3{ FLT_MAX, FLT_MAX, FLT_MAX };
+			node.maxAABB = Vector3{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+			for (uint32_t i{}; i < node.primitiveCount; ++i)
+			{
+				const uint32_t triangle = m_PrimitiveIndices[node.leftFirst + i];
+				const Vector3& v0 = positions[indices[triangle * 3]];
+				const Vector3& v1 = positions[indices[triangle * 3 + 1]];
+				const Vector3& v2 = positions[indices[triangle * 3 + 2]];
+
+				node.minAABB = Vector3::Min(node.minAABB, Vector3::Min(v0, Vector3::Min(v1, v2)));
+				node.maxAABB = Vector3::Max(node.maxAABB, Vector3::Max(v0, Vector3::Max(v1, v2)));
+			}
+
+			return SurfaceArea(node.minAABB, node.maxAABB) * IntersectionCost * static_cast<float>(node.primitiveCount);
+		}
+
+		const float childCost = RefitSubtree(node.leftFirst, positions, indices) + RefitSubtree(node.leftFirst + 1, positions, indices);
+
+		const BVHNode& left = m_Nodes[node.leftFirst];
+		const BVHNode& right = m_Nodes[node.leftFirst + 1];
+		node.minAABB = Vector3::Min(left.minAABB, right.minAABB);
+		node.maxAABB = Vector3::Max(left.maxAABB, right.maxAABB);
+
+		return childCost + SurfaceArea(node.minAABB, node.maxAABB) * TraversalCost;
+	}
+
+	void BVH::UpdateNodeBounds(BVHNode& node, ThreadPool* pThreadPool) const
+	{
+		Bounds bounds{};
+		ReduceChunks(pThreadPool, node.leftFirst, node.primitiveCount, bounds, [this](uint32_t begin, uint32_t end, Bounds& chunkBounds)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					const uint32_t primitive = m_PrimitiveIndices[i];
+					chunkBounds.minAABB = Vector3::Min(chunkBounds.minAABB, m_MinBounds[primitive]);
+					chunkBounds.maxAABB = Vector3::Max(chunkBounds.maxAABB, m_MaxBounds[primitive]);
+				}
+			}, MergeBounds);
+
+		node.minAABB = bounds.minAABB;
+		node.maxAABB = bounds.maxAABB;
+	}
+
+	float BVH::FindBestSplit(const BVHNode& node, int& axis, float& splitPosition, ThreadPool* pThreadPool) const
+	{
+		struct Bin
+		{
+			Vector3 minAABB{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 maxAABB{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			uint32_t primitiveCount{};
+		};
+
+		struct AxisBins
+		{
+			Bin bins[3][BinCount]{};
+		};
+
+		// Bin on centroid bounds, primitive bounds can be much wider than the actual spread
+		Bounds centroidBounds{};
+		ReduceChunks(pThreadPool, node.leftFirst, node.primitiveCount, centroidBounds, [this](uint32_t begin, uint32_t end, Bounds& chunkBounds)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					const Vector3& centroid = m_Centroids[m_PrimitiveIndices[i]];
+					chunkBounds.minAABB = Vector3::Min(chunkBounds.minAABB, centroid);
+					chunkBounds.maxAABB = Vector3::Max(chunkBounds.maxAABB, centroid);
+				}
+			}, MergeBounds);
+
+		const Vector3& centroidMin = centroidBounds.minAABB;
+		const Vector3& centroidMax = centroidBounds.maxAABB;
+
+		float scales[3]{};
+		for (int a{}; a < 3; ++a)
+		{
+			if (centroidMin[a] != centroidMax[a])
+				scales[a] = static_cast<float>(BinCount) / (centroidMax[a] - centroidMin[a]);
+		}
+
+		// All three axes in one pass, bins merge exactly so chunking does not change the outcome
+		AxisBins axisBins{};
+		ReduceChunks(pThreadPool, node.leftFirst, node.primitiveCount, axisBins, [&](uint32_t begin, uint32_t end, AxisBins& chunkBins)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					const uint32_t primitive = m_PrimitiveIndices[i];
+					for (int a{}; a < 3; ++a)
+					{
+						const uint32_t binIndex = std::min(BinCount - 1, static_cast<uint32_t>((m_Centroids[primitive][a] - centroidMin[a]) * scales[a]));
+
+						Bin& bin = chunkBins.bins[a][binIndex];
+						++bin.primitiveCount;
+						bin.minAABB = Vector3::Min(bin.minAABB, m_MinBounds[primitive]);
+						bin.maxAABB = Vector3::Max(bin.maxAABB, m_MaxBounds[primitive]);
+					}
+				}
+			},
+			[](AxisBins& bins, const AxisBins& other)
+			{
+				for (int a{}; a < 3; ++a)
+				{
+					for (uint32_t b{}; b < BinCount; ++b)
+					{
+						Bin& bin = bins.bins[a][b];
+						bin.primitiveCount += other.bins[a][b].primitiveCount;
+						bin.minAABB = Vector3::Min(bin.minAABB, other.bins[a][b].minAABB);
+						bin.maxAABB = Vector3::Max(bin.maxAABB, other.bins[a][b].maxAABB);
+					}
+				}
+			});
+
+		float bestCost{ FLT_MAX };
+		for (int a{}; a < 3; ++a)
+		{
+			const float boundsMin = centroidMin[a];
+			const float boundsMax = centroidMax[a];
+			if (boundsMin == boundsMax)
+				continue;
+
+			const Bin(&bins)[BinCount] = axisBins.bins[a];
+
+			// Sweep from both sides to get the area and count left and right of every bin plane
+			float leftArea[BinCount - 1]{}, rightArea[BinCount - 1]{};
+			uint32_t leftCount[BinCount - 1]{}, rightCount[BinCount - 1]{};
+
+			Bin left{}, right{};
+			for (uint32_t i{}; i < BinCount - 1; ++i)
+			{
+				left.primitiveCount += bins[i].primitiveCount;
+				left.minAABB = Vector3::Min(left.minAABB, bins[i].minAABB);
+				left.maxAABB = Vector3::Max(left.maxAABB, bins[i].maxAABB);
+				leftCount[i] = left.primitiveCount;
+				leftArea[i] = left.primitiveCount > 0 ? SurfaceArea(left.minAABB, left.maxAABB) : 0.f;
+
+				const uint32_t r = BinCount - 1 - i;
+				right.primitiveCount += bins[r].primitiveCount;
+				right.minAABB = Vector3::Min(right.minAABB, bins[r].minAABB);
+				right.maxAABB = Vector3::Max(right.maxAABB, bins[r].maxAABB);
+				rightCount[r - 1] = right.primitiveCount;
+				rightArea[r - 1] = right.primitiveCount > 0 ? SurfaceArea(right.minAABB, right.maxAABB) : 0.f;
+			}
+
+			const float binWidth = (boundsMax - boundsMin) / static_cast<float>(BinCount);
+			for (uint32_t i{}; i < BinCount - 1; ++i)
+			{
+				const float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					axis = a;
+					splitPosition = boundsMin + binWidth * static_cast<float>(i + 1);
+				}
+			}
+		}
+
+		return bestCost;
+	}
+
+	uint32_t BVH::FindMortonSplit(const BVHNode& node) const
+	{
+		const auto begin = m_PrimitiveIndices.begin() + node.leftFirst;
+		const auto end = begin + node.primitiveCount;
+
+		const uint32_t firstCode = m_MortonCodes[*begin];
+		const uint32_t lastCode = m_MortonCodes[*(end - 1)];
+
+		// The curve cannot tell these apart, halve the range
+		if (firstCode == lastCode)
+			return node.primitiveCount / 2;
+
+		// Sorted, so everything with the highest differing bit cleared comes first
+		const int splitBit = 31 - std::countl_zero(firstCode ^ lastCode);
+		const auto split = std::partition_point(begin, end, [this, splitBit](uint32_t primitive)
+			{
+				return ((m_MortonCodes[primitive] >> splitBit) & 1u) == 0;
+			});
+
+		return static_cast<uint32_t>(split - begin);
+	}
+
+	bool BVH::SplitNode(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth, ThreadPool* pThreadPool)
+	{
+		// Copy, the node vector grows below
+		const BVHNode node = nodes[nodeIndex];
+
+		if (node.primitiveCount <= 1 || depth >= MaxDepth - 1)
+			return false;
+
+		uint32_t leftCount{};
+		if (m_Builder == BVHBuilder::LBVH)
+		{
+			if (node.primitiveCount <= MaxLeafSize)
+				return false;
+
+			leftCount = FindMortonSplit(node);
+		}
+		else
+		{
+			int axis{ -1 };
+			float splitPosition{};
+			const float splitCost = FindBestSplit(node, axis, splitPosition, pThreadPool);
+
+			// All centroids coincide, nothing left to split
+			if (axis < 0)
+				return false;
+
+			// SAH: only split when both halves are cheaper than intersecting everything in this node
+			const float nodeArea = SurfaceArea(node.minAABB, node.maxAABB);
+			const float leafCost = IntersectionCost * static_cast<float>(node.primitiveCount);
+			const float splitTotalCost = TraversalCost + IntersectionCost * splitCost / std::max(nodeArea, FLT_MIN);
+			if (splitTotalCost >= leafCost && node.primitiveCount <= MaxLeafSize)
+				return false;
+
+			// Partition the primitive indices in place
+			int i = static_cast<int>(node.leftFirst);
+			int j = i + static_cast<int>(node.primitiveCount) - 1;
+			while (i <= j)
+			{
+				if (m_Centroids[m_PrimitiveIndices[i]][axis] < splitPosition)
+					++i;
+				else
+					std::swap(m_PrimitiveIndices[i], m_PrimitiveIndices[j--]);
+			}
+
+			leftCount = static_cast<uint32_t>(i) - node.leftFirst;
+		}
+
+		if (leftCount == 0 || leftCount == node.primitiveCount)
+			return false;
+
+		const uint32_t leftChildIndex = static_cast<uint32_t>(nodes.size());
+
+		BVHNode leftChild{};
+		leftChild.leftFirst = node.leftFirst;
+		leftChild.primitiveCount = leftCount;
+		UpdateNodeBounds(leftChild, pThreadPool);
+
+		BVHNode rightChild{};
+		rightChild.leftFirst = node.leftFirst + leftCount;
+		rightChild.primitiveCount = node.primitiveCount - leftCount;
+		UpdateNodeBounds(rightChild, pThreadPool);
+
+		nodes.push_back(leftChild);
+		nodes.push_back(rightChild);
+
+		nodes[nodeIndex].leftFirst = leftChildIndex;
+		nodes[nodeIndex].primitiveCount = 0;
+
+		return true;
+	}
+
+	void BVH::Subdivide(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth)
+	{
+		if (!SplitNode(nodes, nodeIndex, depth, nullptr))
+			return;
+
+		const uint32_t leftChildIndex = nodes[nodeIndex].leftFirst;
+		Subdivide(nodes, leftChildIndex, depth + 1);
+		Subdivide(nodes, leftChildIndex + 1, depth + 1);
+	}
+
+	void BVH::BuildParallel(ThreadPool& threadPool)
+	{
+		struct OpenNode
+		{
+			uint32_t nodeIndex{};
+			uint32_t depth{};
+		};
+
+		// Split the biggest open node until there is a subtree for every task, these splits bin and bound with the whole pool
+		const size_t taskCount = static_cast<size_t>(threadPool.GetThreadCount()) * BuildTasksPerThread;
+		std::vector<OpenNode> openNodes{ { 0, 0 } };
+
+		while (!openNodes.empty() && openNodes.size() < taskCount)
+		{
+			const auto biggest = std::max_element(openNodes.begin(), openNodes.end(), [this](const OpenNode& a, const OpenNode& b)
+				{
+					return m_Nodes[a.nodeIndex].primitiveCount < m_Nodes[b.nodeIndex].primitiveCount;
+				});
+
+			// Small enough for a single task already
+			if (m_Nodes[biggest->nodeIndex].primitiveCount < ParallelChunkSize)
+				break;
+
+			const OpenNode node = *biggest;
+			openNodes.erase(biggest);
+
+			if (!SplitNode(m_Nodes, node.nodeIndex, node.depth, &threadPool))
+				continue;
+
+			const uint32_t leftChildIndex = m_Nodes[node.nodeIndex].leftFirst;
+			openNodes.push_back({ leftChildIndex, node.depth + 1 });
+			openNodes.push_back({ leftChildIndex + 1, node.depth + 1 });
+		}
+
+		// Every subtree grows in a node vector of its own, its root is local node 0
+		std::vector<std::vector<BVHNode>> subtrees(openNodes.size());
+		threadPool.Dispatch(static_cast<uint32_t>(openNodes.size()), [&](uint32_t i)
+			{
+				std::vector<BVHNode>& nodes = subtrees[i];
+				nodes.reserve(2 * static_cast<size_t>(m_Nodes[openNodes[i].nodeIndex].primitiveCount) - 1);
+				nodes.push_back(m_Nodes[openNodes[i].nodeIndex]);
+
+				Subdivide(nodes, 0, openNodes[i].depth);
+			});
+
+		// Append below the top of the tree, children still come after their parent
+		for (size_t i{}; i < subtrees.size(); ++i)
+		{
+			const std::vector<BVHNode>& nodes = subtrees[i];
+			if (nodes.size() == 1)
+				continue;
+
+			const uint32_t offset = static_cast<uint32_t>(m_Nodes.size()) - 1;
+
+			BVHNode root = nodes[0];
+			root.leftFirst += offset;
+			m_Nodes[openNodes[i].nodeIndex] = root;
+
+			for (size_t n{ 1 }; n < nodes.size(); ++n)
+			{
+				BVHNode node = nodes[n];
+				if (!node.IsLeaf())
+					node.leftFirst += offset;
+
+				m_Nodes.push_back(node);
+			}
+		}
+	}
+
+	void BVH::SortByMortonCode(ThreadPool* pThreadPool)
+	{
+		const uint32_t primitiveCount = static_cast<uint32_t>(m_Centroids.size());
+
+		Bounds centroidBounds{};
+		ReduceChunks(pThreadPool, 0, primitiveCount, centroidBounds, [this](uint32_t begin, uint32_t end, Bounds& chunkBounds)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					chunkBounds.minAABB = Vector3::Min(chunkBounds.minAABB, m_Centroids[i]);
+					chunkBounds.maxAABB = Vector3::Max(chunkBounds.maxAABB, m_Centroids[i]);
+				}
+			}, MergeBounds);
+
+		constexpr uint32_t cellCount{ 1u << MortonBits };
+
+		float scales[3]{};
+		for (int a{}; a < 3; ++a)
+		{
+			const float extent = centroidBounds.maxAABB[a] - centroidBounds.minAABB[a];
+			if (extent > 0.f)
+				scales[a] = static_cast<float>(cellCount) / extent;
+		}
+
+		const uint32_t chunkCount = GetChunkCount(pThreadPool, primitiveCount);
+
+		m_MortonCodes.resize(primitiveCount);
+		ForEachChunk(pThreadPool, 0, primitiveCount, chunkCount, [&](uint32_t, uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					uint32_t code{};
+					for (int a{}; a < 3; ++a)
+					{
+						const uint32_t cell = std::min(cellCount - 1, static_cast<uint32_t>((m_Centroids[i][a] - centroidBounds.minAABB[a]) * scales[a]));
+						code |= ExpandBits(cell) << (2 - a);
+					}
+
+					m_MortonCodes[i] = code;
+				}
+			});
+
+		// Ties broken on the index, so the order does not depend on how the sort was chunked
+		auto isBefore = [this](uint32_t a, uint32_t b)
+		{
+			return m_MortonCodes[a] != m_MortonCodes[b] ? m_MortonCodes[a] < m_MortonCodes[b] : a < b;
+		};
+
+		auto chunkBegin = [&](uint32_t chunk)
+		{
+			return m_PrimitiveIndices.begin() + static_cast<ptrdiff_t>(static_cast<uint64_t>(primitiveCount) * chunk / chunkCount);
+		};
+
+		ForEachChunk(pThreadPool, 0, primitiveCount, chunkCount, [&](uint32_t chunk, uint32_t, uint32_t)
+			{
+				std::sort(chunkBegin(chunk), chunkBegin(chunk + 1), isBefore);
+			});
+
+		// Merge neighbouring sorted runs pairwise until a single one is left
+		for (uint32_t width{ 1 }; width < chunkCount; width *= 2)
+		{
+			const uint32_t mergeCount = (chunkCount + 2 * width - 1) / (2 * width);
+			auto mergeRuns = [&](uint32_t merge)
+			{
+				const uint32_t first = merge * 2 * width;
+				const uint32_t middle = std::min(first + width, chunkCount);
+				const uint32_t last = std::min(first + 2 * width, chunkCount);
+				if (middle < last)
+					std::inplace_merge(chunkBegin(first), chunkBegin(middle), chunkBegin(last), isBefore);
+			};
+
+			if (mergeCount > 1)
+				pThreadPool->Dispatch(mergeCount, mergeRuns);
+			else
+				mergeRuns(0);
+		}
+	}
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Vector3.h"
+
+namespace dae
+{
+	class ThreadPool;
+
+	struct BVHNode
+	{
+		Vector3 minAABB{};
+		Vector3 maxAABB{};
+
+		// Interior node: index of the left child (right child = leftFirst + 1)
+		// Leaf node: index of the first primitive in the primitive index list
+		uint32_t leftFirst{};
+		uint32_t primitiveCount{};
+
+		bool IsLeaf() const { return primitiveCount > 0; }
+	};
+
+	enum class BVHBuilder : uint32_t
+	{
+		// Binned surface area heuristic, the cheapest trees to trace
+		SAH,
+		// Primitives sorted along a morton curve and split on its bits, far quicker to build but costlier to trace
+		LBVH
+	};
+
+	const char* GetBVHBuilderName(BVHBuilder builder);
+
+	/**
+	 * \brief Binary bounding volume hierarchy built with the (binned) surface area heuristic, or as an LBVH when build time matters more.
+	 * The tree only knows about primitive bounds, so it is used for triangles as well as for whole objects.
+	 * The root is node 0 and children are always stored after their parent.
+	 */
+	class BVH final
+	{
+	public:
+		static constexpr uint32_t MaxDepth{ 64 };
+		// Smaller trees are built on the calling thread, a dispatch would cost more than it saves
+		static constexpr uint32_t MinParallelBuildPrimitives{ 16384 };
+
+		struct BuildStats
+		{
+			BVHBuilder builder{};
+			float buildMs{};
+			float sahCost{};
+		};
+
+		/**
+		 * \param pThreadPool splits the top of the tree with its binning spread over the pool, then builds the subtrees
+		 * below it as one task each. nullptr builds on the calling thread, the tree is the same but its nodes are in another order
+		 */
+		void Build(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds,
+			ThreadPool* pThreadPool = nullptr, BVHBuilder builder = BVHBuilder::SAH);
+		void BuildFromTriangles(const std::vector<Vector3>& positions, const std::vector<int>& indices,
+			ThreadPool* pThreadPool = nullptr, BVHBuilder builder = BVHBuilder::SAH);
+		void Refit(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds);
+		/**
+		 * \brief Keeps the topology and recomputes every node bound bottom-up from the moved triangles
+		 * \param pThreadPool refits the subtrees below the top few levels in parallel, nullptr refits on the calling thread
+		 * \return SAH cost of the refitted tree, same measure as GetSAHCost
+		 */
+		float RefitTriangles(const std::vector<Vector3>& positions, const std::vector<int>& indices, ThreadPool* pThreadPool = nullptr);
+		// Takes over a tree that was built before, like the one stored in a mesh cache
+		void Assign(const BVHNode* pNodes, uint32_t nodeCount, const uint32_t* pPrimitiveIndices, uint32_t primitiveCount,
+			BVHBuilder builder = BVHBuilder::SAH);
+		void Clear();
+
+		bool IsBuilt() const { return !m_Nodes.empty(); }
+		float GetSAHCost() const;
+		// Of the last Build, a tree that was assigned reports its builder and cost with a build time of 0
+		const BuildStats& GetBuildStats() const { return m_BuildStats; }
+
+		const std::vector<BVHNode>& GetNodes() const { return m_Nodes; }
+		const std::vector<uint32_t>& GetPrimitiveIndices() const { return m_PrimitiveIndices; }
+		// Bytes of the nodes and the primitive index list, the build scratch data is not counted
+		size_t GetMemoryUsage() const { return m_Nodes.size() * sizeof(BVHNode) + m_PrimitiveIndices.size() * sizeof(uint32_t); }
+
+	private:
+		static constexpr uint32_t BinCount{ 16 };
+		static constexpr uint32_t MaxLeafSize{ 4 };
+		static constexpr float TraversalCost{ 1.f };
+		static constexpr float IntersectionCost{ 1.f };
+		// Smaller trees are refitted on the calling thread, a dispatch would cost more than it saves
+		static constexpr uint32_t MinParallelRefitPrimitives{ 4096 };
+		// Subtrees handed out per thread, more than one so stealing evens out unbalanced ones
+		static constexpr uint32_t RefitTasksPerThread{ 4 };
+		static constexpr uint32_t BuildTasksPerThread{ 4 };
+		// Morton code bits per axis, 3 of them fit in 32 bits
+		static constexpr uint32_t MortonBits{ 10 };
+
+		std::vector<BVHNode> m_Nodes{};
+		std::vector<uint32_t> m_PrimitiveIndices{};
+
+		BuildStats m_BuildStats{};
+
+		// Build scratch data
+		std::vector<Vector3> m_MinBounds{};
+		std::vector<Vector3> m_MaxBounds{};
+		std::vector<Vector3> m_Centroids{};
+		// Per primitive, m_PrimitiveIndices is sorted by them before an LBVH build
+		std::vector<uint32_t> m_MortonCodes{};
+		BVHBuilder m_Builder{};
+
+		// pThreadPool spreads big nodes over the pool, nullptr does everything on the calling thread
+		void UpdateNodeBounds(BVHNode& node, ThreadPool* pThreadPool = nullptr) const;
+		float FindBestSplit(const BVHNode& node, int& axis, float& splitPosition, ThreadPool* pThreadPool) const;
+		uint32_t FindMortonSplit(const BVHNode& node) const;
+		// Appends the two children of nodes[nodeIndex] to nodes, false when it stays a leaf
+		bool SplitNode(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth, ThreadPool* pThreadPool);
+		void Subdivide(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth);
+		void BuildParallel(ThreadPool& threadPool);
+		void SortByMortonCode(ThreadPool* pThreadPool);
+		// Returns the unnormalized SAH cost of the subtree, area times cost summed over its nodes
+		float RefitSubtree(uint32_t nodeIndex, const std::vector<Vector3>& positions, const std::vector<int>& indices);
+	};
+
+	inline float SurfaceArea(const Vector3& minAABB, const Vector3& maxAABB)
+	{
+		const Vector3 extent{ maxAABB - minAABB };
+		return 2.f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+	}
+}
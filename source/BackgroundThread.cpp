@@ -0,0 +1,54 @@
+#include "BackgroundThread.h"
+#include "Profiler.h"
+
+namespace dae
+{
+	BackgroundThread::BackgroundThread(const std::string& name)
+	{
+		// Started last, every other member is ready by the time it runs
+		m_Thread = std::thread(&BackgroundThread::ThreadLoop, this, name);
+	}
+
+	BackgroundThread::~BackgroundThread()
+	{
+		{
+			std::lock_guard lock{ m_Mutex };
+			m_IsStopping = true;
+			m_Jobs.clear();
+		}
+		m_WakeCondition.notify_one();
+
+		m_Thread.join();
+	}
+
+	void BackgroundThread::Enqueue(std::function<void()> job)
+	{
+		{
+			std::lock_guard lock{ m_Mutex };
+			m_Jobs.push_back(std::move(job));
+		}
+		m_WakeCondition.notify_one();
+	}
+
+	void BackgroundThread::ThreadLoop(const std::string& name)
+	{
+		PROFILE_THREAD_NAME(name);
+
+		while (true)
+		{
+			std::function<void()> job{};
+			{
+				std::unique_lock lock{ m_Mutex };
+				m_WakeCondition.wait(lock, [this] { return m_IsStopping || !m_Jobs.empty(); });
+
+				if (m_IsStopping)
+					break;
+
+				job = std::move(m_Jobs.front());
+				m_Jobs.pop_front();
+			}
+
+			job();
+		}
+	}
+}
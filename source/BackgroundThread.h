@@ -0,0 +1,40 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace dae
+{
+	/**
+	 * \brief One long lived thread running queued jobs one after the other, for work that takes several frames like a bvh rebuild.
+	 * Jobs still queued when it is destroyed are dropped, the one that is running is finished first.
+	 */
+	class BackgroundThread final
+	{
+	public:
+		// name is the track name of the thread in a trace
+		explicit BackgroundThread(const std::string& name);
+		~BackgroundThread();
+
+		BackgroundThread(const BackgroundThread&) = delete;
+		BackgroundThread(BackgroundThread&&) noexcept = delete;
+		BackgroundThread& operator=(const BackgroundThread&) = delete;
+		BackgroundThread& operator=(BackgroundThread&&) noexcept = delete;
+
+		// Returns right away, job owns (or shares) everything it touches
+		void Enqueue(std::function<void()> job);
+
+	private:
+		std::mutex m_Mutex{};
+		std::condition_variable m_WakeCondition{};
+		std::deque<std::function<void()>> m_Jobs{};
+		bool m_IsStopping{ false };
+
+		std::thread m_Thread{};
+
+		void ThreadLoop(const std::string& name);
+	};
+}
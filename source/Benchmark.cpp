@@ -0,0 +1,223 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <sstream>
+
+#include "Renderer.h"
+#include "Scene.h"
+#include "Timer.h"
+
+namespace dae
+{
+	namespace
+	{
+		float GetPercentile(const std::vector<float>& sortedValues, float percentile)
+		{
+			if (sortedValues.empty())
+				return 0.f;
+
+			//Nearest rank
+			const size_t rank = static_cast<size_t>(std::ceil(percentile / 100.f * static_cast<float>(sortedValues.size())));
+			return sortedValues[std::clamp<size_t>(rank, 1, sortedValues.size()) - 1];
+		}
+
+		std::string GetBuildConfiguration()
+		{
+#if defined(_DEBUG)
+			return "Debug";
+#else
+			return "Release";
+#endif
+		}
+	}
+
+	Benchmark::Benchmark(uint32_t frameCount, uint32_t warmupFrameCount) :
+		m_FrameCount(std::max(frameCount, 1u)),
+		m_WarmupFrameCount(warmupFrameCount)
+	{
+	}
+
+	bool Benchmark::Run(Renderer* pRenderer, const std::vector<std::string>& sceneNames, const std::vector<MeshTraversal>& traversals)
+	{
+		m_Results.clear();
+		m_Width = pRenderer->GetWidth();
+		m_Height = pRenderer->GetHeight();
+		m_ThreadCount = pRenderer->GetThreadCount();
+
+		const std::time_t now = std::time(nullptr);
+		std::tm localTime{};
+#if defined(_WIN32)
+		localtime_s(&localTime, &now);
+#else
+		localtime_r(&now, &localTime);
+#endif
+		std::ostringstream timestamp{};
+		timestamp << std::put_time(&localTime, "%Y%m%d_%H%M%S");
+		m_Timestamp = timestamp.str();
+
+		std::cout << "**BENCHMARK STARTED** " << m_Width << "x" << m_Height << ", " << m_ThreadCount << " threads, "
+			<< GetTriangleKernelName(GetBestTriangleKernel()) << " triangle kernel\n";
+
+		//Reloaded for every traversal, so every run renders exactly the same frames
+		const size_t runCount = std::max<size_t>(traversals.size(), 1);
+
+		for (const std::string& sceneName : sceneNames)
+		{
+			for (size_t run{}; run < runCount; ++run)
+			{
+				const std::unique_ptr<Scene> pScene{ CreateScene(sceneName) };
+				if (!pScene)
+				{
+					std::cout << "Unknown scene: " << sceneName << std::endl;
+					return false;
+				}
+
+				pScene->Initialize();
+				if (!traversals.empty())
+					pScene->SetMeshTraversal(traversals[run]);
+
+				const Camera startCamera{ pScene->GetCamera() };
+
+				Timer timer{};
+				timer.SetFixedTimeStep(FixedTimeStep);
+				timer.Start();
+
+				SceneResult result{};
+				result.sceneName = sceneName;
+				result.traversalName = GetMeshTraversalName(pScene->GetMeshTraversal());
+				result.frameCount = m_FrameCount;
+
+				std::vector<float> frameTimes{};
+				frameTimes.reserve(m_FrameCount);
+
+				for (uint32_t frame{}; frame < m_WarmupFrameCount + m_FrameCount; ++frame)
+				{
+					const auto startTime = std::chrono::steady_clock::now();
+
+					pScene->Update(&timer);
+					MoveCamera(pScene->GetCamera(), startCamera, frame);
+					pRenderer->Render(pScene.get());
+
+					const auto endTime = std::chrono::steady_clock::now();
+					timer.Update();
+
+					if (frame < m_WarmupFrameCount)
+						continue;
+
+					frameTimes.push_back(std::chrono::duration<float, std::milli>(endTime - startTime).count());
+					result.primaryRays += pRenderer->GetFrameRayCount().primaryRays;
+					result.shadowRays += pRenderer->GetFrameRayCount().shadowRays;
+				}
+
+				result.meshBytesPerTriangle = pScene->GetMeshBytesPerTriangle();
+
+				const float totalMs = std::accumulate(frameTimes.begin(), frameTimes.end(), 0.f);
+				std::sort(frameTimes.begin(), frameTimes.end());
+
+				result.avgFrameMs = totalMs / static_cast<float>(frameTimes.size());
+				result.p50FrameMs = GetPercentile(frameTimes, 50.f);
+				result.p95FrameMs = GetPercentile(frameTimes, 95.f);
+				result.p99FrameMs = GetPercentile(frameTimes, 99.f);
+
+				const double totalSeconds = std::max(static_cast<double>(totalMs) / 1000.0, 1e-9);
+				result.primaryRaysPerSecond = static_cast<double>(result.primaryRays) / totalSeconds;
+				result.shadowRaysPerSecond = static_cast<double>(result.shadowRays) / totalSeconds;
+
+				m_Results.push_back(result);
+			}
+		}
+
+		std::cout << "**BENCHMARK FINISHED**\n";
+		return true;
+	}
+
+	void Benchmark::MoveCamera(Camera& camera, const Camera& startCamera, uint32_t frame) const
+	{
+		//Dolly forward while swaying left and right, one full sway over the measured frames
+		const float progress = static_cast<float>(frame) / static_cast<float>(m_WarmupFrameCount + m_FrameCount);
+		const float sway = sinf(progress * PI_2);
+
+		camera.origin = startCamera.origin + Vector3{ sway * 1.5f, 0.f, progress * 2.f };
+		camera.totalYaw = startCamera.totalYaw - sway * 15.f;
+		camera.totalPitch = startCamera.totalPitch;
+	}
+
+	bool Benchmark::WriteReport(const std::string& basePath) const
+	{
+		const std::string jsonPath = basePath + "_" + m_Timestamp + ".json";
+		const std::string csvPath = basePath + "_" + m_Timestamp + ".csv";
+
+		std::ofstream jsonStream(jsonPath);
+		std::ofstream csvStream(csvPath);
+		if (!jsonStream || !csvStream)
+			return false;
+
+		jsonStream << "{\n"
+			<< "  \"timestamp\": \"" << m_Timestamp << "\",\n"
+			<< "  \"build\": \"" << __DATE__ << " " << __TIME__ << "\",\n"
+			<< "  \"configuration\": \"" << GetBuildConfiguration() << "\",\n"
+			<< "  \"width\": " << m_Width << ",\n"
+			<< "  \"height\": " << m_Height << ",\n"
+			<< "  \"threads\": " << m_ThreadCount << ",\n"
+			<< "  \"triangle_kernel\": \"" << GetTriangleKernelName(GetBestTriangleKernel()) << "\",\n"
+			<< "  \"frames\": " << m_FrameCount << ",\n"
+			<< "  \"scenes\": [\n";
+
+		csvStream << "timestamp,configuration,scene,traversal,mesh_bytes_per_triangle,width,height,threads,frames,avg_ms,p50_ms,p95_ms,p99_ms,"
+			<< "primary_rays,shadow_rays,primary_rays_per_second,shadow_rays_per_second\n";
+
+		for (size_t i{}; i < m_Results.size(); ++i)
+		{
+			const SceneResult& result = m_Results[i];
+
+			jsonStream << "    {\n"
+				<< "      \"scene\": \"" << result.sceneName << "\",\n"
+				<< "      \"traversal\": \"" << result.traversalName << "\",\n"
+				<< "      \"mesh_bytes_per_triangle\": " << result.meshBytesPerTriangle << ",\n"
+				<< "      \"avg_ms\": " << result.avgFrameMs << ",\n"
+				<< "      \"p50_ms\": " << result.p50FrameMs << ",\n"
+				<< "      \"p95_ms\": " << result.p95FrameMs << ",\n"
+				<< "      \"p99_ms\": " << result.p99FrameMs << ",\n"
+				<< "      \"primary_rays\": " << result.primaryRays << ",\n"
+				<< "      \"shadow_rays\": " << result.shadowRays << ",\n"
+				<< "      \"primary_rays_per_second\": " << std::fixed << std::setprecision(0) << result.primaryRaysPerSecond << ",\n"
+				<< "      \"shadow_rays_per_second\": " << result.shadowRaysPerSecond << std::defaultfloat << std::setprecision(6) << "\n"
+				<< "    }" << (i + 1 < m_Results.size() ? "," : "") << "\n";
+
+			csvStream << m_Timestamp << "," << GetBuildConfiguration() << "," << result.sceneName << "," << result.traversalName << "," << result.meshBytesPerTriangle << ","
+				<< m_Width << "," << m_Height << "," << m_ThreadCount << "," << result.frameCount << ","
+				<< result.avgFrameMs << "," << result.p50FrameMs << "," << result.p95FrameMs << "," << result.p99FrameMs << ","
+				<< result.primaryRays << "," << result.shadowRays << ","
+				<< std::fixed << std::setprecision(0) << result.primaryRaysPerSecond << "," << result.shadowRaysPerSecond
+				<< std::defaultfloat << std::setprecision(6) << "\n";
+		}
+
+		jsonStream << "  ]\n}\n";
+
+		std::cout << "Benchmark report saved to " << jsonPath << " and " << csvPath << std::endl;
+		return true;
+	}
+
+	void Benchmark::PrintResults() const
+	{
+		for (const SceneResult& result : m_Results)
+		{
+			std::cout << ">> " << result.sceneName << " " << result.traversalName
+				<< " MESH = " << result.meshBytesPerTriangle << " B/triangle"
+				<< " AVG = " << result.avgFrameMs << "ms"
+				<< " P50 = " << result.p50FrameMs << "ms"
+				<< " P95 = " << result.p95FrameMs << "ms"
+				<< " P99 = " << result.p99FrameMs << "ms"
+				<< " PRIMARY = " << result.primaryRaysPerSecond / 1e6 << " MRays/s"
+				<< " SHADOW = " << result.shadowRaysPerSecond / 1e6 << " MRays/s\n";
+		}
+	}
+}
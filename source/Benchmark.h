@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dae
+{
+	class Renderer;
+	struct Camera;
+	enum class MeshTraversal;
+
+	/**
+	 * \brief Renders every scene along a fixed camera path with a simulated clock,
+	 * so two runs of the same build render exactly the same frames.
+	 */
+	class Benchmark final
+	{
+	public:
+		struct SceneResult
+		{
+			std::string sceneName{};
+			std::string traversalName{};
+			// Scene::GetMeshBytesPerTriangle after the last frame
+			float meshBytesPerTriangle{};
+			uint32_t frameCount{};
+
+			float avgFrameMs{};
+			float p50FrameMs{};
+			float p95FrameMs{};
+			float p99FrameMs{};
+
+			uint64_t primaryRays{};
+			uint64_t shadowRays{};
+			double primaryRaysPerSecond{};
+			double shadowRaysPerSecond{};
+		};
+
+		Benchmark(uint32_t frameCount, uint32_t warmupFrameCount = 2);
+		~Benchmark() = default;
+
+		Benchmark(const Benchmark&) = delete;
+		Benchmark(Benchmark&&) noexcept = delete;
+		Benchmark& operator=(const Benchmark&) = delete;
+		Benchmark& operator=(Benchmark&&) noexcept = delete;
+
+		//Every scene is run once per traversal, an empty list runs it once with the traversal it starts with
+		bool Run(Renderer* pRenderer, const std::vector<std::string>& sceneNames, const std::vector<MeshTraversal>& traversals = {});
+
+		//Writes <basePath>_<timestamp>.json and .csv
+		bool WriteReport(const std::string& basePath) const;
+		void PrintResults() const;
+
+		const std::vector<SceneResult>& GetResults() const { return m_Results; }
+
+	private:
+		//Simulated seconds per frame
+		static constexpr float FixedTimeStep{ 1.f / 30.f };
+
+		uint32_t m_FrameCount{};
+		uint32_t m_WarmupFrameCount{};
+
+		uint32_t m_Width{};
+		uint32_t m_Height{};
+		uint32_t m_ThreadCount{};
+		std::string m_Timestamp{};
+
+		std::vector<SceneResult> m_Results{};
+
+		void MoveCamera(Camera& camera, const Camera& startCamera, uint32_t frame) const;
+	};
+}
@@ -0,0 +1,300 @@
+#include "CompactBVH.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include "Simd.h"
+#include "WideBVH.h"
+
+namespace dae
+{
+	namespace
+	{
+		constexpr int MinExponent{ -126 };
+		constexpr int MaxExponent{ 127 };
+		constexpr int MaxQuantized{ UINT8_MAX };
+
+		// 2^exponent built from its bits, exactly what the simd test computes
+		float GetScale(int8_t exponent)
+		{
+			const uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+			float scale{};
+			std::memcpy(&scale, &bits, sizeof(float));
+			return scale;
+		}
+
+		// The build checks its rounding with this, the simd test has to do the same float math
+		float Dequantize(float origin, float scale, int quantized)
+		{
+			return origin + static_cast<float>(quantized) * scale;
+		}
+
+#ifdef SIMD_X86
+		__m128 Dequantize(const uint8_t (&quantized)[CompactBVHNode::Width], float origin, float scale)
+		{
+			int32_t packed{};
+			std::memcpy(&packed, quantized, sizeof(packed));
+
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+			const __m128 values = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+
+			return _mm_add_ps(_mm_set1_ps(origin), _mm_mul_ps(values, _mm_set1_ps(scale)));
+		}
+#endif
+	}
+
+	bool CompactBVH::Build(const BVH& bvh, const std::vector<int>& indices)
+	{
+		Clear();
+
+		const std::vector<BVHNode>& binaryNodes = bvh.GetNodes();
+		const std::vector<uint32_t>& primitiveIndices = bvh.GetPrimitiveIndices();
+		if (binaryNodes.empty())
+			return true;
+
+		if (primitiveIndices.size() > Node::LeafFirstMask + 1
+			|| std::any_of(indices.begin(), indices.end(), [](int index) { return static_cast<uint32_t>(index) >= MaxVertexCount; }))
+			return false;
+
+		m_Triangles.reserve(primitiveIndices.size());
+		for (const uint32_t triangleIndex : primitiveIndices)
+		{
+			uint64_t triangle{};
+			for (uint32_t vertex{}; vertex < 3; ++vertex)
+				triangle |= static_cast<uint64_t>(indices[triangleIndex * 3 + vertex]) << (vertex * VertexIndexBits);
+
+			m_Triangles.push_back(triangle);
+		}
+
+		// Reserved like WideBVH::Build, leaves too big for one slot can add a few nodes on top
+		m_Nodes.reserve(binaryNodes.size() / 2 + 1);
+		m_BinarySlots.reserve((binaryNodes.size() / 2 + 1) * Node::Width);
+
+		CollapseNode(binaryNodes, 0);
+		return true;
+	}
+
+	void CompactBVH::Refit(const BVH& bvh)
+	{
+		const std::vector<BVHNode>& binaryNodes = bvh.GetNodes();
+
+		for (size_t nodeIndex{}; nodeIndex < m_Nodes.size(); ++nodeIndex)
+		{
+			const uint32_t* pSlots = m_BinarySlots.data() + nodeIndex * Node::Width;
+
+			Vector3 minBounds[Node::Width]{};
+			Vector3 maxBounds[Node::Width]{};
+			for (uint32_t slot{}; slot < Node::Width; ++slot)
+			{
+				if (pSlots[slot] == Node::EmptySlot)
+					continue;
+
+				minBounds[slot] = binaryNodes[pSlots[slot]].minAABB;
+				maxBounds[slot] = binaryNodes[pSlots[slot]].maxAABB;
+			}
+
+			QuantizeNode(m_Nodes[nodeIndex], minBounds, maxBounds);
+		}
+	}
+
+	void CompactBVH::Clear()
+	{
+		m_Nodes.clear();
+		m_Triangles.clear();
+		m_BinarySlots.clear();
+	}
+
+	size_t CompactBVH::GetMemoryUsage() const
+	{
+		return m_Nodes.size() * sizeof(Node) + m_Triangles.size() * sizeof(uint64_t);
+	}
+
+	uint32_t CompactBVH::IntersectChildren(const Node& node, const Vector3& origin, const Vector3& inverseDirection,
+		float tMin, float tMax, float (&tEntries)[Node::Width])
+	{
+		const float scaleX = GetScale(node.exponents[0]);
+		const float scaleY = GetScale(node.exponents[1]);
+		const float scaleZ = GetScale(node.exponents[2]);
+
+#ifdef SIMD_X86
+		const __m128 originX = _mm_set1_ps(origin.x);
+		const __m128 originY = _mm_set1_ps(origin.y);
+		const __m128 originZ = _mm_set1_ps(origin.z);
+		const __m128 inverseDirectionX = _mm_set1_ps(inverseDirection.x);
+		const __m128 inverseDirectionY = _mm_set1_ps(inverseDirection.y);
+		const __m128 inverseDirectionZ = _mm_set1_ps(inverseDirection.z);
+
+		const __m128 tx1 = _mm_mul_ps(_mm_sub_ps(Dequantize(node.minX, node.origin[0], scaleX), originX), inverseDirectionX);
+		const __m128 tx2 = _mm_mul_ps(_mm_sub_ps(Dequantize(node.maxX, node.origin[0], scaleX), originX), inverseDirectionX);
+		const __m128 ty1 = _mm_mul_ps(_mm_sub_ps(Dequantize(node.minY, node.origin[1], scaleY), originY), inverseDirectionY);
+		const __m128 ty2 = _mm_mul_ps(_mm_sub_ps(Dequantize(node.maxY, node.origin[1], scaleY), originY), inverseDirectionY);
+		const __m128 tz1 = _mm_mul_ps(_mm_sub_ps(Dequantize(node.minZ, node.origin[2], scaleZ), originZ), inverseDirectionZ);
+		const __m128 tz2 = _mm_mul_ps(_mm_sub_ps(Dequantize(node.maxZ, node.origin[2], scaleZ), originZ), inverseDirectionZ);
+
+		const __m128 entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_min_ps(tz1, tz2));
+		const __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_max_ps(tz1, tz2));
+
+		// Hit rule of WideBVH::IntersectChildren, on the dequantized bounds
+		const __m128 isHit = _mm_and_ps(_mm_cmpge_ps(exit, _mm_max_ps(entry, _mm_set1_ps(tMin))), _mm_cmple_ps(entry, _mm_set1_ps(tMax)));
+
+		_mm_storeu_ps(tEntries, entry);
+		return static_cast<uint32_t>(_mm_movemask_ps(isHit)) & node.occupiedMask;
+#else
+		uint32_t hitMask{};
+		for (uint32_t i{}; i < Node::Width; ++i)
+		{
+			const float tx1 = (Dequantize(node.origin[0], scaleX, node.minX[i]) - origin.x) * inverseDirection.x;
+			const float tx2 = (Dequantize(node.origin[0], scaleX, node.maxX[i]) - origin.x) * inverseDirection.x;
+			const float ty1 = (Dequantize(node.origin[1], scaleY, node.minY[i]) - origin.y) * inverseDirection.y;
+			const float ty2 = (Dequantize(node.origin[1], scaleY, node.maxY[i]) - origin.y) * inverseDirection.y;
+			const float tz1 = (Dequantize(node.origin[2], scaleZ, node.minZ[i]) - origin.z) * inverseDirection.z;
+			const float tz2 = (Dequantize(node.origin[2], scaleZ, node.maxZ[i]) - origin.z) * inverseDirection.z;
+
+			const float entry = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2));
+			const float exit = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2));
+
+			tEntries[i] = entry;
+			if (exit >= std::max(entry, tMin) && entry <= tMax)
+				hitMask |= 1u << i;
+		}
+
+		return hitMask & node.occupiedMask;
+#endif
+	}
+
+	uint32_t CompactBVH::CollapseNode(const std::vector<BVHNode>& binaryNodes, uint32_t binaryIndex)
+	{
+		uint32_t slots[Node::Width];
+		const uint32_t splitAxes = CollapseBinaryLevels(binaryNodes, binaryIndex, slots);
+
+		// Written back once the children are collapsed, like in WideBVH::CollapseNode
+		Node node{};
+		std::fill(std::begin(node.children), std::end(node.children), Node::EmptySlot);
+		node.splitAxes = splitAxes;
+
+		Vector3 minBounds[Node::Width]{};
+		Vector3 maxBounds[Node::Width]{};
+
+		const uint32_t nodeIndex = static_cast<uint32_t>(m_Nodes.size());
+		m_Nodes.emplace_back();
+		m_BinarySlots.insert(m_BinarySlots.end(), std::begin(slots), std::end(slots));
+
+		for (uint32_t slot{}; slot < Node::Width; ++slot)
+		{
+			const uint32_t childIndex = slots[slot];
+			if (childIndex == Node::EmptySlot)
+				continue;
+
+			const BVHNode& child = binaryNodes[childIndex];
+			minBounds[slot] = child.minAABB;
+			maxBounds[slot] = child.maxAABB;
+
+			node.children[slot] = child.IsLeaf() ? AddLeaf(binaryNodes, childIndex, child.leftFirst, child.primitiveCount)
+				: CollapseNode(binaryNodes, childIndex);
+		}
+
+		QuantizeNode(node, minBounds, maxBounds);
+
+		m_Nodes[nodeIndex] = node;
+		return nodeIndex;
+	}
+
+	uint32_t CompactBVH::AddLeaf(const std::vector<BVHNode>& binaryNodes, uint32_t binaryLeafIndex, uint32_t first, uint32_t count)
+	{
+		if (count <= Node::MaxLeafCount)
+			return Node::LeafFlag | (count - 1) << Node::LeafFirstBits | first;
+
+		const BVHNode& binaryLeaf = binaryNodes[binaryLeafIndex];
+
+		// Every slot gets the bounds of the whole leaf. A binary leaf this big is a node BVH::SplitNode gave up on, at BVH::MaxDepth,
+		// because its centroids coincide or because a split left one side empty. BuildParallel keeps those as leaves whatever their size
+		Node node{};
+		std::fill(std::begin(node.children), std::end(node.children), Node::EmptySlot);
+
+		Vector3 minBounds[Node::Width]{};
+		Vector3 maxBounds[Node::Width]{};
+
+		const uint32_t nodeIndex = static_cast<uint32_t>(m_Nodes.size());
+		m_Nodes.emplace_back();
+		const size_t slotsIndex = m_BinarySlots.size();
+		m_BinarySlots.insert(m_BinarySlots.end(), Node::Width, Node::EmptySlot);
+
+		const uint32_t slotCount = (count + Node::Width - 1) / Node::Width;
+		for (uint32_t slot{}; slot < Node::Width; ++slot)
+		{
+			const uint32_t slotFirst = first + slot * slotCount;
+			const uint32_t slotEnd = std::min(slotFirst + slotCount, first + count);
+			if (slotFirst >= slotEnd)
+				break;
+
+			minBounds[slot] = binaryLeaf.minAABB;
+			maxBounds[slot] = binaryLeaf.maxAABB;
+			m_BinarySlots[slotsIndex + slot] = binaryLeafIndex;
+			node.children[slot] = AddLeaf(binaryNodes, binaryLeafIndex, slotFirst, slotEnd - slotFirst);
+		}
+
+		QuantizeNode(node, minBounds, maxBounds);
+
+		m_Nodes[nodeIndex] = node;
+		return nodeIndex;
+	}
+
+	void CompactBVH::QuantizeNode(Node& node, const Vector3 (&minBounds)[Node::Width], const Vector3 (&maxBounds)[Node::Width])
+	{
+		// The box of the node is the one its children are quantized in
+		Vector3 nodeMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 nodeMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (uint32_t slot{}; slot < Node::Width; ++slot)
+		{
+			if (node.children[slot] == Node::EmptySlot)
+				continue;
+
+			nodeMin = Vector3::Min(nodeMin, minBounds[slot]);
+			nodeMax = Vector3::Max(nodeMax, maxBounds[slot]);
+			node.occupiedMask |= 1u << slot;
+		}
+
+		uint8_t* const quantizedMins[3]{ node.minX, node.minY, node.minZ };
+		uint8_t* const quantizedMaxs[3]{ node.maxX, node.maxY, node.maxZ };
+
+		for (int axis{}; axis < 3; ++axis)
+		{
+			const float origin = nodeMin[axis];
+
+			// Smallest power of 2 step that still reaches the far side of the node in MaxQuantized steps
+			int exponent{};
+			std::frexp((nodeMax[axis] - origin) / MaxQuantized, &exponent);
+			exponent = std::clamp(exponent, MinExponent, MaxExponent);
+			while (exponent < MaxExponent && Dequantize(origin, GetScale(static_cast<int8_t>(exponent)), MaxQuantized) < nodeMax[axis])
+				++exponent;
+
+			node.origin[axis] = origin;
+			node.exponents[axis] = static_cast<int8_t>(exponent);
+			const float scale = GetScale(node.exponents[axis]);
+
+			for (uint32_t slot{}; slot < Node::Width; ++slot)
+			{
+				if (node.children[slot] == Node::EmptySlot)
+					continue;
+
+				// Rounded outwards, then nudged until the float math of the traversal covers the child too
+				const float childMin = minBounds[slot][axis];
+				const float childMax = maxBounds[slot][axis];
+
+				int quantizedMin = std::clamp(static_cast<int>(std::floor((childMin - origin) / scale)), 0, MaxQuantized);
+				while (quantizedMin > 0 && Dequantize(origin, scale, quantizedMin) > childMin)
+					--quantizedMin;
+
+				int quantizedMax = std::clamp(static_cast<int>(std::ceil((childMax - origin) / scale)), 0, MaxQuantized);
+				while (quantizedMax < MaxQuantized && Dequantize(origin, scale, quantizedMax) < childMax)
+					++quantizedMax;
+
+				quantizedMins[axis][slot] = static_cast<uint8_t>(quantizedMin);
+				quantizedMaxs[axis][slot] = static_cast<uint8_t>(quantizedMax);
+			}
+		}
+	}
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "BVH.h"
+#include "Vector3.h"
+#include "WideBVH.h"
+
+namespace dae
+{
+	/**
+	 * \brief 4 wide node with its child bounds quantized to 8 bits in the box of the node, a whole node fits one cache line.
+	 * A child bound is origin + quantized * 2^exponent along its axis, rounded outwards so the child is always covered.
+	 */
+	struct alignas(64) CompactBVHNode
+	{
+		static constexpr uint32_t Width{ 4 };
+		static constexpr uint32_t LeafFlag{ 0x80000000u };
+		static constexpr uint32_t EmptySlot{ UINT32_MAX };
+		// Leaf: LeafFlag | (count - 1) << LeafFirstBits | first
+		static constexpr uint32_t LeafFirstBits{ 27 };
+		static constexpr uint32_t LeafFirstMask{ (1u << LeafFirstBits) - 1 };
+		static constexpr uint32_t MaxLeafCount{ 16 };
+
+		float origin[3];
+		int8_t exponents[3];
+		// Bit per slot that holds a child
+		uint8_t occupiedMask;
+
+		uint8_t minX[Width];
+		uint8_t minY[Width];
+		uint8_t minZ[Width];
+		uint8_t maxX[Width];
+		uint8_t maxY[Width];
+		uint8_t maxZ[Width];
+
+		// Node index, leaf or EmptySlot
+		uint32_t children[Width];
+		// Same as WideBVHNode::splitAxes
+		uint32_t splitAxes;
+
+		static bool IsLeaf(uint32_t child) { return (child & LeafFlag) != 0; }
+		static uint32_t GetLeafFirst(uint32_t child) { return child & LeafFirstMask; }
+		static uint32_t GetLeafCount(uint32_t child) { return ((child & ~LeafFlag) >> LeafFirstBits) + 1; }
+	};
+
+	static_assert(sizeof(CompactBVHNode) == 64, "A compact node should fill 1 cache line");
+
+	/**
+	 * \brief Memory compact 4 wide BVH over the triangles of a mesh, collapsed from its binary BVH.
+	 * Nodes are a quarter of the size of WideBVHNode<4>, and the triangles of every leaf are stored in place as
+	 * packed vertex indices, so tracing a ray never goes through the primitive index list or the index triples.
+	 */
+	class CompactBVH final
+	{
+	public:
+		using Node = CompactBVHNode;
+
+		// 3 of them are packed in a 64 bit triangle
+		static constexpr uint32_t VertexIndexBits{ 21 };
+		static constexpr uint32_t MaxVertexCount{ 1u << VertexIndexBits };
+		// Leaves bigger than MaxLeafCount are split over extra levels of nodes, at most this many
+		static constexpr uint32_t MaxLeafLevels{ (Node::LeafFirstBits - 4) / 2 + 1 };
+		// Every node on the way down defers at most 3 children
+		static constexpr uint32_t MaxStackSize{ (BVH::MaxDepth / 2 + 1 + MaxLeafLevels) * (Node::Width - 1) + 1 };
+
+		/**
+		 * \brief Collapsed the same way as WideBVH<4>::Build, so it shares the leaf order of bvh with the packed triangles
+		 * \param indices triangle index triples bvh was built over
+		 * \return false when the mesh has too many vertices or triangles to pack, the compact tree is left empty
+		 */
+		bool Build(const BVH& bvh, const std::vector<int>& indices);
+		// Quantizes the child bounds of bvh again after it was refitted, its topology has to be the one it was built from
+		void Refit(const BVH& bvh);
+		void Clear();
+
+		bool IsBuilt() const { return !m_Nodes.empty(); }
+
+		const std::vector<Node>& GetNodes() const { return m_Nodes; }
+		// Same as WideBVH::IsLeaf and GetLeaf, the range is stored in the child itself
+		static bool IsLeaf(uint32_t child) { return Node::IsLeaf(child); }
+		static WideBVHLeaf GetLeaf(uint32_t child) { return { Node::GetLeafFirst(child), Node::GetLeafCount(child) }; }
+		// Vertex 0, 1 or 2 of the triangle at position in leaf order, the bvh primitive index list maps position back to the mesh
+		uint32_t GetVertexIndex(uint32_t position, uint32_t vertex) const
+		{
+			return static_cast<uint32_t>(m_Triangles[position] >> (vertex * VertexIndexBits)) & (MaxVertexCount - 1);
+		}
+
+		// Bytes of the nodes and packed triangles
+		size_t GetMemoryUsage() const;
+
+		// Same contract as WideBVH::IntersectChildren
+		static uint32_t IntersectChildren(const Node& node, const Vector3& origin, const Vector3& inverseDirection,
+			float tMin, float tMax, float (&tEntries)[Node::Width]);
+
+	private:
+		std::vector<Node> m_Nodes{};
+		// 3 vertex indices per triangle in bvh leaf order
+		std::vector<uint64_t> m_Triangles{};
+		// Binary node every slot takes its bounds from, Width per node, only Refit reads it
+		std::vector<uint32_t> m_BinarySlots{};
+
+		uint32_t CollapseNode(const std::vector<BVHNode>& binaryNodes, uint32_t binaryIndex);
+		// A leaf too big for one child becomes a node with the leaf range split over its slots
+		uint32_t AddLeaf(const std::vector<BVHNode>& binaryNodes, uint32_t binaryLeafIndex, uint32_t first, uint32_t count);
+		static void QuantizeNode(Node& node, const Vector3 (&minBounds)[Node::Width], const Vector3 (&maxBounds)[Node::Width]);
+	};
+}
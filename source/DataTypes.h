@@ -1,7 +1,16 @@
 #pragma once
+#include <atomic>
 #include <cassert>
+#include <memory>
 
 #include "Math.h"
+#include "BackgroundThread.h"
+#include "BVH.h"
+#include "CompactBVH.h"
+#include "PackedTriangles.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+#include "WideBVH.h"
 #include "vector"
 #include <stdexcept>
 
@@ -31,6 +40,35 @@ namespace dae
 		NoCulling
 	};
 
+	enum class MeshTraversal
+	{
+		Linear,
+		BVH,
+		// The binary bvh collapsed into 4 or 8 children per node
+		BVH4,
+		BVH8,
+		// 4 wide with 8 bit child bounds and the leaf triangles packed in place, a fraction of the memory of the others
+		Compact
+	};
+
+	inline const char* GetMeshTraversalName(MeshTraversal traversal)
+	{
+		switch (traversal)
+		{
+		case MeshTraversal::Linear:
+			return "Linear";
+		case MeshTraversal::BVH:
+			return "BVH";
+		case MeshTraversal::BVH4:
+			return "BVH4";
+		case MeshTraversal::BVH8:
+			return "BVH8";
+		case MeshTraversal::Compact:
+			return "Compact";
+		}
+		return "Unknown";
+	}
+
 	struct Triangle
 	{
 		Triangle() = default;
@@ -55,6 +93,18 @@ namespace dae
 		unsigned char materialIndex{};
 	};
 
+	// Triangle of a mesh baked for the scalar hit test: edges precomputed, no indices to follow and one cache line each
+	struct alignas(64) TriangleRecord
+	{
+		Vector3 v0{};
+		Vector3 edge1{};
+		Vector3 edge2{};
+		Vector3 normal{};
+
+		// In the mesh, for the normal of the hit record
+		uint32_t triangleIndex{};
+	};
+
 	struct TriangleMesh
 	{
 		TriangleMesh() = default;
@@ -80,11 +130,17 @@ namespace dae
 		unsigned char materialIndex{};
 
 		TriangleCullMode cullMode{TriangleCullMode::BackFaceCulling};
+		MeshTraversal traversal{MeshTraversal::BVH};
+		TriangleKernel triangleKernel{GetBestTriangleKernel()};
 
 		Matrix rotationTransform{};
 		Matrix translationTransform{};
 		Matrix scaleTransform{};
 
+		// Instanced meshes never transform their vertices, rays are moved into object space instead
+		bool isInstanced{ false };
+		Matrix inverseTransform{};
+
 		Vector3 minAABB{};
 		Vector3 maxAABB{};
 
@@ -94,6 +150,31 @@ namespace dae
 		std::vector<Vector3> transformedPositions{};
 		std::vector<Vector3> transformedNormals{};
 
+		// Built over the transformed triangles (object space positions when instanced),
+		// primitive i is the triangle starting at indices[i * 3]
+		BVH bvh{};
+		// SAH cost of bvh right after it was (re)built, refits that make it much worse start a rebuild
+		float bvhBuildCost{};
+		// Shared with the job building it, so a mesh that drops it never waits for the job to finish
+		struct BVHRebuild
+		{
+			BVH bvh{};
+			std::atomic<bool> isDone{ false };
+		};
+		// Rebuild running on a background thread, swapped in by the first UpdateBVH after it finished
+		std::shared_ptr<BVHRebuild> pBVHRebuild{};
+		// Collapsed from bvh for the wide and compact traversals, only the one the traversal uses is built
+		WideBVH<4> bvh4{};
+		WideBVH<8> bvh8{};
+		CompactBVH compactBVH{};
+		// compactBVH refused the mesh, it is not tried again until bvh gets a new topology
+		bool isCompactBVHRefused{ false };
+
+		// Same triangles in bvh leaf order for the simd kernels, empty when the kernel is scalar
+		PackedTriangles packedTriangles{};
+		// Same triangles in bvh leaf order for the scalar kernel, empty when the kernel is simd or compactBVH is built
+		std::vector<TriangleRecord> triangleRecords{};
+
 		void Translate(const Vector3& translation)
 		{
 			translationTransform = Matrix::CreateTranslation(translation);
@@ -133,30 +214,52 @@ namespace dae
 			if (indices.size() % 3 != 0)
 				throw std::runtime_error("Triangle model has no multiple of 3 indices");
 
-			int vertexCount{ 0 };
-			for (int index{}; index < indices.size(); index++)
-			{
-				vertexCount++;
+			// Overwritten in place, so it can run again after the positions moved
+			normals.resize(indices.size() / 3);
 
-				if (vertexCount == 3)
-				{
-					Vector3 v0 = positions[indices[index - 2]];
-					Vector3 v1 = positions[indices[index - 1]];
-					Vector3 v2 = positions[indices[index]];
-
-					Vector3 n = Vector3::Cross(v1 - v0, v2 - v0).Normalized();
-					normals.push_back(n);
+			for (size_t triangle{}; triangle < normals.size(); ++triangle)
+			{
+				const Vector3& v0 = positions[indices[triangle * 3]];
+				const Vector3& v1 = positions[indices[triangle * 3 + 1]];
+				const Vector3& v2 = positions[indices[triangle * 3 + 2]];
 
-					// reset index counter
-					vertexCount = 0;
-				}
+				normals[triangle] = Vector3::Cross(v1 - v0, v2 - v0).Normalized();
 			}
 		}
 
-		void UpdateTransforms()
+		// pThreadPool refits and repacks meshes that are not instanced in parallel, pRebuildThread rebuilds it when refitting wore it out
+		void UpdateTransforms(ThreadPool* pThreadPool = nullptr, BackgroundThread* pRebuildThread = nullptr)
 		{
+			PROFILE_ZONE("TriangleMesh::UpdateTransforms");
+
 			const Matrix finalTransform = scaleTransform * rotationTransform * translationTransform;
 
+			if (isInstanced)
+			{
+				inverseTransform = Matrix::Inverse(finalTransform);
+				UpdateTransformedAABB(finalTransform);
+
+				// Object space never changes, only (re)build when triangles were added
+				const bool bvhIsStale = bvh.GetPrimitiveIndices().size() != indices.size() / 3;
+				const bool rebuildBVH = traversal != MeshTraversal::Linear && bvhIsStale;
+				if (rebuildBVH)
+					bvh.BuildFromTriangles(positions, indices);
+
+				UpdateCollapsedBVH(rebuildBVH, false);
+
+				// Repacked in the new leaf order, or when the kernel switched from or to scalar
+				const size_t packedTriangleCount = triangleKernel == TriangleKernel::Scalar ? 0 : indices.size() / 3;
+				if (rebuildBVH || packedTriangles.GetTriangleCount() != packedTriangleCount)
+					UpdatePackedTriangles(positions, normals, pThreadPool);
+
+				// After UpdateCollapsedBVH, a compact tree that could not be built falls back to the records
+				const bool useRecords = triangleKernel == TriangleKernel::Scalar && !compactBVH.IsBuilt();
+				if (rebuildBVH || triangleRecords.size() != (useRecords ? indices.size() / 3 : 0))
+					UpdateTriangleRecords(positions, normals, pThreadPool);
+
+				return;
+			}
+
 			transformedNormals.clear();
 			transformedNormals.reserve(normals.size());
 
@@ -176,6 +279,200 @@ namespace dae
 				Vector3 result = rotationTransform.TransformVector(normal);
 				transformedNormals.emplace_back(result);
 			}
+
+			// The collapsed trees only follow the refit, unless bvh got a new topology
+			const bool isRebuilt = traversal != MeshTraversal::Linear && UpdateBVH(transformedPositions, pThreadPool, pRebuildThread);
+			UpdateCollapsedBVH(isRebuilt, true);
+
+			UpdatePackedTriangles(transformedPositions, transformedNormals, pThreadPool);
+			UpdateTriangleRecords(transformedPositions, transformedNormals, pThreadPool);
+		}
+
+		// Keeps the topology of bvh while the triangles move, a full rebuild every frame would cost more than
+		// tracing. Only once the refitted tree costs maxCostGrowth times what it did after its build, a new one is
+		// built from a copy of the triangles on pRebuildThread while the old one keeps being refitted.
+		// Without a rebuild thread it is rebuilt in place on pThreadPool.
+		// Returns true when bvh has a new topology, built or swapped for the rebuilt one
+		bool UpdateBVH(const std::vector<Vector3>& meshPositions, ThreadPool* pThreadPool, BackgroundThread* pRebuildThread)
+		{
+			constexpr float maxCostGrowth{ 1.5f };
+
+			// Triangles were added, a rebuild still running is for the old ones.
+			// It is only let go of, the job finishes on its own thread and nobody waits for it
+			if (bvh.GetPrimitiveIndices().size() != indices.size() / 3)
+			{
+				pBVHRebuild.reset();
+				bvh.BuildFromTriangles(meshPositions, indices, pThreadPool);
+				bvhBuildCost = bvh.GetSAHCost();
+				return true;
+			}
+
+			bool isRebuilt{};
+			if (pBVHRebuild && pBVHRebuild->isDone.load(std::memory_order_acquire))
+			{
+				bvh = std::move(pBVHRebuild->bvh);
+				pBVHRebuild.reset();
+				isRebuilt = true;
+			}
+
+			const float cost = bvh.RefitTriangles(meshPositions, indices, pThreadPool);
+
+			// The new tree was built for the triangles of a few frames ago, refitted to these it is the new baseline
+			if (isRebuilt)
+			{
+				bvhBuildCost = cost;
+			}
+			else if (!pBVHRebuild && cost > bvhBuildCost * maxCostGrowth)
+			{
+				if (!pRebuildThread)
+				{
+					bvh.BuildFromTriangles(meshPositions, indices, pThreadPool);
+					bvhBuildCost = bvh.GetSAHCost();
+					return true;
+				}
+
+				pBVHRebuild = std::make_shared<BVHRebuild>();
+				pRebuildThread->Enqueue([pRebuild = pBVHRebuild, positionsCopy = meshPositions, indicesCopy = indices]
+				{
+					PROFILE_ZONE("TriangleMesh::RebuildBVH");
+
+					pRebuild->bvh.BuildFromTriangles(positionsCopy, indicesCopy);
+					pRebuild->isDone.store(true, std::memory_order_release);
+				});
+			}
+
+			return isRebuilt;
+		}
+
+		// Collapsed again when bvh has a new topology, a refitted bvh only hands its bounds down
+		void UpdateCollapsedBVH(bool isRebuilt, bool isRefitted)
+		{
+			if (traversal == MeshTraversal::BVH4)
+			{
+				if (isRebuilt || !bvh4.IsBuilt())
+					bvh4.Build(bvh);
+				else if (isRefitted)
+					bvh4.Refit(bvh);
+			}
+			else
+			{
+				bvh4.Clear();
+			}
+
+			if (traversal == MeshTraversal::BVH8)
+			{
+				if (isRebuilt || !bvh8.IsBuilt())
+					bvh8.Build(bvh);
+				else if (isRefitted)
+					bvh8.Refit(bvh);
+			}
+			else
+			{
+				bvh8.Clear();
+			}
+
+			// Meshes with too many vertices to pack keep tracing bvh
+			if (traversal == MeshTraversal::Compact)
+			{
+				if (isRebuilt || (!compactBVH.IsBuilt() && !isCompactBVHRefused))
+					isCompactBVHRefused = !compactBVH.Build(bvh, indices);
+				else if (isRefitted)
+					compactBVH.Refit(bvh);
+			}
+			else
+			{
+				compactBVH.Clear();
+			}
+		}
+
+		// Bytes of what the traversal reads to find the triangles a ray hits, besides the vertex positions and normals
+		size_t GetTraversalMemoryUsage() const
+		{
+			const size_t indexBytes = indices.size() * sizeof(int);
+
+			switch (traversal)
+			{
+			case MeshTraversal::BVH:
+				return bvh.GetMemoryUsage() + indexBytes;
+			case MeshTraversal::BVH4:
+				return bvh4.GetMemoryUsage() + bvh.GetPrimitiveIndices().size() * sizeof(uint32_t) + indexBytes;
+			case MeshTraversal::BVH8:
+				return bvh8.GetMemoryUsage() + bvh.GetPrimitiveIndices().size() * sizeof(uint32_t) + indexBytes;
+			case MeshTraversal::Compact:
+				// The primitive index list is only read once per hit, to find the normal
+				if (compactBVH.IsBuilt())
+					return compactBVH.GetMemoryUsage() + bvh.GetPrimitiveIndices().size() * sizeof(uint32_t);
+				return bvh.GetMemoryUsage() + indexBytes;
+			default:
+				return indexBytes;
+			}
+		}
+
+		void UpdatePackedTriangles(const std::vector<Vector3>& meshPositions, const std::vector<Vector3>& meshNormals, ThreadPool* pThreadPool)
+		{
+			if (triangleKernel == TriangleKernel::Scalar)
+			{
+				packedTriangles.Clear();
+				return;
+			}
+
+			float cullSign{};
+			if (cullMode == TriangleCullMode::BackFaceCulling)
+				cullSign = 1.f;
+			else if (cullMode == TriangleCullMode::FrontFaceCulling)
+				cullSign = -1.f;
+
+			// Packed in leaf order whenever there is a bvh, so a leaf is a contiguous range of lanes
+			packedTriangles.Pack(meshPositions, meshNormals, indices, bvh.GetPrimitiveIndices(), cullSign, pThreadPool);
+		}
+
+		void UpdateTriangleRecords(const std::vector<Vector3>& meshPositions, const std::vector<Vector3>& meshNormals, ThreadPool* pThreadPool)
+		{
+			PROFILE_ZONE("TriangleMesh::UpdateTriangleRecords");
+
+			// A built compact tree reads its own packed triangles, meshes it refused keep tracing bvh with the records.
+			// Call after UpdateCollapsedBVH
+			if (triangleKernel != TriangleKernel::Scalar || compactBVH.IsBuilt())
+			{
+				triangleRecords.clear();
+				return;
+			}
+
+			const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+			const std::vector<uint32_t>& order = bvh.GetPrimitiveIndices();
+			const bool isLeafOrder = order.size() == triangleCount;
+
+			triangleRecords.resize(triangleCount);
+
+			// Same blocks as PackedTriangles::Pack, small meshes stay on the calling thread
+			constexpr uint32_t blockSize{ 4096 };
+			const uint32_t blockCount = (triangleCount + blockSize - 1) / blockSize;
+			auto fillBlock = [&](uint32_t block)
+			{
+				const uint32_t positionEnd = std::min(triangleCount, (block + 1) * blockSize);
+				for (uint32_t position{ block * blockSize }; position < positionEnd; ++position)
+				{
+					const uint32_t triangleIndex = isLeafOrder ? order[position] : position;
+					const Vector3& v0 = meshPositions[indices[triangleIndex * 3]];
+
+					TriangleRecord& record = triangleRecords[position];
+					record.v0 = v0;
+					record.edge1 = meshPositions[indices[triangleIndex * 3 + 1]] - v0;
+					record.edge2 = meshPositions[indices[triangleIndex * 3 + 2]] - v0;
+					record.normal = meshNormals[triangleIndex];
+					record.triangleIndex = triangleIndex;
+				}
+			};
+
+			if (pThreadPool && blockCount > 1)
+			{
+				pThreadPool->Dispatch(blockCount, fillBlock);
+			}
+			else
+			{
+				for (uint32_t block{}; block < blockCount; ++block)
+					fillBlock(block);
+			}
 		}
 
 		void UpdateAABB()
@@ -222,7 +519,7 @@ namespace dae
 			tMinAABB = Vector3::Min(tAABB, tMinAABB);
 			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
 
-			tAABB = finalTransform.TransformPoint(minAABB.x, maxAABB.y, minAABB.z);
+			tAABB = finalTransform.TransformPoint(minAABB.x, maxAABB.y, maxAABB.z);
 			tMinAABB = Vector3::Min(tAABB, tMinAABB);
 			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
 
@@ -258,6 +555,64 @@ namespace dae
 		float max{ FLT_MAX };
 	};
 
+	// 2x2 block of camera rays sharing one origin, traced together with one ray per sse lane
+	struct RayPacket
+	{
+		static constexpr uint32_t Width{ 2 };
+		static constexpr uint32_t Size{ Width * Width };
+
+		Vector3 origin{};
+		alignas(16) float directionX[Size]{};
+		alignas(16) float directionY[Size]{};
+		alignas(16) float directionZ[Size]{};
+		float min{ 0.0001f };
+
+		// Bit per lane that holds a ray, packets on the right and bottom edge of the screen can be partial
+		uint32_t activeMask{};
+
+		Vector3 GetDirection(uint32_t lane) const { return { directionX[lane], directionY[lane], directionZ[lane] }; }
+	};
+
+	// Side planes of the pyramid through the corners of a screen tile, the apex is the camera
+	struct Frustum
+	{
+		// corners: ray directions through the tile corners, in order around the tile
+		Frustum(const Vector3& _origin, const Vector3 (&corners)[4]) :
+			origin{ _origin }
+		{
+			const Vector3 center = corners[0] + corners[1] + corners[2] + corners[3];
+
+			for (int i{}; i < 4; ++i)
+			{
+				// Point inwards whatever the winding of the corners is
+				const Vector3 normal = Vector3::Cross(corners[i], corners[(i + 1) % 4]);
+				normals[i] = Vector3::Dot(normal, center) < 0.f ? -normal : normal;
+			}
+		}
+
+		Vector3 origin{};
+		Vector3 normals[4]{};
+
+		// Conservative, boxes just outside a corner of the pyramid still pass
+		bool Overlaps(const Vector3& minAABB, const Vector3& maxAABB) const
+		{
+			for (const Vector3& normal : normals)
+			{
+				// Corner of the box farthest along the normal
+				const Vector3 corner{
+					normal.x >= 0.f ? maxAABB.x : minAABB.x,
+					normal.y >= 0.f ? maxAABB.y : minAABB.y,
+					normal.z >= 0.f ? maxAABB.z : minAABB.z
+				};
+
+				if (Vector3::Dot(normal, corner - origin) < 0.f)
+					return false;
+			}
+
+			return true;
+		}
+	};
+
 	struct HitRecord
 	{
 		Vector3 origin{};
@@ -267,5 +622,15 @@ namespace dae
 		bool didHit{ false };
 		unsigned char materialIndex{ 0 };
 	};
+
+	// What a closest hit search keeps per hit, the HitRecord is only filled in for the one that ends up closest
+	struct HitCandidate
+	{
+		static constexpr uint32_t InvalidPrimitive{ UINT32_MAX };
+
+		float t = FLT_MAX;
+		// Triangle of a mesh, spheres and planes leave it invalid
+		uint32_t primitiveIndex{ InvalidPrimitive };
+	};
 #pragma endregion
 }
\ No newline at end of file
@@ -5,6 +5,115 @@
 
 namespace dae
 {
+#pragma region Material DATA
+	enum class MaterialType : uint8_t
+	{
+		SolidColor,
+		Lambert,
+		LambertPhong,
+		CookTorrence
+	};
+
+	struct SolidColorData
+	{
+		ColorRGB color{};
+	};
+
+	struct LambertData
+	{
+		ColorRGB diffuseColor{};
+		float diffuseReflectance{}; //kd
+	};
+
+	struct LambertPhongData
+	{
+		ColorRGB diffuseColor{};
+		float diffuseReflectance{}; //kd
+		float specularReflectance{}; //ks
+		float phongExponent{};
+	};
+
+	struct CookTorrenceData
+	{
+		ColorRGB albedo{};
+		float metalness{};
+		float roughness{};
+	};
+
+	/**
+	 * \brief Plain copy of the parameters of a material, the scene keeps these in one flat table
+	 * so shading a hit is a switch on the type instead of a virtual call through a heap pointer
+	 */
+	struct MaterialData
+	{
+		MaterialType type{ MaterialType::SolidColor };
+
+		union
+		{
+			SolidColorData solidColor{};
+			LambertData lambert;
+			LambertPhongData lambertPhong;
+			CookTorrenceData cookTorrence;
+		};
+	};
+
+	namespace MaterialUtils
+	{
+		/**
+		 * \brief Function used to calculate the correct color for the specific material and its parameters
+		 * \param hitRecord current hitrecord
+		 * \param l light direction
+		 * \param v view direction
+		 * \return color
+		 */
+		inline ColorRGB Shade(const MaterialData& material, const HitRecord& hitRecord, const Vector3& l, const Vector3& v)
+		{
+			switch (material.type)
+			{
+			case MaterialType::SolidColor:
+				return material.solidColor.color;
+			case MaterialType::Lambert:
+				return BRDF::Lambert(material.lambert.diffuseReflectance, material.lambert.diffuseColor);
+			case MaterialType::LambertPhong:
+			{
+				const LambertPhongData& lambertPhong = material.lambertPhong;
+
+				ColorRGB specularReflection = BRDF::Phong(lambertPhong.specularReflectance, lambertPhong.phongExponent, l, -v, hitRecord.normal);
+				ColorRGB diffuse = BRDF::Lambert(lambertPhong.diffuseReflectance, lambertPhong.diffuseColor);
+
+				return diffuse + specularReflection;
+			}
+			case MaterialType::CookTorrence:
+			{
+				const CookTorrenceData& cookTorrence = material.cookTorrence;
+				const Vector3 h = (v + l) / (v + l).Magnitude();
+
+				// Decide base reflectivity of the surface
+				ColorRGB f0{ ((int)cookTorrence.metalness == 0) ? ColorRGB{0.04f, 0.04f, 0.04f} : cookTorrence.albedo };
+
+				// Specular components
+				const ColorRGB F = BRDF::FresnelFunction_Schlick(h, v, f0);
+				const float D = BRDF::NormalDistribution_GGX(hitRecord.normal, h, cookTorrence.roughness);
+				const float G = BRDF::GeometryFunction_Smith(hitRecord.normal, v, l, cookTorrence.roughness);
+
+				// Specular
+				ColorRGB nominator{F * D * G};
+				float denominator{ 4 * (Vector3::Dot(v, hitRecord.normal) * Vector3::Dot(l, hitRecord.normal)) };
+				ColorRGB specular{ nominator / denominator };
+
+				// Defuse
+				const ColorRGB kd = ColorRGB{ 1,1,1 } - F;
+				const ColorRGB diffuse = BRDF::Lambert(kd, cookTorrence.albedo);
+
+				return diffuse + specular;
+			}
+			}
+
+			return {};
+		}
+	}
+#pragma endregion
+
 #pragma region Material BASE
 	class Material
 	{
@@ -25,6 +134,9 @@ namespace dae
 		 * \return color
 		 */
 		virtual ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) = 0;
+
+		// Parameters for the flat material table, read once when the material is added to a scene
+		virtual MaterialData GetData() const = 0;
 	};
 #pragma endregion
 
@@ -40,7 +152,15 @@ namespace dae
 
 		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) override
 		{
-			return m_Color;
+			return MaterialUtils::Shade(GetData(), hitRecord, l, v);
+		}
+
+		MaterialData GetData() const override
+		{
+			MaterialData data{};
+			data.type = MaterialType::SolidColor;
+			data.solidColor = { m_Color };
+			return data;
 		}
 
 	private:
@@ -59,7 +179,15 @@ namespace dae
 
 		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
 		{
-			return BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor);
+			return MaterialUtils::Shade(GetData(), hitRecord, l, v);
+		}
+
+		MaterialData GetData() const override
+		{
+			MaterialData data{};
+			data.type = MaterialType::Lambert;
+			data.lambert = { m_DiffuseColor, m_DiffuseReflectance };
+			return data;
 		}
 
 	private:
@@ -82,10 +210,15 @@ namespace dae
 
 		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
 		{
-			ColorRGB specularReflection = BRDF::Phong(m_SpecularReflectance, m_PhongExponent, l, -v, hitRecord.normal);
-			ColorRGB diffuse = BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor);
+			return MaterialUtils::Shade(GetData(), hitRecord, l, v);
+		}
 
-			return diffuse + specularReflection;
+		MaterialData GetData() const override
+		{
+			MaterialData data{};
+			data.type = MaterialType::LambertPhong;
+			data.lambertPhong = { m_DiffuseColor, m_DiffuseReflectance, m_SpecularReflectance, m_PhongExponent };
+			return data;
 		}
 
 	private:
@@ -108,26 +241,15 @@ namespace dae
 
 		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
 		{
-			const Vector3 h = (v + l) / (v + l).Magnitude();
-
-			// Decide base reflectivity of the surface
-			ColorRGB f0{ ((int)m_Metalness == 0) ? ColorRGB{0.04f, 0.04f, 0.04f} : m_Albedo };
-
-			// Specular components
-			const ColorRGB F = BRDF::FresnelFunction_Schlick(h, v, f0);
-			const float D = BRDF::NormalDistribution_GGX(hitRecord.normal, h, m_Roughness);
-			const float G = BRDF::GeometryFunction_Smith(hitRecord.normal, v, l, m_Roughness);
-
-			// Specular
-			ColorRGB nominator{F * D * G};
-			float denominator{ 4 * (Vector3::Dot(v, hitRecord.normal) * Vector3::Dot(l, hitRecord.normal)) };
-			ColorRGB specular{ nominator / denominator };
-
-			// Defuse
-			const ColorRGB kd = ColorRGB{ 1,1,1 } - F;
-			const ColorRGB diffuse = BRDF::Lambert(kd, m_Albedo);
+			return MaterialUtils::Shade(GetData(), hitRecord, l, v);
+		}
 
-			return diffuse + specular;
+		MaterialData GetData() const override
+		{
+			MaterialData data{};
+			data.type = MaterialType::CookTorrence;
+			data.cookTorrence = { m_Albedo, m_Metalness, m_Roughness };
+			return data;
 		}
 
 	private:
@@ -1,5 +1,6 @@
 #pragma once
 #include <cmath>
+#include <cstdint>
 
 namespace dae
 {
@@ -40,4 +41,18 @@ namespace dae
 		}
 		return value;
 	}
+
+	//PCG output permutation, cheap integer hash for per pixel random numbers
+	inline uint32_t Hash(uint32_t value)
+	{
+		const uint32_t state = value * 747796405u + 2891336453u;
+		const uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	//Float in [0, 1) from the top 24 bits of the hash
+	inline float HashToFloat(uint32_t value)
+	{
+		return static_cast<float>(Hash(value) >> 8) * (1.f / 16777216.f);
+	}
 }
\ No newline at end of file
@@ -141,6 +141,40 @@ namespace dae {
 		return out;
 	}
 
+	const Matrix& Matrix::Inverse()
+	{
+		//Affine inverse, assumes the last column is (0, 0, 0, 1)
+		const Vector3 xAxis{ data[0] };
+		const Vector3 yAxis{ data[1] };
+		const Vector3 zAxis{ data[2] };
+		const Vector3 t{ data[3] };
+
+		const float determinant = Vector3::Dot(xAxis, Vector3::Cross(yAxis, zAxis));
+		assert(determinant != 0.f && "Matrix is not invertible");
+
+		const float invDeterminant = 1.f / determinant;
+
+		//Columns of the inverse 3x3 are the cross products of the rows
+		const Vector3 c0{ Vector3::Cross(yAxis, zAxis) * invDeterminant };
+		const Vector3 c1{ Vector3::Cross(zAxis, xAxis) * invDeterminant };
+		const Vector3 c2{ Vector3::Cross(xAxis, yAxis) * invDeterminant };
+
+		data[0] = { c0.x, c1.x, c2.x, 0 };
+		data[1] = { c0.y, c1.y, c2.y, 0 };
+		data[2] = { c0.z, c1.z, c2.z, 0 };
+		data[3] = { -Vector3::Dot(t, c0), -Vector3::Dot(t, c1), -Vector3::Dot(t, c2), 1 };
+
+		return *this;
+	}
+
+	Matrix Matrix::Inverse(const Matrix& m)
+	{
+		Matrix out{ m };
+		out.Inverse();
+
+		return out;
+	}
+
 	Vector3 Matrix::GetAxisX() const
 	{
 		return data[0];
@@ -0,0 +1,656 @@
+#include "MeshLoader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <type_traits>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "BVH.h"
+#include "ThreadPool.h"
+
+namespace dae
+{
+	namespace
+	{
+		static_assert(std::is_trivially_copyable_v<Vector3> && sizeof(Vector3) == 3 * sizeof(float), "Vector3 is copied as 3 floats");
+		static_assert(std::is_trivially_copyable_v<BVHNode>, "BVHNode is copied as raw bytes");
+
+		// Chunks smaller than this cost more to schedule than to parse
+		constexpr size_t MinChunkSize{ 1 << 20 };
+		constexpr uint32_t NormalBlockSize{ 1 << 16 };
+
+		// Runs task(index) for every index in [0, count), on pThreadPool when there is one
+		template <typename Task>
+		void Dispatch(ThreadPool* pThreadPool, uint32_t count, Task&& task)
+		{
+			if (pThreadPool)
+			{
+				pThreadPool->Dispatch(count, task);
+				return;
+			}
+
+			for (uint32_t i{}; i < count; ++i)
+				task(i);
+		}
+
+		// Read only view of a whole file, unmapped when it goes out of scope
+		class MappedFile final
+		{
+		public:
+			explicit MappedFile(const std::string& filename)
+			{
+#if defined(_WIN32)
+				m_File = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+				if (m_File == INVALID_HANDLE_VALUE)
+					return;
+
+				LARGE_INTEGER size{};
+				if (!GetFileSizeEx(m_File, &size))
+					return;
+
+				m_Size = static_cast<size_t>(size.QuadPart);
+
+				// Empty files can't be mapped, but they are valid
+				if (m_Size == 0)
+				{
+					m_IsOpen = true;
+					return;
+				}
+
+				m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (!m_Mapping)
+					return;
+
+				m_pData = static_cast<const char*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+				m_IsOpen = m_pData != nullptr;
+#else
+				const int file = open(filename.c_str(), O_RDONLY);
+				if (file < 0)
+					return;
+
+				struct stat status{};
+				if (fstat(file, &status) == 0)
+				{
+					m_Size = static_cast<size_t>(status.st_size);
+					m_IsOpen = true;
+
+					if (m_Size > 0)
+					{
+						void* pData = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, file, 0);
+						if (pData == MAP_FAILED)
+						{
+							m_IsOpen = false;
+						}
+						else
+						{
+							madvise(pData, m_Size, MADV_SEQUENTIAL);
+							m_pData = static_cast<const char*>(pData);
+						}
+					}
+				}
+
+				// The mapping keeps its own reference to the file
+				close(file);
+#endif
+			}
+
+			~MappedFile()
+			{
+#if defined(_WIN32)
+				if (m_pData)
+					UnmapViewOfFile(m_pData);
+				if (m_Mapping)
+					CloseHandle(m_Mapping);
+				if (m_File != INVALID_HANDLE_VALUE)
+					CloseHandle(m_File);
+#else
+				if (m_pData)
+					munmap(const_cast<char*>(m_pData), m_Size);
+#endif
+			}
+
+			MappedFile(const MappedFile&) = delete;
+			MappedFile(MappedFile&&) noexcept = delete;
+			MappedFile& operator=(const MappedFile&) = delete;
+			MappedFile& operator=(MappedFile&&) noexcept = delete;
+
+			bool IsOpen() const { return m_IsOpen; }
+			const char* GetData() const { return m_pData; }
+			size_t GetSize() const { return m_Size; }
+
+		private:
+			const char* m_pData{};
+			size_t m_Size{};
+			bool m_IsOpen{};
+
+#if defined(_WIN32)
+			HANDLE m_File{ INVALID_HANDLE_VALUE };
+			HANDLE m_Mapping{};
+#endif
+		};
+
+		struct MeshCacheHeader
+		{
+			char magic[4]{ 'R', 'T', 'M', 'C' };
+			uint32_t version{ MeshLoader::MeshCacheVersion };
+
+			// Stamp of the obj the cache was made from, any change makes the cache stale
+			uint64_t sourceSize{};
+			int64_t sourceWriteTime{};
+
+			uint32_t positionCount{};
+			uint32_t triangleCount{};
+			// 0 when the cache has no bvh, otherwise triangleCount primitive indices follow the nodes
+			uint32_t nodeCount{};
+			uint32_t nodeSize{ sizeof(BVHNode) };
+			// BVHBuilder of the stored tree, a load asking for another one rebuilds it
+			uint32_t bvhBuilder{};
+		};
+
+		// What one chunk of the file produced, merged into the output once every chunk is done
+		struct ParsedChunk
+		{
+			std::vector<Vector3> positions{};
+			// 0 based position indices, 3 per triangle
+			std::vector<int> indices{};
+			// Entries of indices that came from negative obj indices, they count from the first position of this chunk
+			std::vector<uint32_t> relativeIndices{};
+			bool isValid{ true };
+		};
+
+		struct FaceVertex
+		{
+			int index{};
+			bool isRelative{};
+		};
+
+		bool GetSourceStamp(const std::string& sourceFilename, uint64_t& size, int64_t& writeTime)
+		{
+			std::error_code error{};
+
+			size = std::filesystem::file_size(sourceFilename, error);
+			if (error)
+				return false;
+
+			const auto time = std::filesystem::last_write_time(sourceFilename, error);
+			if (error)
+				return false;
+
+			writeTime = static_cast<int64_t>(time.time_since_epoch().count());
+			return true;
+		}
+
+		bool IsSpace(char c)
+		{
+			return c == ' ' || c == '\t' || c == '\r';
+		}
+
+		const char* SkipSpaces(const char* pCurrent, const char* pEnd)
+		{
+			while (pCurrent < pEnd && IsSpace(*pCurrent))
+				++pCurrent;
+
+			return pCurrent;
+		}
+
+		bool ParseFloat(const char*& pCurrent, const char* pEnd, float& value)
+		{
+			pCurrent = SkipSpaces(pCurrent, pEnd);
+
+			// from_chars doesn't take an explicit plus sign
+			if (pCurrent < pEnd && *pCurrent == '+')
+				++pCurrent;
+
+			const auto [pNext, error] = std::from_chars(pCurrent, pEnd, value);
+			if (error != std::errc{})
+				return false;
+
+			pCurrent = pNext;
+			return true;
+		}
+
+		// v, v/vt, v//vn or v/vt/vn, only the position index is kept
+		bool ParseFaceVertex(const char*& pCurrent, const char* pEnd, int chunkPositionCount, FaceVertex& vertex)
+		{
+			int value{};
+			const auto [pNext, error] = std::from_chars(pCurrent, pEnd, value);
+			if (error != std::errc{} || value == 0)
+				return false;
+
+			pCurrent = pNext;
+			while (pCurrent < pEnd && !IsSpace(*pCurrent))
+				++pCurrent;
+
+			// Negative indices count back from the last position read so far
+			if (value > 0)
+				vertex = { value - 1, false };
+			else
+				vertex = { chunkPositionCount + value, true };
+
+			return true;
+		}
+
+		void AddFaceVertex(ParsedChunk& chunk, const FaceVertex& vertex)
+		{
+			if (vertex.isRelative)
+				chunk.relativeIndices.push_back(static_cast<uint32_t>(chunk.indices.size()));
+
+			chunk.indices.push_back(vertex.index);
+		}
+
+		void ParseLine(const char* pLine, const char* pEnd, ParsedChunk& chunk)
+		{
+			pLine = SkipSpaces(pLine, pEnd);
+			if (pEnd - pLine < 2 || !IsSpace(pLine[1]))
+				return;
+
+			if (pLine[0] == 'v')
+			{
+				const char* pCurrent = pLine + 1;
+
+				Vector3 position{};
+				if (!ParseFloat(pCurrent, pEnd, position.x) || !ParseFloat(pCurrent, pEnd, position.y) || !ParseFloat(pCurrent, pEnd, position.z))
+				{
+					chunk.isValid = false;
+					return;
+				}
+
+				chunk.positions.push_back(position);
+			}
+			else if (pLine[0] == 'f')
+			{
+				const char* pCurrent = SkipSpaces(pLine + 1, pEnd);
+				const int chunkPositionCount = static_cast<int>(chunk.positions.size());
+
+				// Polygons become a fan around their first vertex
+				FaceVertex first{}, previous{}, current{};
+				uint32_t vertexCount{};
+
+				while (pCurrent < pEnd)
+				{
+					if (!ParseFaceVertex(pCurrent, pEnd, chunkPositionCount, current))
+					{
+						chunk.isValid = false;
+						return;
+					}
+
+					if (vertexCount == 0)
+					{
+						first = current;
+					}
+					else if (vertexCount >= 2)
+					{
+						AddFaceVertex(chunk, first);
+						AddFaceVertex(chunk, previous);
+						AddFaceVertex(chunk, current);
+					}
+
+					previous = current;
+					++vertexCount;
+					pCurrent = SkipSpaces(pCurrent, pEnd);
+				}
+
+				if (vertexCount < 3)
+					chunk.isValid = false;
+			}
+
+			// vn, vt, comments, groups and materials carry nothing the mesh uses
+		}
+
+		void ParseChunk(const char* pBegin, const char* pEnd, ParsedChunk& chunk)
+		{
+			const char* pLine = pBegin;
+			while (pLine < pEnd && chunk.isValid)
+			{
+				const char* pLineEnd = static_cast<const char*>(std::memchr(pLine, '\n', static_cast<size_t>(pEnd - pLine)));
+				if (!pLineEnd)
+					pLineEnd = pEnd;
+
+				ParseLine(pLine, pLineEnd, chunk);
+				pLine = pLineEnd + 1;
+			}
+		}
+
+		// Same math as Utils::ParseOBJ, so both loaders give identical normals
+		void CalculateNormals(ThreadPool* pThreadPool, const std::vector<Vector3>& positions, const std::vector<int>& indices, std::vector<Vector3>& normals)
+		{
+			const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+			normals.resize(triangleCount);
+
+			Dispatch(pThreadPool, (triangleCount + NormalBlockSize - 1) / NormalBlockSize, [&](uint32_t blockIndex)
+			{
+				const uint32_t triangleEnd = std::min(triangleCount, (blockIndex + 1) * NormalBlockSize);
+
+				for (uint32_t triangle{ blockIndex * NormalBlockSize }; triangle < triangleEnd; ++triangle)
+				{
+					const Vector3& v0 = positions[indices[triangle * 3]];
+					const Vector3& v1 = positions[indices[triangle * 3 + 1]];
+					const Vector3& v2 = positions[indices[triangle * 3 + 2]];
+
+					Vector3 normal = Vector3::Cross(v1 - v0, v2 - v0);
+					normal.Normalize();
+					normals[triangle] = normal;
+				}
+			});
+		}
+
+		bool ParseOBJ(const std::string& filename, std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices,
+			ThreadPool* pThreadPool)
+		{
+			const MappedFile file{ filename };
+			if (!file.IsOpen())
+				return false;
+
+			const char* pData = file.GetData();
+			const size_t size = file.GetSize();
+
+			// A few chunks per thread so an uneven split still keeps every thread busy
+			const size_t threadCount = pThreadPool ? pThreadPool->GetThreadCount() : 1;
+			const size_t chunkCount = std::clamp<size_t>(size / MinChunkSize, 1, threadCount * 4);
+
+			// Cut at the first line end after every even split point
+			std::vector<const char*> chunkStarts(chunkCount + 1);
+			chunkStarts[0] = pData;
+			chunkStarts[chunkCount] = pData + size;
+			for (size_t i{ 1 }; i < chunkCount; ++i)
+			{
+				const char* pSplit = std::max(pData + size / chunkCount * i, chunkStarts[i - 1]);
+				const char* pLineEnd = static_cast<const char*>(std::memchr(pSplit, '\n', static_cast<size_t>(pData + size - pSplit)));
+				chunkStarts[i] = pLineEnd ? pLineEnd + 1 : pData + size;
+			}
+
+			std::vector<ParsedChunk> chunks(chunkCount);
+			Dispatch(pThreadPool, static_cast<uint32_t>(chunkCount), [&](uint32_t chunkIndex)
+			{
+				ParseChunk(chunkStarts[chunkIndex], chunkStarts[chunkIndex + 1], chunks[chunkIndex]);
+			});
+
+			// Chunk outputs go back to back, in file order
+			std::vector<size_t> positionOffsets(chunkCount + 1);
+			std::vector<size_t> indexOffsets(chunkCount + 1);
+			for (size_t i{}; i < chunkCount; ++i)
+			{
+				if (!chunks[i].isValid)
+				{
+					std::cout << "MeshLoader: malformed vertex or face in " << filename << "\n";
+					return false;
+				}
+
+				positionOffsets[i + 1] = positionOffsets[i] + chunks[i].positions.size();
+				indexOffsets[i + 1] = indexOffsets[i] + chunks[i].indices.size();
+			}
+
+			const size_t positionCount = positionOffsets[chunkCount];
+			if (positionCount > static_cast<size_t>(INT32_MAX) || indexOffsets[chunkCount] / 3 > UINT32_MAX)
+			{
+				std::cout << "MeshLoader: " << filename << " is too big for 32 bit indices\n";
+				return false;
+			}
+
+			positions.resize(positionCount);
+			indices.resize(indexOffsets[chunkCount]);
+
+			std::atomic<bool> hasInvalidIndex{ false };
+			Dispatch(pThreadPool, static_cast<uint32_t>(chunkCount), [&](uint32_t chunkIndex)
+			{
+				ParsedChunk& chunk = chunks[chunkIndex];
+
+				for (const uint32_t relativeIndex : chunk.relativeIndices)
+					chunk.indices[relativeIndex] += static_cast<int>(positionOffsets[chunkIndex]);
+
+				for (const int index : chunk.indices)
+				{
+					if (index < 0 || static_cast<size_t>(index) >= positionCount)
+					{
+						hasInvalidIndex.store(true, std::memory_order_relaxed);
+						break;
+					}
+				}
+
+				std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + positionOffsets[chunkIndex]);
+				std::copy(chunk.indices.begin(), chunk.indices.end(), indices.begin() + indexOffsets[chunkIndex]);
+
+				// Freed on the worker, not all at once at the end
+				chunk = ParsedChunk{};
+			});
+
+			if (hasInvalidIndex.load(std::memory_order_relaxed))
+			{
+				std::cout << "MeshLoader: face index out of range in " << filename << "\n";
+				return false;
+			}
+
+			CalculateNormals(pThreadPool, positions, indices, normals);
+			return true;
+		}
+
+		// One line per mesh, written at once because meshes load in parallel
+		void PrintBVHStats(const std::string& filename, const BVH& bvh, size_t triangleCount, bool isCached)
+		{
+			const BVH::BuildStats& stats = bvh.GetBuildStats();
+
+			std::ostringstream line{};
+			line << "MeshLoader: " << filename << " " << triangleCount << " triangles, " << GetBVHBuilderName(stats.builder) << " bvh ";
+			if (isCached)
+				line << "from cache";
+			else
+				line << "built in " << stats.buildMs << " ms";
+			line << ", SAH cost " << stats.sahCost << "\n";
+
+			std::cout << line.str();
+		}
+
+		void BuildBVH(const std::string& filename, const std::vector<Vector3>& positions, const std::vector<int>& indices, BVH& bvh, BVHBuilder builder,
+			ThreadPool* pThreadPool)
+		{
+			// Small meshes are built on the calling thread whatever the pool
+			bvh.BuildFromTriangles(positions, indices, pThreadPool, builder);
+			PrintBVHStats(filename, bvh, indices.size() / 3, false);
+		}
+
+		template <typename T>
+		bool ReadArray(const char*& pCurrent, const char* pEnd, std::vector<T>& values, size_t count)
+		{
+			const size_t byteCount = count * sizeof(T);
+			if (static_cast<size_t>(pEnd - pCurrent) < byteCount)
+				return false;
+
+			values.resize(count);
+			if (byteCount > 0)
+				std::memcpy(values.data(), pCurrent, byteCount);
+
+			pCurrent += byteCount;
+			return true;
+		}
+
+		// Children are stored after their parent and no deeper than BVH::MaxDepth, the traversal stacks rely on it
+		bool IsValidBVH(const std::vector<BVHNode>& nodes, const std::vector<uint32_t>& primitiveIndices, uint32_t triangleCount)
+		{
+			const uint32_t nodeCount = static_cast<uint32_t>(nodes.size());
+			std::vector<uint32_t> depths(nodeCount, 0);
+
+			for (uint32_t i{}; i < nodeCount; ++i)
+			{
+				const BVHNode& node = nodes[i];
+				if (node.IsLeaf())
+				{
+					if (node.primitiveCount > triangleCount || node.leftFirst > triangleCount - node.primitiveCount)
+						return false;
+				}
+				else
+				{
+					if (node.leftFirst <= i || node.leftFirst >= nodeCount - 1 || depths[i] + 1 >= BVH::MaxDepth)
+						return false;
+
+					depths[node.leftFirst] = std::max(depths[node.leftFirst], depths[i] + 1);
+					depths[node.leftFirst + 1] = std::max(depths[node.leftFirst + 1], depths[i] + 1);
+				}
+			}
+
+			return std::all_of(primitiveIndices.begin(), primitiveIndices.end(),
+				[triangleCount](uint32_t index) { return index < triangleCount; });
+		}
+
+		template <typename T>
+		void WriteArray(std::ofstream& stream, const T* pValues, size_t count)
+		{
+			stream.write(reinterpret_cast<const char*>(pValues), static_cast<std::streamsize>(count * sizeof(T)));
+		}
+	}
+
+	bool MeshLoader::LoadOBJ(const std::string& filename, std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices,
+		BVH* pBVH, BVHBuilder builder, ThreadPool* pThreadPool)
+	{
+		const std::string cacheFilename = filename + ".meshcache";
+
+		if (ReadMeshCache(cacheFilename, filename, positions, normals, indices, pBVH, builder))
+		{
+			if (pBVH && !indices.empty())
+			{
+				// Cached before anyone asked for a bvh, or with another builder
+				if (!pBVH->IsBuilt())
+				{
+					BuildBVH(filename, positions, indices, *pBVH, builder, pThreadPool);
+					WriteMeshCache(cacheFilename, filename, positions, normals, indices, pBVH);
+				}
+				else
+				{
+					PrintBVHStats(filename, *pBVH, indices.size() / 3, true);
+				}
+			}
+
+			return true;
+		}
+
+		if (!ParseOBJ(filename, positions, normals, indices, pThreadPool))
+			return false;
+
+		if (pBVH)
+			BuildBVH(filename, positions, indices, *pBVH, builder, pThreadPool);
+
+		if (!WriteMeshCache(cacheFilename, filename, positions, normals, indices, pBVH))
+			std::cout << "MeshLoader: could not write " << cacheFilename << "\n";
+
+		return true;
+	}
+
+	bool MeshLoader::ReadMeshCache(const std::string& cacheFilename, const std::string& sourceFilename,
+		std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices, BVH* pBVH, BVHBuilder builder)
+	{
+		uint64_t sourceSize{};
+		int64_t sourceWriteTime{};
+		if (!GetSourceStamp(sourceFilename, sourceSize, sourceWriteTime))
+			return false;
+
+		const MappedFile file{ cacheFilename };
+		if (!file.IsOpen() || file.GetSize() < sizeof(MeshCacheHeader))
+			return false;
+
+		const char* pCurrent = file.GetData();
+		const char* pEnd = pCurrent + file.GetSize();
+
+		MeshCacheHeader header{};
+		const MeshCacheHeader expectedHeader{};
+		std::memcpy(&header, pCurrent, sizeof(header));
+		pCurrent += sizeof(header);
+
+		if (std::memcmp(header.magic, expectedHeader.magic, sizeof(header.magic)) != 0
+			|| header.version != expectedHeader.version
+			|| header.nodeSize != expectedHeader.nodeSize
+			|| header.sourceSize != sourceSize
+			|| header.sourceWriteTime != sourceWriteTime)
+			return false;
+
+		std::vector<BVHNode> nodes{};
+		std::vector<uint32_t> primitiveIndices{};
+
+		if (!ReadArray(pCurrent, pEnd, positions, header.positionCount)
+			|| !ReadArray(pCurrent, pEnd, normals, header.triangleCount)
+			|| !ReadArray(pCurrent, pEnd, indices, static_cast<size_t>(header.triangleCount) * 3)
+			|| !ReadArray(pCurrent, pEnd, nodes, header.nodeCount)
+			|| !ReadArray(pCurrent, pEnd, primitiveIndices, header.nodeCount > 0 ? header.triangleCount : 0)
+			|| pCurrent != pEnd)
+			return false;
+
+		// A damaged cache must not index out of bounds later
+		for (const int index : indices)
+		{
+			if (index < 0 || static_cast<uint32_t>(index) >= header.positionCount)
+				return false;
+		}
+
+		if (pBVH)
+		{
+			// A damaged tree is dropped and built again
+			if (header.nodeCount > 0 && header.bvhBuilder == static_cast<uint32_t>(builder)
+				&& IsValidBVH(nodes, primitiveIndices, header.triangleCount))
+				pBVH->Assign(nodes.data(), header.nodeCount, primitiveIndices.data(), header.triangleCount, builder);
+			else
+				pBVH->Clear();
+		}
+
+		return true;
+	}
+
+	bool MeshLoader::WriteMeshCache(const std::string& cacheFilename, const std::string& sourceFilename,
+		const std::vector<Vector3>& positions, const std::vector<Vector3>& normals, const std::vector<int>& indices, const BVH* pBVH)
+	{
+		MeshCacheHeader header{};
+		if (!GetSourceStamp(sourceFilename, header.sourceSize, header.sourceWriteTime))
+			return false;
+
+		const bool hasBVH = pBVH && pBVH->IsBuilt();
+		header.positionCount = static_cast<uint32_t>(positions.size());
+		header.triangleCount = static_cast<uint32_t>(indices.size() / 3);
+		header.nodeCount = hasBVH ? static_cast<uint32_t>(pBVH->GetNodes().size()) : 0;
+		header.bvhBuilder = hasBVH ? static_cast<uint32_t>(pBVH->GetBuildStats().builder) : 0;
+
+		// Written next to the cache and renamed over it, a reader never sees half a file
+		const std::string tempFilename = cacheFilename + ".tmp";
+		{
+			std::ofstream stream(tempFilename, std::ios::binary | std::ios::trunc);
+			if (!stream)
+				return false;
+
+			stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			WriteArray(stream, positions.data(), positions.size());
+			WriteArray(stream, normals.data(), header.triangleCount);
+			WriteArray(stream, indices.data(), static_cast<size_t>(header.triangleCount) * 3);
+
+			if (hasBVH)
+			{
+				WriteArray(stream, pBVH->GetNodes().data(), pBVH->GetNodes().size());
+				WriteArray(stream, pBVH->GetPrimitiveIndices().data(), pBVH->GetPrimitiveIndices().size());
+			}
+
+			if (!stream)
+				return false;
+		}
+
+		std::error_code error{};
+		std::filesystem::rename(tempFilename, cacheFilename, error);
+		if (error)
+		{
+			std::filesystem::remove(tempFilename, error);
+			return false;
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BVH.h"
+#include "Vector3.h"
+
+namespace dae
+{
+	class ThreadPool;
+
+	/**
+	 * \brief Wavefront obj loading for meshes far too big for Utils::ParseOBJ.
+	 * The file is memory mapped and parsed in line aligned chunks, spread over the threads of the pool it is given.
+	 * The result is stored in <file>.meshcache, the next load maps that instead while the obj is unchanged.
+	 */
+	namespace MeshLoader
+	{
+		// Bump whenever the cache layout or the bvh builder changes, older caches are then rebuilt
+		constexpr uint32_t MeshCacheVersion{ 2 };
+
+		/**
+		 * \brief Same output as Utils::ParseOBJ: positions, one face normal and 3 indices per triangle.
+		 * Faces with more than 3 vertices are fanned, texture coordinate and normal indices are skipped.
+		 * \param pBVH when set, receives the bvh over the object space triangles, from the cache when it has one made by builder
+		 * \param pThreadPool parses and builds the bvh on it, may be called from one of its own tasks. Without it everything runs on the calling thread
+		 */
+		bool LoadOBJ(const std::string& filename, std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices,
+			BVH* pBVH = nullptr, BVHBuilder builder = BVHBuilder::SAH, ThreadPool* pThreadPool = nullptr);
+
+		// pBVH is cleared when the cache has no tree or one from another builder
+		bool ReadMeshCache(const std::string& cacheFilename, const std::string& sourceFilename,
+			std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices, BVH* pBVH,
+			BVHBuilder builder = BVHBuilder::SAH);
+		bool WriteMeshCache(const std::string& cacheFilename, const std::string& sourceFilename,
+			const std::vector<Vector3>& positions, const std::vector<Vector3>& normals, const std::vector<int>& indices, const BVH* pBVH);
+	}
+}
@@ -0,0 +1,420 @@
+#include "PackedTriangles.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+#include "Simd.h"
+#include "ThreadPool.h"
+
+namespace dae
+{
+	namespace
+	{
+		// Same epsilon as the scalar triangle test
+		constexpr float Epsilon{ 0.0000001f };
+		// Lanes one task packs, small meshes stay on the calling thread
+		constexpr uint32_t PackBlockSize{ 4096 };
+
+#ifdef SIMD_X86
+		bool CpuSupportsAVX2()
+		{
+#if defined(_MSC_VER)
+			int info[4]{};
+			__cpuid(info, 0);
+			if (info[0] < 7)
+				return false;
+
+			// The os has to save the ymm registers on a context switch too
+			__cpuid(info, 1);
+			const bool hasOSXSave = (info[2] & (1 << 27)) != 0;
+			const bool hasAVX = (info[2] & (1 << 28)) != 0;
+			if (!hasOSXSave || !hasAVX || (_xgetbv(0) & 0x6) != 0x6)
+				return false;
+
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+#else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2");
+#endif
+		}
+#endif
+	}
+
+	const char* GetTriangleKernelName(TriangleKernel kernel)
+	{
+		switch (kernel)
+		{
+		case TriangleKernel::Scalar:
+			return "Scalar";
+		case TriangleKernel::SSE:
+			return "SSE";
+		case TriangleKernel::AVX2:
+			return "AVX2";
+		}
+		return "Unknown";
+	}
+
+	bool IsTriangleKernelSupported(TriangleKernel kernel)
+	{
+#ifdef SIMD_X86
+		static const bool hasAVX2 = CpuSupportsAVX2();
+
+		switch (kernel)
+		{
+		case TriangleKernel::Scalar:
+		case TriangleKernel::SSE:
+			return true;
+		case TriangleKernel::AVX2:
+			return hasAVX2;
+		}
+		return false;
+#else
+		return kernel == TriangleKernel::Scalar;
+#endif
+	}
+
+	TriangleKernel GetBestTriangleKernel()
+	{
+		static const TriangleKernel bestKernel = IsTriangleKernelSupported(TriangleKernel::AVX2) ? TriangleKernel::AVX2
+			: IsTriangleKernelSupported(TriangleKernel::SSE) ? TriangleKernel::SSE : TriangleKernel::Scalar;
+
+		return bestKernel;
+	}
+
+#pragma region Kernels
+	struct PackedTriangleKernels
+	{
+#ifdef SIMD_X86
+		static uint32_t IntersectSSE(const PackedTriangles& triangles, uint32_t first, uint32_t count,
+			const Vector3& origin, const Vector3& direction, float tMin, float& tMax, bool anyHit)
+		{
+			const float* pV0X = triangles.GetStream(PackedTriangles::V0X);
+			const float* pV0Y = triangles.GetStream(PackedTriangles::V0Y);
+			const float* pV0Z = triangles.GetStream(PackedTriangles::V0Z);
+			const float* pEdge1X = triangles.GetStream(PackedTriangles::Edge1X);
+			const float* pEdge1Y = triangles.GetStream(PackedTriangles::Edge1Y);
+			const float* pEdge1Z = triangles.GetStream(PackedTriangles::Edge1Z);
+			const float* pEdge2X = triangles.GetStream(PackedTriangles::Edge2X);
+			const float* pEdge2Y = triangles.GetStream(PackedTriangles::Edge2Y);
+			const float* pEdge2Z = triangles.GetStream(PackedTriangles::Edge2Z);
+			const float* pNormalX = triangles.GetStream(PackedTriangles::NormalX);
+			const float* pNormalY = triangles.GetStream(PackedTriangles::NormalY);
+			const float* pNormalZ = triangles.GetStream(PackedTriangles::NormalZ);
+			const float* pCullSign = triangles.GetStream(PackedTriangles::CullSign);
+
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.f);
+			const __m128 epsilon = _mm_set1_ps(Epsilon);
+			const __m128 signMask = _mm_set1_ps(-0.f);
+			const __m128 laneOffsets = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+
+			const __m128 originX = _mm_set1_ps(origin.x);
+			const __m128 originY = _mm_set1_ps(origin.y);
+			const __m128 originZ = _mm_set1_ps(origin.z);
+			const __m128 directionX = _mm_set1_ps(direction.x);
+			const __m128 directionY = _mm_set1_ps(direction.y);
+			const __m128 directionZ = _mm_set1_ps(direction.z);
+			const __m128 minT = _mm_set1_ps(tMin);
+
+			uint32_t hitLane{ PackedTriangles::InvalidLane };
+
+			for (uint32_t offset{}; offset < count; offset += 4)
+			{
+				const uint32_t lane = first + offset;
+
+				// Perpendicular and culled triangles
+				const __m128 normalViewDot = _mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(_mm_loadu_ps(pNormalX + lane), directionX),
+					_mm_mul_ps(_mm_loadu_ps(pNormalY + lane), directionY)),
+					_mm_mul_ps(_mm_loadu_ps(pNormalZ + lane), directionZ));
+
+				__m128 isValid = _mm_cmplt_ps(laneOffsets, _mm_set1_ps(static_cast<float>(count - offset)));
+				isValid = _mm_and_ps(isValid, _mm_cmpge_ps(_mm_andnot_ps(signMask, normalViewDot), epsilon));
+				isValid = _mm_and_ps(isValid, _mm_cmple_ps(_mm_mul_ps(normalViewDot, _mm_loadu_ps(pCullSign + lane)), zero));
+
+				if (_mm_movemask_ps(isValid) == 0)
+					continue;
+
+				// Moller-Trumbore
+				const __m128 edge1X = _mm_loadu_ps(pEdge1X + lane);
+				const __m128 edge1Y = _mm_loadu_ps(pEdge1Y + lane);
+				const __m128 edge1Z = _mm_loadu_ps(pEdge1Z + lane);
+				const __m128 edge2X = _mm_loadu_ps(pEdge2X + lane);
+				const __m128 edge2Y = _mm_loadu_ps(pEdge2Y + lane);
+				const __m128 edge2Z = _mm_loadu_ps(pEdge2Z + lane);
+
+				const __m128 hX = _mm_sub_ps(_mm_mul_ps(directionY, edge2Z), _mm_mul_ps(directionZ, edge2Y));
+				const __m128 hY = _mm_sub_ps(_mm_mul_ps(directionZ, edge2X), _mm_mul_ps(directionX, edge2Z));
+				const __m128 hZ = _mm_sub_ps(_mm_mul_ps(directionX, edge2Y), _mm_mul_ps(directionY, edge2X));
+
+				const __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1X, hX), _mm_mul_ps(edge1Y, hY)), _mm_mul_ps(edge1Z, hZ));
+				isValid = _mm_and_ps(isValid, _mm_cmpge_ps(_mm_andnot_ps(signMask, a), epsilon));
+
+				const __m128 f = _mm_div_ps(one, a);
+				const __m128 sX = _mm_sub_ps(originX, _mm_loadu_ps(pV0X + lane));
+				const __m128 sY = _mm_sub_ps(originY, _mm_loadu_ps(pV0Y + lane));
+				const __m128 sZ = _mm_sub_ps(originZ, _mm_loadu_ps(pV0Z + lane));
+
+				const __m128 u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sX, hX), _mm_mul_ps(sY, hY)), _mm_mul_ps(sZ, hZ)));
+				isValid = _mm_and_ps(isValid, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+
+				const __m128 qX = _mm_sub_ps(_mm_mul_ps(sY, edge1Z), _mm_mul_ps(sZ, edge1Y));
+				const __m128 qY = _mm_sub_ps(_mm_mul_ps(sZ, edge1X), _mm_mul_ps(sX, edge1Z));
+				const __m128 qZ = _mm_sub_ps(_mm_mul_ps(sX, edge1Y), _mm_mul_ps(sY, edge1X));
+
+				const __m128 v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, qX), _mm_mul_ps(directionY, qY)), _mm_mul_ps(directionZ, qZ)));
+				isValid = _mm_and_ps(isValid, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+
+				const __m128 t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge2X, qX), _mm_mul_ps(edge2Y, qY)), _mm_mul_ps(edge2Z, qZ)));
+				isValid = _mm_and_ps(isValid, _mm_and_ps(_mm_cmpge_ps(t, minT), _mm_cmple_ps(t, _mm_set1_ps(tMax))));
+
+				uint32_t hitMask = static_cast<uint32_t>(_mm_movemask_ps(isValid));
+				if (hitMask == 0)
+					continue;
+
+				alignas(16) float hitT[4];
+				_mm_store_ps(hitT, t);
+
+				// Closest lane of this group, tMax already rejected everything behind earlier hits
+				while (hitMask != 0)
+				{
+					const uint32_t i = static_cast<uint32_t>(std::countr_zero(hitMask));
+					hitMask &= hitMask - 1;
+
+					if (hitT[i] <= tMax)
+					{
+						tMax = hitT[i];
+						hitLane = lane + i;
+					}
+				}
+
+				if (anyHit)
+					return hitLane;
+			}
+
+			return hitLane;
+		}
+
+		TARGET_AVX2 static uint32_t IntersectAVX2(const PackedTriangles& triangles, uint32_t first, uint32_t count,
+			const Vector3& origin, const Vector3& direction, float tMin, float& tMax, bool anyHit)
+		{
+			const float* pV0X = triangles.GetStream(PackedTriangles::V0X);
+			const float* pV0Y = triangles.GetStream(PackedTriangles::V0Y);
+			const float* pV0Z = triangles.GetStream(PackedTriangles::V0Z);
+			const float* pEdge1X = triangles.GetStream(PackedTriangles::Edge1X);
+			const float* pEdge1Y = triangles.GetStream(PackedTriangles::Edge1Y);
+			const float* pEdge1Z = triangles.GetStream(PackedTriangles::Edge1Z);
+			const float* pEdge2X = triangles.GetStream(PackedTriangles::Edge2X);
+			const float* pEdge2Y = triangles.GetStream(PackedTriangles::Edge2Y);
+			const float* pEdge2Z = triangles.GetStream(PackedTriangles::Edge2Z);
+			const float* pNormalX = triangles.GetStream(PackedTriangles::NormalX);
+			const float* pNormalY = triangles.GetStream(PackedTriangles::NormalY);
+			const float* pNormalZ = triangles.GetStream(PackedTriangles::NormalZ);
+			const float* pCullSign = triangles.GetStream(PackedTriangles::CullSign);
+
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 one = _mm256_set1_ps(1.f);
+			const __m256 epsilon = _mm256_set1_ps(Epsilon);
+			const __m256 signMask = _mm256_set1_ps(-0.f);
+			const __m256 laneOffsets = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+
+			const __m256 originX = _mm256_set1_ps(origin.x);
+			const __m256 originY = _mm256_set1_ps(origin.y);
+			const __m256 originZ = _mm256_set1_ps(origin.z);
+			const __m256 directionX = _mm256_set1_ps(direction.x);
+			const __m256 directionY = _mm256_set1_ps(direction.y);
+			const __m256 directionZ = _mm256_set1_ps(direction.z);
+			const __m256 minT = _mm256_set1_ps(tMin);
+
+			uint32_t hitLane{ PackedTriangles::InvalidLane };
+
+			for (uint32_t offset{}; offset < count; offset += 8)
+			{
+				const uint32_t lane = first + offset;
+
+				// Perpendicular and culled triangles
+				const __m256 normalViewDot = _mm256_add_ps(_mm256_add_ps(
+					_mm256_mul_ps(_mm256_loadu_ps(pNormalX + lane), directionX),
+					_mm256_mul_ps(_mm256_loadu_ps(pNormalY + lane), directionY)),
+					_mm256_mul_ps(_mm256_loadu_ps(pNormalZ + lane), directionZ));
+
+				__m256 isValid = _mm256_cmp_ps(laneOffsets, _mm256_set1_ps(static_cast<float>(count - offset)), _CMP_LT_OQ);
+				isValid = _mm256_and_ps(isValid, _mm256_cmp_ps(_mm256_andnot_ps(signMask, normalViewDot), epsilon, _CMP_GE_OQ));
+				isValid = _mm256_and_ps(isValid, _mm256_cmp_ps(_mm256_mul_ps(normalViewDot, _mm256_loadu_ps(pCullSign + lane)), zero, _CMP_LE_OQ));
+
+				if (_mm256_movemask_ps(isValid) == 0)
+					continue;
+
+				// Moller-Trumbore
+				const __m256 edge1X = _mm256_loadu_ps(pEdge1X + lane);
+				const __m256 edge1Y = _mm256_loadu_ps(pEdge1Y + lane);
+				const __m256 edge1Z = _mm256_loadu_ps(pEdge1Z + lane);
+				const __m256 edge2X = _mm256_loadu_ps(pEdge2X + lane);
+				const __m256 edge2Y = _mm256_loadu_ps(pEdge2Y + lane);
+				const __m256 edge2Z = _mm256_loadu_ps(pEdge2Z + lane);
+
+				const __m256 hX = _mm256_sub_ps(_mm256_mul_ps(directionY, edge2Z), _mm256_mul_ps(directionZ, edge2Y));
+				const __m256 hY = _mm256_sub_ps(_mm256_mul_ps(directionZ, edge2X), _mm256_mul_ps(directionX, edge2Z));
+				const __m256 hZ = _mm256_sub_ps(_mm256_mul_ps(directionX, edge2Y), _mm256_mul_ps(directionY, edge2X));
+
+				const __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge1X, hX), _mm256_mul_ps(edge1Y, hY)), _mm256_mul_ps(edge1Z, hZ));
+				isValid = _mm256_and_ps(isValid, _mm256_cmp_ps(_mm256_andnot_ps(signMask, a), epsilon, _CMP_GE_OQ));
+
+				const __m256 f = _mm256_div_ps(one, a);
+				const __m256 sX = _mm256_sub_ps(originX, _mm256_loadu_ps(pV0X + lane));
+				const __m256 sY = _mm256_sub_ps(originY, _mm256_loadu_ps(pV0Y + lane));
+				const __m256 sZ = _mm256_sub_ps(originZ, _mm256_loadu_ps(pV0Z + lane));
+
+				const __m256 u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sX, hX), _mm256_mul_ps(sY, hY)), _mm256_mul_ps(sZ, hZ)));
+				isValid = _mm256_and_ps(isValid, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+
+				const __m256 qX = _mm256_sub_ps(_mm256_mul_ps(sY, edge1Z), _mm256_mul_ps(sZ, edge1Y));
+				const __m256 qY = _mm256_sub_ps(_mm256_mul_ps(sZ, edge1X), _mm256_mul_ps(sX, edge1Z));
+				const __m256 qZ = _mm256_sub_ps(_mm256_mul_ps(sX, edge1Y), _mm256_mul_ps(sY, edge1X));
+
+				const __m256 v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(directionX, qX), _mm256_mul_ps(directionY, qY)), _mm256_mul_ps(directionZ, qZ)));
+				isValid = _mm256_and_ps(isValid, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+
+				const __m256 t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge2X, qX), _mm256_mul_ps(edge2Y, qY)), _mm256_mul_ps(edge2Z, qZ)));
+				isValid = _mm256_and_ps(isValid, _mm256_and_ps(_mm256_cmp_ps(t, minT, _CMP_GE_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LE_OQ)));
+
+				uint32_t hitMask = static_cast<uint32_t>(_mm256_movemask_ps(isValid));
+				if (hitMask == 0)
+					continue;
+
+				alignas(32) float hitT[8];
+				_mm256_store_ps(hitT, t);
+
+				// Closest lane of this group, tMax already rejected everything behind earlier hits
+				while (hitMask != 0)
+				{
+					const uint32_t i = static_cast<uint32_t>(std::countr_zero(hitMask));
+					hitMask &= hitMask - 1;
+
+					if (hitT[i] <= tMax)
+					{
+						tMax = hitT[i];
+						hitLane = lane + i;
+					}
+				}
+
+				if (anyHit)
+					return hitLane;
+			}
+
+			return hitLane;
+		}
+#endif
+	};
+#pragma endregion
+
+	void PackedTriangles::Pack(const std::vector<Vector3>& positions, const std::vector<Vector3>& normals, const std::vector<int>& indices,
+		const std::vector<uint32_t>& order, float cullSign, ThreadPool* pThreadPool)
+	{
+		const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+		if (triangleCount == 0)
+		{
+			Clear();
+			return;
+		}
+
+		const bool useOrder = order.size() == triangleCount;
+
+		// Padding lanes stay zero, a zero normal never passes the perpendicular test
+		m_TriangleCount = triangleCount;
+		m_Stride = (triangleCount + MaxWidth - 1) / MaxWidth * MaxWidth + MaxWidth;
+		m_Data.assign(static_cast<size_t>(StreamCount) * m_Stride, 0.f);
+		m_TriangleIndices.resize(triangleCount);
+
+		float* pV0X = GetStream(V0X);
+		float* pV0Y = GetStream(V0Y);
+		float* pV0Z = GetStream(V0Z);
+		float* pEdge1X = GetStream(Edge1X);
+		float* pEdge1Y = GetStream(Edge1Y);
+		float* pEdge1Z = GetStream(Edge1Z);
+		float* pEdge2X = GetStream(Edge2X);
+		float* pEdge2Y = GetStream(Edge2Y);
+		float* pEdge2Z = GetStream(Edge2Z);
+		float* pNormalX = GetStream(NormalX);
+		float* pNormalY = GetStream(NormalY);
+		float* pNormalZ = GetStream(NormalZ);
+		float* pCullSign = GetStream(CullSign);
+
+		// Blocks write disjoint lanes, every one can go to another thread
+		const uint32_t blockCount = (triangleCount + PackBlockSize - 1) / PackBlockSize;
+		auto packBlock = [&](uint32_t block)
+		{
+			const uint32_t laneEnd = std::min(triangleCount, (block + 1) * PackBlockSize);
+			for (uint32_t lane{ block * PackBlockSize }; lane < laneEnd; ++lane)
+			{
+				const uint32_t triangle = useOrder ? order[lane] : lane;
+
+				const Vector3& v0 = positions[indices[triangle * 3]];
+				const Vector3 edge1 = positions[indices[triangle * 3 + 1]] - v0;
+				const Vector3 edge2 = positions[indices[triangle * 3 + 2]] - v0;
+				const Vector3& normal = normals[triangle];
+
+				pV0X[lane] = v0.x;
+				pV0Y[lane] = v0.y;
+				pV0Z[lane] = v0.z;
+				pEdge1X[lane] = edge1.x;
+				pEdge1Y[lane] = edge1.y;
+				pEdge1Z[lane] = edge1.z;
+				pEdge2X[lane] = edge2.x;
+				pEdge2Y[lane] = edge2.y;
+				pEdge2Z[lane] = edge2.z;
+				pNormalX[lane] = normal.x;
+				pNormalY[lane] = normal.y;
+				pNormalZ[lane] = normal.z;
+				pCullSign[lane] = cullSign;
+
+				m_TriangleIndices[lane] = triangle;
+			}
+		};
+
+		if (pThreadPool && blockCount > 1)
+		{
+			pThreadPool->Dispatch(blockCount, packBlock);
+		}
+		else
+		{
+			for (uint32_t block{}; block < blockCount; ++block)
+				packBlock(block);
+		}
+	}
+
+	void PackedTriangles::Clear()
+	{
+		m_Data.clear();
+		m_TriangleIndices.clear();
+		m_TriangleCount = 0;
+		m_Stride = 0;
+	}
+
+	Vector3 PackedTriangles::GetNormal(uint32_t lane) const
+	{
+		return { GetStream(NormalX)[lane], GetStream(NormalY)[lane], GetStream(NormalZ)[lane] };
+	}
+
+	uint32_t PackedTriangles::Intersect(TriangleKernel kernel, uint32_t first, uint32_t count,
+		const Vector3& origin, const Vector3& direction, float tMin, float& tMax, bool anyHit) const
+	{
+		assert(first + count <= m_TriangleCount && "Lane range out of bounds");
+
+		switch (kernel)
+		{
+#ifdef SIMD_X86
+		case TriangleKernel::SSE:
+			return PackedTriangleKernels::IntersectSSE(*this, first, count, origin, direction, tMin, tMax, anyHit);
+		case TriangleKernel::AVX2:
+			return PackedTriangleKernels::IntersectAVX2(*this, first, count, origin, direction, tMin, tMax, anyHit);
+#endif
+		default:
+			// The scalar reference path lives in GeometryUtils::HitTest_Triangle and never packs
+			assert(false && "Kernel can not intersect packed triangles");
+			return InvalidLane;
+		}
+	}
+}
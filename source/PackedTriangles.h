@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Vector3.h"
+
+namespace dae
+{
+	class ThreadPool;
+
+	enum class TriangleKernel
+	{
+		Scalar,
+		SSE,
+		AVX2
+	};
+
+	const char* GetTriangleKernelName(TriangleKernel kernel);
+	bool IsTriangleKernelSupported(TriangleKernel kernel);
+	// Widest kernel the cpu we run on supports, checked once
+	TriangleKernel GetBestTriangleKernel();
+
+	/**
+	 * \brief Triangles of one mesh in structure of arrays layout, tested 4 (SSE) or 8 (AVX2) at a time.
+	 * Lanes keep the order they were packed in, packing in bvh leaf order makes every leaf a contiguous lane range.
+	 */
+	class PackedTriangles final
+	{
+	public:
+		static constexpr uint32_t InvalidLane{ UINT32_MAX };
+
+		/**
+		 * \param order triangle for every lane (bvh primitive indices), empty packs the triangles in mesh order
+		 * \param cullSign 1 culls triangles facing away from the ray, -1 culls triangles facing it, 0 culls nothing
+		 * \param pThreadPool packs blocks of lanes in parallel when set
+		 */
+		void Pack(const std::vector<Vector3>& positions, const std::vector<Vector3>& normals, const std::vector<int>& indices,
+			const std::vector<uint32_t>& order, float cullSign, ThreadPool* pThreadPool = nullptr);
+		void Clear();
+
+		bool IsPacked() const { return m_TriangleCount > 0; }
+		uint32_t GetTriangleCount() const { return m_TriangleCount; }
+		uint32_t GetTriangleIndex(uint32_t lane) const { return m_TriangleIndices[lane]; }
+		Vector3 GetNormal(uint32_t lane) const;
+
+		/**
+		 * \brief Intersects a ray with lanes [first, first + count), same rules as GeometryUtils::HitTest_Triangle
+		 * \param tMax farthest hit accepted, set to the t of the hit when one is found
+		 * \param anyHit return the first hit found instead of the closest one
+		 * \return lane of the hit or InvalidLane
+		 */
+		uint32_t Intersect(TriangleKernel kernel, uint32_t first, uint32_t count,
+			const Vector3& origin, const Vector3& direction, float tMin, float& tMax, bool anyHit) const;
+
+	private:
+		friend struct PackedTriangleKernels;
+
+		// Streams stored back to back in m_Data, each m_Stride floats long
+		enum Stream : uint32_t
+		{
+			V0X, V0Y, V0Z,
+			Edge1X, Edge1Y, Edge1Z,
+			Edge2X, Edge2Y, Edge2Z,
+			NormalX, NormalY, NormalZ,
+			CullSign,
+			StreamCount
+		};
+
+		// Widest kernel, every stream is padded by this many lanes so a load never reads past the end
+		static constexpr uint32_t MaxWidth{ 8 };
+
+		std::vector<float> m_Data{};
+		std::vector<uint32_t> m_TriangleIndices{};
+		uint32_t m_TriangleCount{};
+		uint32_t m_Stride{};
+
+		const float* GetStream(Stream stream) const { return m_Data.data() + static_cast<size_t>(stream) * m_Stride; }
+		float* GetStream(Stream stream) { return m_Data.data() + static_cast<size_t>(stream) * m_Stride; }
+	};
+}
@@ -0,0 +1,242 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace dae
+{
+	namespace Profiler
+	{
+		namespace
+		{
+			struct Zone
+			{
+				const char* name{};
+				int64_t value{};
+				int64_t beginNs{};
+				int64_t endNs{};
+			};
+
+			// Written by its own thread only, head is published last so a reader never sees a half written zone
+			struct ThreadTrack
+			{
+				uint32_t threadId{};
+				std::string name{};
+				std::vector<Zone> zones = std::vector<Zone>(RingBufferSize);
+				std::atomic<uint64_t> head{};
+				// Set once its thread is gone, nothing writes to it anymore
+				std::atomic<bool> hasExited{};
+			};
+
+			struct Registry
+			{
+				std::mutex mutex{};
+				std::vector<std::shared_ptr<ThreadTrack>> tracks{};
+				uint32_t nextThreadId{};
+			};
+
+			// Owned by its thread, tells the registry when the thread exits
+			struct ThreadTrackOwner
+			{
+				std::shared_ptr<ThreadTrack> pTrack{};
+				// Kept until the thread records its first zone
+				std::string name{};
+
+				ThreadTrackOwner() = default;
+				~ThreadTrackOwner()
+				{
+					if (pTrack)
+						pTrack->hasExited.store(true, std::memory_order_release);
+				}
+
+				ThreadTrackOwner(const ThreadTrackOwner&) = delete;
+				ThreadTrackOwner(ThreadTrackOwner&&) noexcept = delete;
+				ThreadTrackOwner& operator=(const ThreadTrackOwner&) = delete;
+				ThreadTrackOwner& operator=(ThreadTrackOwner&&) noexcept = delete;
+			};
+
+			std::atomic<bool> g_IsCapturing{};
+
+			Registry& GetRegistry()
+			{
+				static Registry registry{};
+				return registry;
+			}
+
+			ThreadTrackOwner& GetThreadTrackOwner()
+			{
+				thread_local ThreadTrackOwner owner{};
+				return owner;
+			}
+
+			ThreadTrack& GetThreadTrack()
+			{
+				ThreadTrackOwner& owner = GetThreadTrackOwner();
+
+				// Shared with the registry, so the zones of a thread that already exited can still be written out
+				if (!owner.pTrack)
+				{
+					Registry& registry = GetRegistry();
+					std::lock_guard lock{ registry.mutex };
+
+					auto pNewTrack = std::make_shared<ThreadTrack>();
+					pNewTrack->threadId = registry.nextThreadId++;
+					pNewTrack->name = owner.name.empty() ? "Thread " + std::to_string(pNewTrack->threadId) : owner.name;
+					registry.tracks.push_back(pNewTrack);
+					owner.pTrack = std::move(pNewTrack);
+				}
+
+				return *owner.pTrack;
+			}
+
+			// Caller holds the registry mutex
+			void RemoveExitedTracks(Registry& registry)
+			{
+				std::erase_if(registry.tracks,
+					[](const std::shared_ptr<ThreadTrack>& pTrack) { return pTrack->hasExited.load(std::memory_order_acquire); });
+			}
+
+			int64_t ToNs(Clock::time_point time)
+			{
+				return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+			}
+		}
+
+		void RecordZone(const char* name, int64_t value, Clock::time_point begin, Clock::time_point end)
+		{
+			if (!g_IsCapturing.load(std::memory_order_relaxed))
+				return;
+
+			ThreadTrack& track = GetThreadTrack();
+
+			const uint64_t head = track.head.load(std::memory_order_relaxed);
+			track.zones[head % RingBufferSize] = Zone{ name, value, ToNs(begin), ToNs(end) };
+			track.head.store(head + 1, std::memory_order_release);
+		}
+
+		void SetThreadName(const std::string& name)
+		{
+			ThreadTrackOwner& owner = GetThreadTrackOwner();
+			owner.name = name;
+
+			if (owner.pTrack)
+			{
+				std::lock_guard lock{ GetRegistry().mutex };
+				owner.pTrack->name = name;
+			}
+		}
+
+		void StartCapture()
+		{
+			if (!ProfilingEnabled)
+			{
+				std::cout << "PROFILER: unavailable, the zones are compiled out of this build (NO_PROFILING)\n";
+				return;
+			}
+
+			Clear();
+			g_IsCapturing.store(true, std::memory_order_relaxed);
+		}
+
+		void StopCapture()
+		{
+			g_IsCapturing.store(false, std::memory_order_relaxed);
+		}
+
+		bool IsCapturing()
+		{
+			return g_IsCapturing.load(std::memory_order_relaxed);
+		}
+
+		bool WriteChromeTrace(const std::string& filename)
+		{
+			Registry& registry = GetRegistry();
+			std::lock_guard lock{ registry.mutex };
+
+			std::ofstream file{ filename };
+			if (!file)
+			{
+				std::cout << "PROFILER: could not write " << filename << "\n";
+				return false;
+			}
+
+			// Copied first, a thread recording meanwhile (a bvh rebuild on a background thread) can overwrite the oldest zones.
+			// Those are dropped, the zones that are kept were not touched until after the copy
+			std::vector<std::vector<Zone>> trackZones(registry.tracks.size());
+			for (size_t t{}; t < registry.tracks.size(); ++t)
+			{
+				const ThreadTrack& track = *registry.tracks[t];
+				const uint64_t head = track.head.load(std::memory_order_acquire);
+				const uint64_t first = head > RingBufferSize ? head - RingBufferSize : 0;
+
+				for (uint64_t i{ first }; i < head; ++i)
+					trackZones[t].push_back(track.zones[i % RingBufferSize]);
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+				const uint64_t overwrittenEnd = track.head.load(std::memory_order_relaxed) + 1;
+				if (overwrittenEnd > first + RingBufferSize)
+				{
+					const size_t overwrittenCount = static_cast<size_t>(std::min<uint64_t>(overwrittenEnd - first - RingBufferSize, head - first));
+					trackZones[t].erase(trackZones[t].begin(), trackZones[t].begin() + overwrittenCount);
+				}
+			}
+
+			// Timestamps start at the oldest zone still in a buffer
+			int64_t startNs{ INT64_MAX };
+			for (const std::vector<Zone>& zones : trackZones)
+			{
+				for (const Zone& zone : zones)
+					startNs = std::min(startNs, zone.beginNs);
+			}
+
+			file << std::fixed << std::setprecision(3);
+			file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+			size_t zoneCount{};
+			bool isFirstEvent{ true };
+			for (size_t t{}; t < registry.tracks.size(); ++t)
+			{
+				const ThreadTrack& track = *registry.tracks[t];
+				file << (isFirstEvent ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << track.threadId
+					<< ",\"args\":{\"name\":\"" << track.name << "\"}}";
+				isFirstEvent = false;
+
+				for (const Zone& zone : trackZones[t])
+				{
+					// Complete events, ts and dur are in microseconds
+					file << ",\n{\"name\":\"" << zone.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << track.threadId
+						<< ",\"ts\":" << static_cast<double>(zone.beginNs - startNs) / 1000.0
+						<< ",\"dur\":" << static_cast<double>(zone.endNs - zone.beginNs) / 1000.0;
+
+					if (zone.value >= 0)
+						file << ",\"args\":{\"value\":" << zone.value << "}";
+
+					file << "}";
+					++zoneCount;
+				}
+			}
+
+			file << "\n]}\n";
+
+			std::cout << "PROFILER: wrote " << zoneCount << " zones of " << registry.tracks.size() << " threads to " << filename << "\n";
+			RemoveExitedTracks(registry);
+			return static_cast<bool>(file);
+		}
+
+		void Clear()
+		{
+			Registry& registry = GetRegistry();
+			std::lock_guard lock{ registry.mutex };
+
+			RemoveExitedTracks(registry);
+			for (const auto& pTrack : registry.tracks)
+				pTrack->head.store(0, std::memory_order_release);
+		}
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Defining NO_PROFILING (the Release configuration does) compiles every zone out, PROFILE_ZONE then expands to nothing
+#if !defined(NO_PROFILING)
+#define PROFILING
+#endif
+
+namespace dae
+{
+#if defined(PROFILING)
+	constexpr bool ProfilingEnabled{ true };
+#else
+	constexpr bool ProfilingEnabled{ false };
+#endif
+
+	/**
+	 * \brief Timeline of named zones per thread, written out as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+	 * Every thread records into a ring buffer of its own without locking, the oldest zones are overwritten once it is full.
+	 * Zones are only kept during a capture, a thread gets its buffer the first time it records in one.
+	 */
+	namespace Profiler
+	{
+		// Zones every thread keeps, about 2 seconds of 16x16 tiles at 640x480 and 60 fps
+		constexpr uint32_t RingBufferSize{ 1u << 16 };
+
+		using Clock = std::chrono::steady_clock;
+
+		// name has to be a string literal, only the pointer is stored
+		void RecordZone(const char* name, int64_t value, Clock::time_point begin, Clock::time_point end);
+		// Shown as the track name of the calling thread
+		void SetThreadName(const std::string& name);
+
+		// Drops the zones of earlier captures, zones are recorded until StopCapture
+		void StartCapture();
+		void StopCapture();
+		bool IsCapturing();
+
+		// Call between frames, zones a background thread overwrites while they are copied are left out.
+		// The buffers of threads that exited are freed once written
+		bool WriteChromeTrace(const std::string& filename);
+		// Also frees the buffers of threads that exited
+		void Clear();
+	}
+
+	// Records a zone from construction to destruction
+	class ProfileZone final
+	{
+	public:
+		explicit ProfileZone(const char* name, int64_t value = -1)
+			: m_Name{ name }
+			, m_Value{ value }
+			, m_Begin{ Profiler::Clock::now() }
+		{
+		}
+
+		~ProfileZone()
+		{
+			Profiler::RecordZone(m_Name, m_Value, m_Begin, Profiler::Clock::now());
+		}
+
+		ProfileZone(const ProfileZone&) = delete;
+		ProfileZone(ProfileZone&&) noexcept = delete;
+		ProfileZone& operator=(const ProfileZone&) = delete;
+		ProfileZone& operator=(ProfileZone&&) noexcept = delete;
+
+	private:
+		const char* m_Name;
+		int64_t m_Value;
+		Profiler::Clock::time_point m_Begin;
+	};
+}
+
+#if defined(PROFILING)
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+// Zone until the end of the enclosing scope
+#define PROFILE_ZONE(name) const ::dae::ProfileZone PROFILE_CONCAT(profileZone, __LINE__){ name }
+// Same, value shows up in the zone's args, a tile index for example
+#define PROFILE_ZONE_VALUE(name, value) const ::dae::ProfileZone PROFILE_CONCAT(profileZone, __LINE__){ name, static_cast<int64_t>(value) }
+#define PROFILE_THREAD_NAME(name) ::dae::Profiler::SetThreadName(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_ZONE_VALUE(name, value) ((void)0)
+#define PROFILE_THREAD_NAME(name) ((void)0)
+#endif
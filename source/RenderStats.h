@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+
+// Defining NO_RENDER_STATS (the Release configuration does) compiles every counter out, RENDER_STATS_ADD then expands to nothing
+#if !defined(NO_RENDER_STATS)
+#define RENDER_STATS
+#endif
+
+namespace dae
+{
+#if defined(RENDER_STATS)
+	constexpr bool RenderStatsEnabled{ true };
+#else
+	constexpr bool RenderStatsEnabled{ false };
+#endif
+
+	/**
+	 * \brief Work done while rendering, counted per thread and summed by the renderer once the frame is done.
+	 */
+	struct RenderStats
+	{
+		uint64_t primaryRays{};
+		uint64_t shadowRays{};
+		// Bvh node and mesh bound slab tests, a packet test counts once per active lane
+		uint64_t aabbTests{};
+		// Bvh nodes popped by a traversal that were still in front of the closest hit
+		uint64_t nodeVisits{};
+		uint64_t triangleTests{};
+		uint64_t sphereTests{};
+		uint64_t planeTests{};
+		// Primary rays that hit something
+		uint64_t primaryHits{};
+		// Shadow rays that found something between the hit and the light
+		uint64_t occludedShadowRays{};
+		// Material evaluations
+		uint64_t shadeCalls{};
+
+		RenderStats& operator+=(const RenderStats& other)
+		{
+			primaryRays += other.primaryRays;
+			shadowRays += other.shadowRays;
+			aabbTests += other.aabbTests;
+			nodeVisits += other.nodeVisits;
+			triangleTests += other.triangleTests;
+			sphereTests += other.sphereTests;
+			planeTests += other.planeTests;
+			primaryHits += other.primaryHits;
+			occludedShadowRays += other.occludedShadowRays;
+			shadeCalls += other.shadeCalls;
+			return *this;
+		}
+	};
+
+#if defined(RENDER_STATS)
+	// Plain increments on the counters of the calling thread, nothing is shared until the renderer collects them
+	inline thread_local RenderStats g_ThreadRenderStats{};
+
+#define RENDER_STATS_ADD(counter, value) (::dae::g_ThreadRenderStats.counter += (value))
+#else
+#define RENDER_STATS_ADD(counter, value) ((void)0)
+#endif
+
+	// Counts of the calling thread since the last TakeThreadRenderStats, left as they are
+	inline RenderStats PeekThreadRenderStats()
+	{
+#if defined(RENDER_STATS)
+		return g_ThreadRenderStats;
+#else
+		return RenderStats{};
+#endif
+	}
+
+	// Counts of the calling thread since the last call, which start over at zero
+	inline RenderStats TakeThreadRenderStats()
+	{
+#if defined(RENDER_STATS)
+		const RenderStats stats = g_ThreadRenderStats;
+		g_ThreadRenderStats = RenderStats{};
+		return stats;
+#else
+		return RenderStats{};
+#endif
+	}
+}
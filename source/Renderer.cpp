@@ -11,14 +11,24 @@
 #include "Scene.h"
 #include "Utils.h"
 #include "Camera.h"
+#include "Profiler.h"
 #include <future>
-#include <ppl.h>
 
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <numeric>
+#include <stdexcept>
 #include <vector>
 using namespace dae;
 
 //#define ASYNC
-#define PARALLEL_FOR
+//#define PARALLEL_FOR
+#define TILED
+
+#if defined(PARALLEL_FOR)
+#include <ppl.h>
+#endif
 
 Renderer::Renderer(SDL_Window * pWindow) :
 	m_pWindow(pWindow),
@@ -27,19 +37,91 @@ Renderer::Renderer(SDL_Window * pWindow) :
 	//Initialize
 	SDL_GetWindowSize(pWindow, &m_Width, &m_Height);
 	m_pBufferPixels = static_cast<uint32_t*>(m_pBuffer->pixels);
+	m_AccumulationBuffer.resize(static_cast<size_t>(m_Width) * m_Height);
+	m_LuminanceSquaredBuffer.resize(static_cast<size_t>(m_Width) * m_Height);
+
+	m_pThreadPool = std::make_unique<ThreadPool>();
+}
+
+Renderer::Renderer(uint32_t width, uint32_t height) :
+	m_pBuffer(SDL_CreateRGBSurfaceWithFormat(0, static_cast<int>(width), static_cast<int>(height), 32, SDL_PIXELFORMAT_ARGB8888)),
+	m_OwnsBuffer(true),
+	m_Width(static_cast<int>(width)),
+	m_Height(static_cast<int>(height))
+{
+	//Surfaces don't need the video subsystem, so this works without a display
+	if (!m_pBuffer)
+		throw std::runtime_error(std::string("Failed to create framebuffer: ") + SDL_GetError());
+
+	m_pBufferPixels = static_cast<uint32_t*>(m_pBuffer->pixels);
+	m_AccumulationBuffer.resize(static_cast<size_t>(m_Width) * m_Height);
+	m_LuminanceSquaredBuffer.resize(static_cast<size_t>(m_Width) * m_Height);
+
+	m_pThreadPool = std::make_unique<ThreadPool>();
+}
+
+Renderer::~Renderer()
+{
+	if (m_OwnsBuffer)
+		SDL_FreeSurface(m_pBuffer);
 }
 
 void Renderer::Render(Scene* pScene) const
 {
+	PROFILE_ZONE("Renderer::Render");
+
 	Camera& camera = pScene->GetCamera();
 	camera.CalculateCameraToWorld();
 
-	auto& materials = pScene->GetMaterials();
-	auto& lights = pScene->GetLights();
+	pScene->UpdateTopLevelBVH();
+
+	//Anything that moved invalidates the samples gathered so far
+	if (!m_UseAccumulation || pScene->IsAnimated() || HasCameraChanged(camera))
+		m_SampleCount = 0;
 
-	const float as{ (static_cast<float>(m_Width) / static_cast<float>(m_Height)) };
+	m_AccumulationCamera = camera;
+
+	//Nothing in here is copied again or allocated, the threads all read this one snapshot
+	const FrameContext frame{
+		pScene,
+		camera,
+		pScene->GetLights(),
+		pScene->GetMaterialTable(),
+		static_cast<float>(m_Width),
+		static_cast<float>(m_Height),
+		static_cast<float>(m_Width) / static_cast<float>(m_Height)
+	};
 
 	const uint32_t numPixels = m_Width * m_Height;
+	//Every pixel takes the same sample, except in the TILED path where each tile keeps its own count
+	const uint32_t sampleIndex = m_SampleCount;
+
+	m_FrameRayCount.primaryRays = numPixels;
+	m_ShadowRayCount.store(0, std::memory_order_relaxed);
+
+	//Anything this thread traced outside of a frame doesn't belong to the first task it runs
+	TakeThreadRenderStats();
+
+	//Lighting mode and shadows can't change during a frame
+	const RenderKernels kernels = SelectRenderKernels();
+
+	//Only the TILED path can have nothing left to sample
+	bool hasAddedSamples{ true };
+
+	if (m_HeatmapMode != HeatmapMode::Off)
+	{
+		RenderHeatmap(frame, kernels.pPerPixel);
+
+		//Nothing was accumulated, shading starts over once the heatmap is off
+		m_SampleCount = 0;
+
+		if (m_pWindow)
+		{
+			PROFILE_ZONE("Present");
+			SDL_UpdateWindowSurface(m_pWindow);
+		}
+		return;
+	}
 
 #if defined(ASYNC)
 	const uint32_t numCores = std::thread::hardware_concurrency();
@@ -49,6 +131,8 @@ void Renderer::Render(Scene* pScene) const
 	uint32_t numUnassignedPixels = numPixels % numCores;
 	uint32_t currPixelIndex = 0;
 
+	m_TaskStats.assign(numCores, RenderStats{});
+
 	for (uint32_t coreId{ 0 }; coreId < numCores; ++coreId)
 	{
 		uint32_t taskSize = numPixelsPerTask;
@@ -60,14 +144,18 @@ void Renderer::Render(Scene* pScene) const
 		}
 
 		async_futures.push_back(
-			std::async(std::launch::async, [=, this]
+			std::async(std::launch::async, [=, &frame, this]
 				{
 					const uint32_t pixelIndexEnd = currPixelIndex + taskSize;
+					uint64_t shadowRays{};
 
 					for (uint32_t pixelIndex{ currPixelIndex }; pixelIndex < pixelIndexEnd; ++pixelIndex)
 					{
-						PerPixel(pScene, pixelIndex, camera.fov, as, camera, lights, materials);
+						shadowRays += (this->*kernels.pPerPixel)(frame, sampleIndex, pixelIndex);
 					}
+
+					m_ShadowRayCount.fetch_add(shadowRays, std::memory_order_relaxed);
+					m_TaskStats[coreId] = TakeThreadRenderStats();
 				}
 			)
 		);
@@ -79,29 +167,229 @@ void Renderer::Render(Scene* pScene) const
 	{
 		f.wait();
 	}
+#elif defined(TILED)
+	const uint32_t numTilesX = (m_Width + m_TileSize - 1) / m_TileSize;
+	const uint32_t numTilesY = (m_Height + m_TileSize - 1) / m_TileSize;
+	const uint32_t numTiles = numTilesX * numTilesY;
+
+	if (sampleIndex == 0 || m_TileStates.size() != numTiles)
+	{
+		m_TileStates.assign(numTiles, TileState{});
+		m_SamplingStats = SamplingStats{};
+		m_SamplingStats.tileCount = numTiles;
+		m_HasReportedConvergence = false;
+	}
+
+	//Converged tiles hand their share of the frame's rays to the tiles that are still noisy
+	uint32_t samplesPerTile{ 1 };
+	if (m_UseAdaptiveSampling && m_SamplingStats.convergedTileCount < numTiles)
+	{
+		const uint32_t activeTileCount = numTiles - m_SamplingStats.convergedTileCount;
+		samplesPerTile = std::min((numTiles + activeTileCount - 1) / activeTileCount, MaxTileSamplesPerFrame);
+	}
+
+	m_PrimaryRayCount.store(0, std::memory_order_relaxed);
+	m_TaskStats.assign(numTiles, RenderStats{});
+
+	//Once every tile is done the image is final until something resets it, no sample is added
+	hasAddedSamples = m_SamplingStats.convergedTileCount < numTiles;
+	if (hasAddedSamples)
+	{
+		m_pThreadPool->Dispatch(numTiles, [&](uint32_t tileIndex)
+		{
+			PROFILE_ZONE_VALUE("Tile", tileIndex);
+
+			TileState& tile = m_TileStates[tileIndex];
+			if (tile.isConverged)
+				return;
+
+			const uint32_t startX = (tileIndex % numTilesX) * m_TileSize;
+			const uint32_t startY = (tileIndex / numTilesX) * m_TileSize;
+			const uint32_t endX = std::min(startX + m_TileSize, static_cast<uint32_t>(m_Width));
+			const uint32_t endY = std::min(startY + m_TileSize, static_cast<uint32_t>(m_Height));
+			const uint32_t sampleEnd = std::min(tile.sampleCount + samplesPerTile, m_MaxSampleCount);
+			const uint32_t sampleCount = sampleEnd - tile.sampleCount;
+			uint64_t shadowRays{};
+
+			for (; tile.sampleCount < sampleEnd; ++tile.sampleCount)
+			{
+				if (m_UsePacketTracing)
+				{
+					shadowRays += (this->*kernels.pRenderTilePackets)(frame, tile.sampleCount, startX, startY, endX, endY);
+				}
+				else
+				{
+					for (uint32_t py{ startY }; py < endY; ++py)
+					{
+						for (uint32_t px{ startX }; px < endX; ++px)
+						{
+							shadowRays += (this->*kernels.pPerPixel)(frame, tile.sampleCount, px + py * m_Width);
+						}
+					}
+				}
+			}
+
+			tile.isConverged = tile.sampleCount >= m_MaxSampleCount
+				|| (m_UseAdaptiveSampling && tile.sampleCount >= MinAdaptiveSampleCount
+					&& GetTileError(startX, startY, endX, endY, tile.sampleCount) < m_ErrorThreshold);
+
+			m_PrimaryRayCount.fetch_add(static_cast<uint64_t>(sampleCount) * (endX - startX) * (endY - startY), std::memory_order_relaxed);
+			m_ShadowRayCount.fetch_add(shadowRays, std::memory_order_relaxed);
+			m_TaskStats[tileIndex] = TakeThreadRenderStats();
+		});
+	}
+
+	m_FrameRayCount.primaryRays = m_PrimaryRayCount.load(std::memory_order_relaxed);
+	UpdateSamplingStats();
 #elif defined(PARALLEL_FOR)
-	concurrency::parallel_for(0u, numPixels, [=, this](int i) {
-		PerPixel(pScene, i, camera.fov, as, camera, lights, materials);
+	concurrency::combinable<RenderStats> threadStats{};
+	concurrency::parallel_for(0u, numPixels, [&frame, &threadStats, kernels, sampleIndex, this](int i) {
+		m_ShadowRayCount.fetch_add((this->*kernels.pPerPixel)(frame, sampleIndex, i), std::memory_order_relaxed);
+		threadStats.local() += TakeThreadRenderStats();
 	});
+
+	m_TaskStats.assign(1, RenderStats{});
+	threadStats.combine_each([this](const RenderStats& stats) { m_TaskStats[0] += stats; });
 #else
+	uint64_t shadowRays{};
 	for (uint32_t p{}; p < numPixels; ++p)
 	{
-		PerPixel(pScene, p, camera.fov, as, camera, lights, materials);
+		shadowRays += (this->*kernels.pPerPixel)(frame, sampleIndex, p);
 	}
+	m_ShadowRayCount.store(shadowRays, std::memory_order_relaxed);
+	m_TaskStats.assign(1, TakeThreadRenderStats());
 #endif
 
+	m_FrameStats = std::accumulate(m_TaskStats.begin(), m_TaskStats.end(), RenderStats{},
+		[](RenderStats sum, const RenderStats& stats) { return sum += stats; });
+
+	m_FrameRayCount.shadowRays = m_ShadowRayCount.load(std::memory_order_relaxed);
+	if (hasAddedSamples)
+		++m_SampleCount;
+
 	//@END
 	//Update SDL Surface
-	SDL_UpdateWindowSurface(m_pWindow);
+	if (m_pWindow)
+	{
+		PROFILE_ZONE("Present");
+		SDL_UpdateWindowSurface(m_pWindow);
+	}
 }
 
 bool Renderer::SaveBufferToImage() const
 {
-	return SDL_SaveBMP(m_pBuffer, "RayTracing_Buffer.bmp");
+	return SaveBufferToImage("RayTracing_Buffer.bmp");
+}
+
+bool Renderer::SaveBufferToImage(const std::string& filePath) const
+{
+	PROFILE_ZONE("Renderer::SaveBufferToImage");
+	return SDL_SaveBMP(m_pBuffer, filePath.c_str());
+}
+
+void Renderer::SetTileSize(uint32_t tileSize)
+{
+	m_TileSize = std::max(tileSize, 1u);
+}
+
+void Renderer::SetThreadCount(uint32_t threadCount)
+{
+	m_pThreadPool = std::make_unique<ThreadPool>(threadCount);
+}
+
+void Renderer::PrintThreadStats() const
+{
+	std::cout << "TILE SIZE: " << m_TileSize << "x" << m_TileSize << "\n";
+	m_pThreadPool->PrintWorkerStats();
+	m_pThreadPool->ResetWorkerStats();
+}
+
+void Renderer::PrintFrameStats() const
+{
+#if defined(RENDER_STATS)
+	const RenderStats& stats = m_FrameStats;
+	std::cout << "FRAME STATS: " << stats.primaryRays << " primary rays (" << stats.primaryHits << " hits), "
+		<< stats.shadowRays << " shadow rays (" << stats.occludedShadowRays << " occluded)\n"
+		<< "  tests: " << stats.aabbTests << " aabb (" << stats.nodeVisits << " bvh nodes visited), " << stats.triangleTests << " triangle, "
+		<< stats.sphereTests << " sphere, " << stats.planeTests << " plane, " << stats.shadeCalls << " shade calls\n";
+#else
+	std::cout << "FRAME STATS: unavailable, the counters are compiled out of this build (NO_RENDER_STATS)\n";
+#endif
+
+	if (m_HeatmapMode != HeatmapMode::Off)
+		std::cout << "  heatmap: blue is " << m_HeatmapMinCost << ", red is " << m_HeatmapMaxCost << (m_HeatmapMode == HeatmapMode::Time ? " ns" : "") << " per pixel\n";
+}
+
+void Renderer::CycleHeatmapMode()
+{
+#if defined(RENDER_STATS)
+	SetHeatmapMode(static_cast<HeatmapMode>((static_cast<int>(m_HeatmapMode) + 1) % 4));
+#else
+	SetHeatmapMode(m_HeatmapMode == HeatmapMode::Off ? HeatmapMode::Time : HeatmapMode::Off);
+#endif
+}
+
+void Renderer::SetHeatmapMode(HeatmapMode mode)
+{
+#if !defined(RENDER_STATS)
+	if (mode == HeatmapMode::NodeVisits || mode == HeatmapMode::TriangleTests)
+	{
+		std::cout << "HEATMAP: node and triangle counts are unavailable, the counters are compiled out of this build (NO_RENDER_STATS). Showing time instead" << "\n";
+		mode = HeatmapMode::Time;
+	}
+#endif
+
+	ResetAccumulation();
+	m_HeatmapMode = mode;
+
+	switch (m_HeatmapMode)
+	{
+	case HeatmapMode::Off:
+		std::cout << "HEATMAP: OFF" << "\n";
+		break;
+	case HeatmapMode::NodeVisits:
+		std::cout << "HEATMAP: bvh node visits" << "\n";
+		break;
+	case HeatmapMode::TriangleTests:
+		std::cout << "HEATMAP: triangle tests" << "\n";
+		break;
+	case HeatmapMode::Time:
+		std::cout << "HEATMAP: time" << "\n";
+		break;
+	}
+}
+
+void Renderer::TogglePacketTracing()
+{
+	m_UsePacketTracing = !m_UsePacketTracing;
+	std::cout << "PACKET TRACING: " << (m_UsePacketTracing ? "ON" : "OFF") << "\n";
+}
+
+void Renderer::ToggleAccumulation()
+{
+	m_UseAccumulation = !m_UseAccumulation;
+	ResetAccumulation();
+	std::cout << "ACCUMULATION: " << (m_UseAccumulation ? "ON" : "OFF") << "\n";
+}
+
+void Renderer::ToggleAdaptiveSampling()
+{
+	m_UseAdaptiveSampling = !m_UseAdaptiveSampling;
+	ResetAccumulation();
+	std::cout << "ADAPTIVE SAMPLING: " << (m_UseAdaptiveSampling ? "ON" : "OFF") << "\n";
+}
+
+void Renderer::SetAdaptiveSampling(float errorThreshold, uint32_t maxSampleCount)
+{
+	m_ErrorThreshold = std::max(errorThreshold, 0.f);
+	m_MaxSampleCount = std::max(maxSampleCount, 1u);
+	ResetAccumulation();
 }
 
 void Renderer::CycleLightingMode()
 {
+	ResetAccumulation();
+
 	int modeId = static_cast<int>(m_CurrentLightingMode);
 	m_CurrentLightingMode = static_cast<LightingMode>((++modeId) % 4);
 
@@ -122,37 +410,339 @@ void Renderer::CycleLightingMode()
 	}
 }
 
-void Renderer::PerPixel(Scene* pScene, uint32_t pixelIndex, float fov, float as, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const
+Renderer::RenderKernels Renderer::SelectRenderKernels() const
 {
-	// Light ray constants
-	constexpr float minLightRay{ 0.001f };
+	switch (m_CurrentLightingMode)
+	{
+	case LightingMode::ObservedArea:
+		return GetRenderKernels<LightingMode::ObservedArea>(m_CanRenderShadow);
+	case LightingMode::Radiance:
+		return GetRenderKernels<LightingMode::Radiance>(m_CanRenderShadow);
+	case LightingMode::BRDF:
+		return GetRenderKernels<LightingMode::BRDF>(m_CanRenderShadow);
+	case LightingMode::Combined:
+		break;
+	}
 
-	const int px = pixelIndex % m_Width;
-	const int py = pixelIndex / m_Width;
+	return GetRenderKernels<LightingMode::Combined>(m_CanRenderShadow);
+}
 
-	const float rx = px + 0.5f;
-	const float ry = py + 0.5f;
+template <Renderer::LightingMode Mode>
+Renderer::RenderKernels Renderer::GetRenderKernels(bool canRenderShadow)
+{
+	if (canRenderShadow)
+		return { &Renderer::PerPixel<Mode, true>, &Renderer::RenderTilePackets<Mode, true> };
 
-	const float cx = ((2 * (rx)) / static_cast<float>(m_Width) - 1) * (static_cast<float>(m_Width) / static_cast<float>(m_Height)) * camera.fov;
-	const float cy = (1 - (2 * (ry)) / static_cast<float>(m_Height)) * camera.fov;
+	return { &Renderer::PerPixel<Mode, false>, &Renderer::RenderTilePackets<Mode, false> };
+}
 
-	const Vector3 rayDirection = camera.cameraToWorld.TransformVector(Vector3(cx, cy, 1.f)).Normalized();
-	const Ray hitRay = Ray{ camera.origin, rayDirection };
+template <Renderer::LightingMode Mode, bool Shadows>
+uint32_t Renderer::PerPixel(const FrameContext& frame, uint32_t sampleIndex, uint32_t pixelIndex) const
+{
+	const uint32_t px = pixelIndex % m_Width;
+	const uint32_t py = pixelIndex / m_Width;
 
-	// Color to write to buffer
-	ColorRGB finalColor{};
+	const Vector3 rayDirection = GetSampleDirection(frame, sampleIndex, px, py).Normalized();
+	const Ray hitRay = Ray{ frame.camera.origin, rayDirection };
+	RENDER_STATS_ADD(primaryRays, 1);
 
 	// HitRecord containing info about hit
 	HitRecord closestHit{};
 
-	pScene->GetClosestHit(hitRay, closestHit);
+	frame.pScene->GetClosestHit(hitRay, closestHit);
+
+	return ShadePixel<Mode, Shadows>(frame, sampleIndex, px, py, rayDirection, closestHit);
+}
+
+template <Renderer::LightingMode Mode, bool Shadows>
+uint32_t Renderer::RenderTilePackets(const FrameContext& frame, uint32_t sampleIndex, uint32_t startX, uint32_t startY, uint32_t endX, uint32_t endY) const
+{
+	uint32_t shadowRays{};
+
+	// Objects outside the pyramid through the tile corners can't be hit by any primary ray of the tile, samples never leave their pixel
+	const Vector3 corners[4]{
+		GetPrimaryRayDirection(frame, static_cast<float>(startX), static_cast<float>(startY)),
+		GetPrimaryRayDirection(frame, static_cast<float>(endX), static_cast<float>(startY)),
+		GetPrimaryRayDirection(frame, static_cast<float>(endX), static_cast<float>(endY)),
+		GetPrimaryRayDirection(frame, static_cast<float>(startX), static_cast<float>(endY))
+	};
+	const Frustum frustum{ frame.camera.origin, corners };
+
+	// Keeps its capacity between tiles, so culling doesn't allocate every frame
+	static thread_local std::vector<uint32_t> visibleObjects{};
+	frame.pScene->GatherVisibleObjects(frustum, visibleObjects);
+
+	RayPacket packet{};
+	packet.origin = frame.camera.origin;
+
+	for (uint32_t py{ startY }; py < endY; py += RayPacket::Width)
+	{
+		for (uint32_t px{ startX }; px < endX; px += RayPacket::Width)
+		{
+			packet.activeMask = 0;
+
+			for (uint32_t lane{}; lane < RayPacket::Size; ++lane)
+			{
+				const uint32_t laneX = px + lane % RayPacket::Width;
+				const uint32_t laneY = py + lane / RayPacket::Width;
+
+				// Lanes past the edge of the tile keep a zero direction and are masked out
+				Vector3 rayDirection{};
+				if (laneX < endX && laneY < endY)
+				{
+					rayDirection = GetSampleDirection(frame, sampleIndex, laneX, laneY).Normalized();
+					packet.activeMask |= 1u << lane;
+				}
+
+				packet.directionX[lane] = rayDirection.x;
+				packet.directionY[lane] = rayDirection.y;
+				packet.directionZ[lane] = rayDirection.z;
+			}
+
+			HitRecord hitRecords[RayPacket::Size]{};
+			frame.pScene->GetClosestHit(packet, visibleObjects, hitRecords);
+			RENDER_STATS_ADD(primaryRays, std::popcount(packet.activeMask));
+
+			for (uint32_t lane{}; lane < RayPacket::Size; ++lane)
+			{
+				if ((packet.activeMask & (1u << lane)) == 0)
+					continue;
+
+				shadowRays += ShadePixel<Mode, Shadows>(frame, sampleIndex, px + lane % RayPacket::Width, py + lane / RayPacket::Width,
+					packet.GetDirection(lane), hitRecords[lane]);
+			}
+		}
+	}
+
+	return shadowRays;
+}
+
+Vector3 Renderer::GetPrimaryRayDirection(const FrameContext& frame, float rx, float ry)
+{
+	const float cx = ((2 * (rx)) / frame.width - 1) * frame.aspectRatio * frame.camera.fov;
+	const float cy = (1 - (2 * (ry)) / frame.height) * frame.camera.fov;
+
+	return frame.camera.cameraToWorld.TransformVector(Vector3(cx, cy, 1.f));
+}
+
+Vector3 Renderer::GetSampleDirection(const FrameContext& frame, uint32_t sampleIndex, uint32_t px, uint32_t py) const
+{
+	// The first sample goes through the pixel center, so a moving camera looks the same as without accumulation
+	if (sampleIndex == 0)
+		return GetPrimaryRayDirection(frame, px + 0.5f, py + 0.5f);
+
+	// The others walk a 4x4 grid of strata, every group of 4 covers each quadrant of the pixel once.
+	// Every pixel starts at a different group so neighbours don't share a pattern
+	const uint32_t pixelHash = Hash(px + py * m_Width);
+	const uint32_t stratum = (sampleIndex - 1 + (pixelHash << 2)) % 16;
+	const uint32_t stratumX = ((stratum & 1) << 1) | ((stratum >> 2) & 1);
+	const uint32_t stratumY = (((stratum >> 1) & 1) << 1) | ((stratum >> 3) & 1);
+
+	const uint32_t sampleHash = Hash(pixelHash ^ sampleIndex);
+	const float offsetX = (stratumX + HashToFloat(sampleHash)) * 0.25f;
+	const float offsetY = (stratumY + HashToFloat(sampleHash + 1)) * 0.25f;
+
+	return GetPrimaryRayDirection(frame, px + offsetX, py + offsetY);
+}
+
+void Renderer::AccumulatePixel(uint32_t sampleIndex, uint32_t px, uint32_t py, const ColorRGB& color) const
+{
+	const uint32_t pixelIndex = px + py * m_Width;
+	const float luminance = color.Luminance();
+
+	ColorRGB& accumulatedColor = m_AccumulationBuffer[pixelIndex];
+	float& luminanceSquared = m_LuminanceSquaredBuffer[pixelIndex];
+	if (sampleIndex == 0)
+	{
+		accumulatedColor = color;
+		luminanceSquared = luminance * luminance;
+	}
+	else
+	{
+		accumulatedColor += color;
+		luminanceSquared += luminance * luminance;
+	}
+
+	ColorRGB finalColor = accumulatedColor;
+	finalColor *= 1.f / static_cast<float>(sampleIndex + 1);
+
+	m_pBufferPixels[pixelIndex] = SDL_MapRGB(m_pBuffer->format,
+		static_cast<uint8_t>(finalColor.r * 255),
+		static_cast<uint8_t>(finalColor.g * 255),
+		static_cast<uint8_t>(finalColor.b * 255));
+}
+
+float Renderer::GetTileError(uint32_t startX, uint32_t startY, uint32_t endX, uint32_t endY, uint32_t sampleCount) const
+{
+	const float invSampleCount = 1.f / static_cast<float>(sampleCount);
+	float maxVariance{};
+
+	for (uint32_t py{ startY }; py < endY; ++py)
+	{
+		for (uint32_t px{ startX }; px < endX; ++px)
+		{
+			const uint32_t pixelIndex = px + py * m_Width;
+			const float mean = m_AccumulationBuffer[pixelIndex].Luminance() * invSampleCount;
+			const float variance = m_LuminanceSquaredBuffer[pixelIndex] * invSampleCount - mean * mean;
+
+			maxVariance = std::max(maxVariance, variance);
+		}
+	}
+
+	// Standard error of the mean, the average on screen is off by about this much
+	return sqrtf(maxVariance * invSampleCount);
+}
+
+void Renderer::UpdateSamplingStats() const
+{
+	m_SamplingStats.tracedSamples += m_FrameRayCount.primaryRays;
+	m_SamplingStats.convergedTileCount = 0;
+
+	uint32_t maxTileSampleCount{};
+	for (const TileState& tile : m_TileStates)
+	{
+		m_SamplingStats.convergedTileCount += tile.isConverged;
+		maxTileSampleCount = std::max(maxTileSampleCount, tile.sampleCount);
+	}
+
+	m_SamplingStats.uniformSamples = static_cast<uint64_t>(m_Width) * m_Height * maxTileSampleCount;
+
+	if (!m_UseAdaptiveSampling || m_HasReportedConvergence || m_SamplingStats.convergedTileCount < m_SamplingStats.tileCount)
+		return;
+
+	m_HasReportedConvergence = true;
+
+	const double savedPercentage = 100.0 * (1.0 - static_cast<double>(m_SamplingStats.tracedSamples) / static_cast<double>(m_SamplingStats.uniformSamples));
+	std::cout << "ADAPTIVE SAMPLING: converged at " << maxTileSampleCount << " spp, traced " << m_SamplingStats.tracedSamples
+		<< " samples instead of " << m_SamplingStats.uniformSamples << " (" << savedPercentage << "% saved)\n";
+}
+
+void Renderer::RenderHeatmap(const FrameContext& frame, PerPixelFunction pPerPixel) const
+{
+	const uint32_t numTilesX = (m_Width + m_TileSize - 1) / m_TileSize;
+	const uint32_t numTilesY = (m_Height + m_TileSize - 1) / m_TileSize;
+	const uint32_t numTiles = numTilesX * numTilesY;
+
+	m_HeatmapBuffer.resize(static_cast<size_t>(m_Width) * m_Height);
+	m_TaskStats.assign(numTiles, RenderStats{});
+
+	const HeatmapMode mode = m_HeatmapMode;
+	const auto getCount = [mode](const RenderStats& stats)
+	{
+		return mode == HeatmapMode::NodeVisits ? stats.nodeVisits : stats.triangleTests;
+	};
+
+	m_pThreadPool->Dispatch(numTiles, [&](uint32_t tileIndex)
+	{
+		PROFILE_ZONE_VALUE("Heatmap tile", tileIndex);
+
+		const uint32_t startX = (tileIndex % numTilesX) * m_TileSize;
+		const uint32_t startY = (tileIndex / numTilesX) * m_TileSize;
+		const uint32_t endX = std::min(startX + m_TileSize, static_cast<uint32_t>(m_Width));
+		const uint32_t endY = std::min(startY + m_TileSize, static_cast<uint32_t>(m_Height));
+		uint64_t shadowRays{};
+
+		for (uint32_t py{ startY }; py < endY; ++py)
+		{
+			for (uint32_t px{ startX }; px < endX; ++px)
+			{
+				const uint32_t pixelIndex = px + py * m_Width;
+				const uint64_t startCount = getCount(PeekThreadRenderStats());
+				const auto startTime = std::chrono::steady_clock::now();
+
+				shadowRays += (this->*pPerPixel)(frame, 0, pixelIndex);
+
+				if (mode == HeatmapMode::Time)
+					m_HeatmapBuffer[pixelIndex] = std::chrono::duration<float, std::nano>(std::chrono::steady_clock::now() - startTime).count();
+				else
+					m_HeatmapBuffer[pixelIndex] = static_cast<float>(getCount(PeekThreadRenderStats()) - startCount);
+			}
+		}
+
+		m_ShadowRayCount.fetch_add(shadowRays, std::memory_order_relaxed);
+		m_TaskStats[tileIndex] = TakeThreadRenderStats();
+	});
+
+	m_FrameStats = std::accumulate(m_TaskStats.begin(), m_TaskStats.end(), RenderStats{},
+		[](RenderStats sum, const RenderStats& stats) { return sum += stats; });
+	m_FrameRayCount.shadowRays = m_ShadowRayCount.load(std::memory_order_relaxed);
+
+	// Blue and red are the 1st and 99th percentile, a few pixels the thread was preempted in would squash everything else into blue
+	m_HeatmapSortBuffer = m_HeatmapBuffer;
+	const auto minPercentile = m_HeatmapSortBuffer.begin() + m_HeatmapSortBuffer.size() / 100;
+	const auto maxPercentile = m_HeatmapSortBuffer.begin() + m_HeatmapSortBuffer.size() * 99 / 100;
+	std::nth_element(m_HeatmapSortBuffer.begin(), maxPercentile, m_HeatmapSortBuffer.end());
+	std::nth_element(m_HeatmapSortBuffer.begin(), minPercentile, maxPercentile);
+	m_HeatmapMinCost = *minPercentile;
+	m_HeatmapMaxCost = *maxPercentile;
+
+	// Costs span orders of magnitude, a log scale keeps the cheap pixels apart from each other
+	const float logMinCost = log1pf(m_HeatmapMinCost);
+	const float logCostRange = log1pf(m_HeatmapMaxCost) - logMinCost;
+	const float invLogCostRange = logCostRange > 0.f ? 1.f / logCostRange : 0.f;
+
+	m_pThreadPool->Dispatch(static_cast<uint32_t>(m_Height), [&](uint32_t py)
+	{
+		for (uint32_t px{}; px < static_cast<uint32_t>(m_Width); ++px)
+		{
+			const uint32_t pixelIndex = px + py * m_Width;
+			const ColorRGB color = GetHeatmapColor((log1pf(m_HeatmapBuffer[pixelIndex]) - logMinCost) * invLogCostRange);
+
+			m_pBufferPixels[pixelIndex] = SDL_MapRGB(m_pBuffer->format,
+				static_cast<uint8_t>(color.r * 255),
+				static_cast<uint8_t>(color.g * 255),
+				static_cast<uint8_t>(color.b * 255));
+		}
+	});
+}
+
+ColorRGB Renderer::GetHeatmapColor(float value)
+{
+	static const ColorRGB ramp[]{
+		{ 0.f, 0.f, 1.f },
+		{ 0.f, 1.f, 1.f },
+		{ 0.f, 1.f, 0.f },
+		{ 1.f, 1.f, 0.f },
+		{ 1.f, 0.f, 0.f }
+	};
+	constexpr uint32_t segmentCount{ std::size(ramp) - 1 };
+
+	const float position = Clamp(0.f, 1.f, value) * segmentCount;
+	const uint32_t segment = std::min(static_cast<uint32_t>(position), segmentCount - 1);
+
+	return ColorRGB::Lerp(ramp[segment], ramp[segment + 1], position - static_cast<float>(segment));
+}
+
+bool Renderer::HasCameraChanged(const Camera& camera) const
+{
+	const Camera& previousCamera = m_AccumulationCamera;
+
+	return camera.origin.x != previousCamera.origin.x || camera.origin.y != previousCamera.origin.y || camera.origin.z != previousCamera.origin.z
+		|| camera.totalPitch != previousCamera.totalPitch || camera.totalYaw != previousCamera.totalYaw || camera.fov != previousCamera.fov;
+}
+
+template <Renderer::LightingMode Mode, bool Shadows>
+uint32_t Renderer::ShadePixel(const FrameContext& frame, uint32_t sampleIndex, uint32_t px, uint32_t py, const Vector3& rayDirection, const HitRecord& closestHit) const
+{
+	uint32_t shadowRays{};
+
+	// Light ray constants
+	constexpr float minLightRay{ 0.001f };
+
+	// Color to write to buffer
+	ColorRGB finalColor{};
+
 	if (closestHit.didHit)
 	{
+		RENDER_STATS_ADD(primaryHits, 1);
+
 		// To shoot our inverse light ray we need to offset it a bit so we don't have self collision.
 		const Vector3 offsetHitOrigin = closestHit.origin + closestHit.normal * minLightRay;
 
-		for (const Light& light : lights)
+		for (uint32_t lightIndex{}; lightIndex < frame.lights.size(); ++lightIndex)
 		{
+			const Light& light = frame.lights[lightIndex];
+
 			// Hard shadow calculations
 			Vector3 directionToLight = LightUtils::GetDirectionToLight(light, closestHit.origin);
 			const float distanceToLight = directionToLight.Normalize();
@@ -160,40 +750,44 @@ void Renderer::PerPixel(Scene* pScene, uint32_t pixelIndex, float fov, float as,
 			// Lambert shading
 			const float lambertCosine = Vector3::Dot(closestHit.normal, directionToLight);
 
-			if (lambertCosine <= 0 && m_CurrentLightingMode == LightingMode::Combined
-				|| lambertCosine <= 0 && m_CurrentLightingMode == LightingMode::ObservedArea)
+			if constexpr (Mode == LightingMode::Combined || Mode == LightingMode::ObservedArea)
 			{
-				continue;
+				if (lambertCosine <= 0)
+					continue;
 			}
 
 			// If a shadow needs to be rendered it skips it
-			if (m_CanRenderShadow)
+			if constexpr (Shadows)
 			{
 				Ray invLightRay = Ray{ offsetHitOrigin, LightUtils::GetDirectionToLight(light, offsetHitOrigin).Normalized(), 0.001f, distanceToLight };
-				if (pScene->DoesHit(invLightRay))
+				++shadowRays;
+				RENDER_STATS_ADD(shadowRays, 1);
+				if (frame.pScene->IsOccluded(invLightRay, lightIndex))
 				{
+					RENDER_STATS_ADD(occludedShadowRays, 1);
 					continue;
 				}
 			}
 
-			// for every light
-			ColorRGB BRDFrgb = materials[closestHit.materialIndex]->Shade(closestHit, directionToLight, -rayDirection);
-			
-
-			switch (m_CurrentLightingMode)
+			// for every light, the material is only evaluated by the modes that use it
+			if constexpr (Mode == LightingMode::ObservedArea)
 			{
-			case LightingMode::ObservedArea:
 				finalColor += ColorRGB{ 1.f,1.f,1.f } * lambertCosine;
-				break;
-			case LightingMode::Radiance:
+			}
+			else if constexpr (Mode == LightingMode::Radiance)
+			{
 				finalColor += LightUtils::GetRadiance(light, closestHit.origin);
-				break;
-			case LightingMode::BRDF:
-				finalColor += BRDFrgb;
-				break;
-			case LightingMode::Combined:
+			}
+			else if constexpr (Mode == LightingMode::BRDF)
+			{
+				RENDER_STATS_ADD(shadeCalls, 1);
+				finalColor += MaterialUtils::Shade(frame.materials[closestHit.materialIndex], closestHit, directionToLight, -rayDirection);
+			}
+			else
+			{
+				RENDER_STATS_ADD(shadeCalls, 1);
+				const ColorRGB BRDFrgb = MaterialUtils::Shade(frame.materials[closestHit.materialIndex], closestHit, directionToLight, -rayDirection);
 				finalColor += LightUtils::GetRadiance(light, closestHit.origin) * BRDFrgb * lambertCosine;
-				break;
 			}
 		}
 	}
@@ -202,12 +796,10 @@ void Renderer::PerPixel(Scene* pScene, uint32_t pixelIndex, float fov, float as,
 		finalColor = ColorRGB{ 1.f, 1.f, 1.f };
 	}
 
-	// Normalizes the color to avoid overflows
+	// Normalizes the color to avoid overflows, every sample is clamped before it is averaged
 	finalColor.MaxToOne();
 
-	m_pBufferPixels[px + (py * m_Width)] = SDL_MapRGB(m_pBuffer->format,
-		static_cast<uint8_t>(finalColor.r * 255),
-		static_cast<uint8_t>(finalColor.g * 255),
-		static_cast<uint8_t>(finalColor.b * 255));
-}
+	AccumulatePixel(sampleIndex, px, py, finalColor);
 
+	return shadowRays;
+}
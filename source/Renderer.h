@@ -1,12 +1,17 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <string>
 
 #include "Vector3.h"
 #include "Camera.h"
 #include <vector>
 #include "DataTypes.h"
 #include "Material.h"
+#include "RenderStats.h"
+#include "ThreadPool.h"
 
 struct SDL_Window;
 struct SDL_Surface;
@@ -19,7 +24,9 @@ namespace dae
 	{
 	public:
 		Renderer(SDL_Window* pWindow);
-		~Renderer() = default;
+		// Headless, renders into a framebuffer owned by the renderer
+		Renderer(uint32_t width, uint32_t height);
+		~Renderer();
 
 		Renderer(const Renderer&) = delete;
 		Renderer(Renderer&&) noexcept = delete;
@@ -28,9 +35,65 @@ namespace dae
 
 		void Render(Scene* pScene) const;
 		bool SaveBufferToImage() const;
+		bool SaveBufferToImage(const std::string& filePath) const;
 		void CycleLightingMode();
-		void ToggleShadows() { m_CanRenderShadow = !m_CanRenderShadow; }
-		void PerPixel(Scene* pScene, uint32_t pixelIndex, float fov, float as, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const;
+		void ToggleShadows() { m_CanRenderShadow = !m_CanRenderShadow; ResetAccumulation(); }
+		void TogglePacketTracing();
+		void ToggleAccumulation();
+		// Starts the progressive image over, the next frame is a single sample again
+		void ResetAccumulation() { m_SampleCount = 0; }
+		void SetTileSize(uint32_t tileSize);
+		void SetThreadCount(uint32_t threadCount);
+		void PrintThreadStats() const;
+		uint32_t GetThreadCount() const { return m_pThreadPool->GetThreadCount(); }
+		uint32_t GetWidth() const { return static_cast<uint32_t>(m_Width); }
+		uint32_t GetHeight() const { return static_cast<uint32_t>(m_Height); }
+		// Frames that added samples since the last reset, it stops growing once every tile has converged
+		uint32_t GetSampleCount() const { return m_SampleCount; }
+
+		void ToggleAdaptiveSampling();
+		// Tiles stop sampling once the standard error of every pixel is below errorThreshold, or at maxSampleCount samples
+		void SetAdaptiveSampling(float errorThreshold, uint32_t maxSampleCount);
+
+		struct SamplingStats
+		{
+			// Pixel samples traced since the last reset
+			uint64_t tracedSamples{};
+			// What uniform sampling would have traced to give every pixel as many samples as the busiest tile
+			uint64_t uniformSamples{};
+			uint32_t convergedTileCount{};
+			uint32_t tileCount{};
+		};
+
+		const SamplingStats& GetSamplingStats() const { return m_SamplingStats; }
+
+		struct RayCount
+		{
+			uint64_t primaryRays{};
+			uint64_t shadowRays{};
+		};
+
+		//Rays traced during the last Render call
+		const RayCount& GetFrameRayCount() const { return m_FrameRayCount; }
+
+		//Counters of the last Render call, all zero when the counters are compiled out (NO_RENDER_STATS)
+		const RenderStats& GetFrameStats() const { return m_FrameStats; }
+		void PrintFrameStats() const;
+
+		//What the heatmap colors a pixel by, its primary ray and shadow rays together
+		enum class HeatmapMode
+		{
+			Off,
+			NodeVisits,
+			TriangleTests,
+			Time
+		};
+
+		//Replaces shading with a false color ramp of the cost of every pixel, log scaled from the cheapest to the most expensive percent of the frame.
+		//Node visits and triangle tests need the counters, with NO_RENDER_STATS only Time is available
+		void CycleHeatmapMode();
+		void SetHeatmapMode(HeatmapMode mode);
+		HeatmapMode GetHeatmapMode() const { return m_HeatmapMode; }
 
 	private:
 		enum class LightingMode
@@ -43,12 +106,113 @@ namespace dae
 
 		LightingMode m_CurrentLightingMode{ LightingMode::Combined };
 
+		//Everything the pixels of one frame share, built once in Render and passed by reference to every thread
+		struct FrameContext
+		{
+			const Scene* pScene{};
+			Camera camera{};
+			const std::vector<Light>& lights;
+			const std::vector<MaterialData>& materials;
+
+			float width{};
+			float height{};
+			float aspectRatio{};
+		};
+
+		//Pixel loops are instantiated per lighting mode and shadow toggle, Render picks the pair once per frame
+		using PerPixelFunction = uint32_t(Renderer::*)(const FrameContext&, uint32_t, uint32_t) const;
+		using TilePacketsFunction = uint32_t(Renderer::*)(const FrameContext&, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t) const;
+
+		struct RenderKernels
+		{
+			PerPixelFunction pPerPixel{};
+			TilePacketsFunction pRenderTilePackets{};
+		};
+
+		RenderKernels SelectRenderKernels() const;
+		template <LightingMode Mode>
+		static RenderKernels GetRenderKernels(bool canRenderShadow);
+
+		//Returns the number of shadow rays that were traced
+		template <LightingMode Mode, bool Shadows>
+		uint32_t PerPixel(const FrameContext& frame, uint32_t sampleIndex, uint32_t pixelIndex) const;
+		//Traces the primary rays of a tile in 2x2 packets, returns the number of shadow rays that were traced
+		template <LightingMode Mode, bool Shadows>
+		uint32_t RenderTilePackets(const FrameContext& frame, uint32_t sampleIndex, uint32_t startX, uint32_t startY, uint32_t endX, uint32_t endY) const;
+		template <LightingMode Mode, bool Shadows>
+		uint32_t ShadePixel(const FrameContext& frame, uint32_t sampleIndex, uint32_t px, uint32_t py, const Vector3& rayDirection, const HitRecord& closestHit) const;
+
+		//Unnormalized world direction of the camera ray through (rx, ry) in pixel coordinates
+		static Vector3 GetPrimaryRayDirection(const FrameContext& frame, float rx, float ry);
+		//Same, through the jittered stratified position of sample sampleIndex in pixel (px, py)
+		Vector3 GetSampleDirection(const FrameContext& frame, uint32_t sampleIndex, uint32_t px, uint32_t py) const;
+		//Adds the sample to the accumulation buffer and writes the average to the framebuffer, sample 0 starts over
+		void AccumulatePixel(uint32_t sampleIndex, uint32_t px, uint32_t py, const ColorRGB& color) const;
+		bool HasCameraChanged(const Camera& camera) const;
+
+		//One centered sample per pixel, without packets so every ray is charged to its own pixel
+		void RenderHeatmap(const FrameContext& frame, PerPixelFunction pPerPixel) const;
+		//Blue through cyan, green and yellow to red for value in [0, 1]
+		static ColorRGB GetHeatmapColor(float value);
+
+		//Largest standard error of the mean luminance of a pixel in the tile
+		float GetTileError(uint32_t startX, uint32_t startY, uint32_t endX, uint32_t endY, uint32_t sampleCount) const;
+		void UpdateSamplingStats() const;
+
 		SDL_Window* m_pWindow{};
 
 		SDL_Surface* m_pBuffer{};
 		uint32_t* m_pBufferPixels{};
+		bool m_OwnsBuffer{ false };
 
 		bool m_CanRenderShadow{ true };
+		bool m_UsePacketTracing{ true };
+		bool m_UseAccumulation{ true };
+
+		//Sum of every sample since the last reset, averaged into the framebuffer
+		mutable std::vector<ColorRGB> m_AccumulationBuffer{};
+		//Sum of the squared sample luminances, for the variance estimate of adaptive sampling
+		mutable std::vector<float> m_LuminanceSquaredBuffer{};
+		mutable uint32_t m_SampleCount{};
+		mutable Camera m_AccumulationCamera{};
+
+		//Progress of every tile of the TILED path since the last reset
+		struct TileState
+		{
+			uint32_t sampleCount{};
+			bool isConverged{};
+		};
+
+		//Tiles need this many samples before their variance estimate is trusted, the first one is always the pixel center
+		static constexpr uint32_t MinAdaptiveSampleCount{ 5 };
+		//Most samples a tile takes in one frame when the converged tiles hand their rays to the others
+		static constexpr uint32_t MaxTileSamplesPerFrame{ 8 };
+
+		bool m_UseAdaptiveSampling{ true };
+		float m_ErrorThreshold{ 0.005f };
+		uint32_t m_MaxSampleCount{ 256 };
+
+		mutable std::vector<TileState> m_TileStates{};
+		mutable SamplingStats m_SamplingStats{};
+		mutable bool m_HasReportedConvergence{};
+
+		std::unique_ptr<ThreadPool> m_pThreadPool{};
+		uint32_t m_TileSize{ 16 };
+
+		mutable std::atomic<uint64_t> m_PrimaryRayCount{};
+		mutable std::atomic<uint64_t> m_ShadowRayCount{};
+		mutable RayCount m_FrameRayCount{};
+
+		//One slot per task, each written by the thread that ran it and summed once the frame is done
+		mutable std::vector<RenderStats> m_TaskStats{};
+		mutable RenderStats m_FrameStats{};
+
+		HeatmapMode m_HeatmapMode{ HeatmapMode::Off };
+		//Cost of every pixel of the last heatmap frame in the unit of the mode, nanoseconds for Time
+		mutable std::vector<float> m_HeatmapBuffer{};
+		mutable std::vector<float> m_HeatmapSortBuffer{};
+		mutable float m_HeatmapMinCost{};
+		mutable float m_HeatmapMaxCost{};
 
 		int m_Width{};
 		int m_Height{};
@@ -1,6 +1,17 @@
 #include "Scene.h"
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
 #include "Utils.h"
 #include "Material.h"
+#include "MeshLoader.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
 
 namespace dae {
 
@@ -13,6 +24,8 @@ namespace dae {
 		m_PlaneGeometries.reserve(32);
 		m_TriangleMeshGeometries.reserve(32);
 		m_Lights.reserve(32);
+
+		m_MaterialTable.push_back(m_Materials[0]->GetData());
 	}
 
 	Scene::~Scene()
@@ -31,80 +44,355 @@ namespace dae {
 		const std::vector<Sphere>& spheres = GetSphereGeometries();
 		const std::vector<Plane>& planes = GetPlaneGeometries();
 
-		// We will pass record into the test functions.
-		HitRecord record{};
+		// Only t and what was hit are tracked, the normal and hit point are computed for the winner alone
+		HitCandidate closest{ closestHit.t };
+		ObjectReference closestObject{};
+		bool hasClosest{};
 
-		for (auto& sphere: spheres)
+		for (uint32_t planeIndex{}; planeIndex < planes.size(); ++planeIndex)
 		{
-			const bool hasHit = GeometryUtils::HitTest_Sphere(sphere, ray, record);
+			HitCandidate candidate{};
+			const bool hasHit = GeometryUtils::HitTest_Plane(planes[planeIndex], ray, candidate);
 
 			// Only update the closest if a new result is closer than the previous one.
 			// This will ensure only the closest one is kept.
-			if (hasHit && record.t < closestHit.t)
+			if (hasHit && candidate.t < closest.t)
 			{
-				closestHit = record;
+				closest = candidate;
+				closestObject = ObjectReference{ ObjectType::Plane, planeIndex };
+				hasClosest = true;
 			}
 		}
 
-		for (auto& plane: planes)
+		// Objects behind the closest plane hit can be skipped entirely
+		Ray closestRay{ ray };
+		closestRay.max = std::min(ray.max, closest.t);
+
+		GeometryUtils::TraverseBVH(m_TopLevelBVH, closestRay, [&](uint32_t objectIndex)
 		{
-			const bool hasHit = GeometryUtils::HitTest_Plane(plane, ray, record);
+			const ObjectReference& object = m_TopLevelObjects[objectIndex];
+
+			HitCandidate candidate{};
+			bool hasHit{};
+			if (object.type == ObjectType::Sphere)
+				hasHit = GeometryUtils::HitTest_Sphere(spheres[object.index], closestRay, candidate);
+			else
+				hasHit = GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[object.index], closestRay, candidate);
 
-			if (hasHit && record.t < closestHit.t)
+			if (hasHit && candidate.t < closest.t)
 			{
-				closestHit = record;
+				closest = candidate;
+				closestObject = object;
+				hasClosest = true;
+				closestRay.max = candidate.t;
 			}
-		}
 
-		for (auto& triangle : m_TriangleMeshGeometries)
-		{
-			const bool hasHit = GeometryUtils::HitTest_TriangleMesh(triangle, ray, record);
+			return false;
+		});
 
-			if (hasHit && record.t < closestHit.t)
-			{
-				closestHit = record;
-			}
+		if (hasClosest)
+			FillHitRecord(closestObject, ray, closest, closestHit);
+	}
+
+	void Scene::FillHitRecord(const ObjectReference& object, const Ray& ray, const HitCandidate& candidate, HitRecord& hitRecord) const
+	{
+		switch (object.type)
+		{
+		case ObjectType::Sphere:
+			GeometryUtils::FillHitRecord_Sphere(m_SphereGeometries[object.index], ray, candidate, hitRecord);
+			break;
+		case ObjectType::TriangleMesh:
+			GeometryUtils::FillHitRecord_TriangleMesh(m_TriangleMeshGeometries[object.index], ray, candidate, hitRecord);
+			break;
+		case ObjectType::Plane:
+			GeometryUtils::FillHitRecord_Plane(m_PlaneGeometries[object.index], ray, candidate, hitRecord);
+			break;
 		}
 	}
 
 	bool Scene::DoesHit(const Ray& ray) const
 	{
-		const std::vector<Sphere>& spheres = GetSphereGeometries();
-		const std::vector<Plane>& planes = GetPlaneGeometries();
+		Occluder occluder{};
+		return FindOccluder(ray, Occluder{}, occluder);
+	}
+
+	bool Scene::IsOccluded(const Ray& ray, uint32_t lightIndex) const
+	{
+		// Neighbouring pixels are mostly shadowed by the same object, one test often settles it.
+		// Forgotten once a ray gets through, neighbours of a lit pixel are mostly lit and would only pay for the extra test
+		Occluder& lastOccluder = GetLastOccluders()[lightIndex];
+		if (IsOccludedBy(lastOccluder, ray))
+			return true;
+
+		if (FindOccluder(ray, lastOccluder, lastOccluder))
+			return true;
+
+		lastOccluder = Occluder{};
+		return false;
+	}
+
+	bool Scene::IsOccludedBy(const Occluder& occluder, const Ray& ray) const
+	{
+		if (occluder.isPlane)
+			return occluder.index < m_PlaneGeometries.size() && GeometryUtils::Occludes_Plane(m_PlaneGeometries[occluder.index], ray);
+
+		if (occluder.index >= m_TopLevelObjects.size())
+			return false;
+
+		const ObjectReference& object = m_TopLevelObjects[occluder.index];
+		if (object.type == ObjectType::Sphere)
+			return GeometryUtils::Occludes_Sphere(m_SphereGeometries[object.index], ray);
 
-		for (auto& sphere : spheres)
+		return GeometryUtils::Occludes_TriangleMesh(m_TriangleMeshGeometries[object.index], ray);
+	}
+
+	bool Scene::FindOccluder(const Ray& ray, const Occluder& skip, Occluder& occluder) const
+	{
+		// Bounded objects first, nearest to the hit point first. Planes usually enclose the scene with the lights
+		// on the same side as everything they light, so they are the least likely to block anything
+		Ray shadowRay{ ray };
+		const bool isObjectHit = GeometryUtils::TraverseBVH(m_TopLevelBVH, shadowRay, [&](uint32_t objectIndex)
 		{
-			const bool hasHit = GeometryUtils::HitTest_Sphere(sphere, ray);
+			if (!skip.isPlane && objectIndex == skip.index)
+				return false;
 
-			// Only update the closest if a new result is closer than the previous one.
-			// This will ensure only the closest one is kept.
-			if (hasHit)
+			const ObjectReference& object = m_TopLevelObjects[objectIndex];
+			const bool isOccluded = object.type == ObjectType::Sphere
+				? GeometryUtils::Occludes_Sphere(m_SphereGeometries[object.index], shadowRay)
+				: GeometryUtils::Occludes_TriangleMesh(m_TriangleMeshGeometries[object.index], shadowRay);
+
+			if (!isOccluded)
+				return false;
+
+			occluder = Occluder{ false, objectIndex };
+			return true;
+		});
+
+		if (isObjectHit)
+			return true;
+
+		for (uint32_t planeIndex{}; planeIndex < m_PlaneGeometries.size(); ++planeIndex)
+		{
+			if (skip.isPlane && planeIndex == skip.index)
+				continue;
+
+			if (GeometryUtils::Occludes_Plane(m_PlaneGeometries[planeIndex], ray))
 			{
+				occluder = Occluder{ true, planeIndex };
 				return true;
 			}
 		}
 
-		for (auto& plane : planes)
+		return false;
+	}
+
+	std::vector<Scene::Occluder>& Scene::GetLastOccluders() const
+	{
+		thread_local const Scene* pCachedScene{};
+		thread_local std::vector<Occluder> lastOccluders{};
+
+		// Indices of another scene mean nothing here, they are bounds checked but would just be wasted tests
+		if (pCachedScene != this || lastOccluders.size() != m_Lights.size())
+		{
+			pCachedScene = this;
+			lastOccluders.assign(m_Lights.size(), Occluder{});
+		}
+
+		return lastOccluders;
+	}
+
+	void Scene::GatherVisibleObjects(const Frustum& frustum, std::vector<uint32_t>& objectIndices) const
+	{
+		objectIndices.clear();
+
+		const std::vector<BVHNode>& nodes = m_TopLevelBVH.GetNodes();
+		const std::vector<uint32_t>& primitiveIndices = m_TopLevelBVH.GetPrimitiveIndices();
+
+		if (nodes.empty())
+			return;
+
+		uint32_t nodeStack[BVH::MaxDepth + 1];
+		uint32_t stackSize{};
+		nodeStack[stackSize++] = 0;
+
+		while (stackSize > 0)
 		{
-			const bool hasHit = GeometryUtils::HitTest_Plane(plane, ray);
+			const BVHNode& node = nodes[nodeStack[--stackSize]];
+
+			if (!frustum.Overlaps(node.minAABB, node.maxAABB))
+				continue;
 
-			if (hasHit)
+			if (!node.IsLeaf())
 			{
-				return true;
+				nodeStack[stackSize++] = node.leftFirst + 1;
+				nodeStack[stackSize++] = node.leftFirst;
+				continue;
 			}
+
+			for (uint32_t i{}; i < node.primitiveCount; ++i)
+			{
+				const uint32_t objectIndex = primitiveIndices[node.leftFirst + i];
+
+				if (frustum.Overlaps(m_ObjectMinBounds[objectIndex], m_ObjectMaxBounds[objectIndex]))
+					objectIndices.push_back(objectIndex);
+			}
+		}
+	}
+
+	void Scene::GetClosestHit(const RayPacket& packet, const std::vector<uint32_t>& objectIndices, HitRecord (&hitRecords)[RayPacket::Size]) const
+	{
+		HitCandidate candidates[RayPacket::Size]{};
+		ObjectReference hitObjects[RayPacket::Size]{};
+		uint32_t hitMask{};
+
+		for (uint32_t lane{}; lane < RayPacket::Size; ++lane)
+			candidates[lane].t = hitRecords[lane].t;
+
+		// Lanes in mask took a closer hit on object
+		const auto keepHits = [&](uint32_t mask, const ObjectReference& object)
+		{
+			hitMask |= mask;
+
+			for (; mask != 0; mask &= mask - 1)
+				hitObjects[std::countr_zero(mask)] = object;
+		};
+
+		for (uint32_t planeIndex{}; planeIndex < m_PlaneGeometries.size(); ++planeIndex)
+		{
+			keepHits(GeometryUtils::HitTest_Plane(m_PlaneGeometries[planeIndex], packet, candidates), ObjectReference{ ObjectType::Plane, planeIndex });
 		}
 
-		for (auto& triangle : m_TriangleMeshGeometries)
+		for (const uint32_t objectIndex : objectIndices)
 		{
-			const bool hasHit = GeometryUtils::HitTest_TriangleMesh(triangle, ray);
+			const ObjectReference& object = m_TopLevelObjects[objectIndex];
 
-			if (hasHit)
+			if (object.type == ObjectType::Sphere)
+				keepHits(GeometryUtils::HitTest_Sphere(m_SphereGeometries[object.index], packet, candidates), object);
+			else
+				keepHits(GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[object.index], packet, candidates), object);
+		}
+
+		for (; hitMask != 0; hitMask &= hitMask - 1)
+		{
+			const uint32_t lane = static_cast<uint32_t>(std::countr_zero(hitMask));
+			FillHitRecord(hitObjects[lane], Ray{ packet.origin, packet.GetDirection(lane) }, candidates[lane], hitRecords[lane]);
+		}
+	}
+
+	void Scene::UpdateTopLevelBVH()
+	{
+		PROFILE_ZONE("Scene::UpdateTopLevelBVH");
+
+		// Rebuild once the refitted tree costs this much more than a fresh one
+		constexpr float maxCostGrowth{ 1.5f };
+
+		const size_t objectCount = m_SphereGeometries.size() + m_TriangleMeshGeometries.size();
+		const bool objectsChanged = objectCount != m_TopLevelObjects.size();
+
+		if (objectsChanged)
+		{
+			m_TopLevelObjects.clear();
+			m_TopLevelObjects.reserve(objectCount);
+
+			for (uint32_t i{}; i < m_SphereGeometries.size(); ++i)
+				m_TopLevelObjects.push_back({ ObjectType::Sphere, i });
+
+			for (uint32_t i{}; i < m_TriangleMeshGeometries.size(); ++i)
+				m_TopLevelObjects.push_back({ ObjectType::TriangleMesh, i });
+
+			m_ObjectMinBounds.resize(objectCount);
+			m_ObjectMaxBounds.resize(objectCount);
+		}
+
+		for (size_t i{}; i < m_TopLevelObjects.size(); ++i)
+		{
+			const ObjectReference& object = m_TopLevelObjects[i];
+
+			if (object.type == ObjectType::Sphere)
 			{
-				return true;
+				const Sphere& sphere = m_SphereGeometries[object.index];
+				const Vector3 extent{ sphere.radius, sphere.radius, sphere.radius };
+				m_ObjectMinBounds[i] = sphere.origin - extent;
+				m_ObjectMaxBounds[i] = sphere.origin + extent;
+			}
+			else
+			{
+				const TriangleMesh& mesh = m_TriangleMeshGeometries[object.index];
+				m_ObjectMinBounds[i] = mesh.transformedMinAABB;
+				m_ObjectMaxBounds[i] = mesh.transformedMaxAABB;
 			}
 		}
 
-		return false;
+		if (!objectsChanged && m_TopLevelBVH.IsBuilt())
+		{
+			m_TopLevelBVH.Refit(m_ObjectMinBounds, m_ObjectMaxBounds);
+
+			if (m_TopLevelBVH.GetSAHCost() <= m_TopLevelBuildCost * maxCostGrowth)
+				return;
+		}
+
+		m_TopLevelBVH.Build(m_ObjectMinBounds, m_ObjectMaxBounds);
+		m_TopLevelBuildCost = m_TopLevelBVH.GetSAHCost();
+	}
+
+	void Scene::SetMeshTraversal(MeshTraversal traversal)
+	{
+		m_MeshTraversal = traversal;
+
+		for (auto& mesh : m_TriangleMeshGeometries)
+		{
+			mesh.traversal = traversal;
+			mesh.UpdateTransforms();
+		}
+	}
+
+	void Scene::CycleMeshTraversal()
+	{
+		const int traversalId = static_cast<int>(m_MeshTraversal);
+		SetMeshTraversal(static_cast<MeshTraversal>((traversalId + 1) % 5));
+
+		std::cout << "MESH TRAVERSAL: " << GetMeshTraversalName(m_MeshTraversal) << ", " << GetMeshBytesPerTriangle() << " bytes/triangle\n";
+	}
+
+	float Scene::GetMeshBytesPerTriangle() const
+	{
+		size_t totalBytes{};
+		size_t triangleCount{};
+		for (const auto& mesh : m_TriangleMeshGeometries)
+		{
+			totalBytes += mesh.GetTraversalMemoryUsage();
+			triangleCount += mesh.indices.size() / 3;
+		}
+
+		return triangleCount > 0 ? static_cast<float>(totalBytes) / static_cast<float>(triangleCount) : 0.f;
+	}
+
+	void Scene::SetTriangleKernel(TriangleKernel kernel)
+	{
+		if (!IsTriangleKernelSupported(kernel))
+			return;
+
+		m_TriangleKernel = kernel;
+
+		for (auto& mesh : m_TriangleMeshGeometries)
+		{
+			mesh.triangleKernel = kernel;
+			mesh.UpdateTransforms();
+		}
+	}
+
+	void Scene::CycleTriangleKernel()
+	{
+		// Skip the kernels this cpu can not run
+		int kernelId = static_cast<int>(m_TriangleKernel);
+		do
+		{
+			kernelId = (kernelId + 1) % 3;
+		} while (!IsTriangleKernelSupported(static_cast<TriangleKernel>(kernelId)));
+
+		SetTriangleKernel(static_cast<TriangleKernel>(kernelId));
+
+		std::cout << "TRIANGLE KERNEL: " << GetTriangleKernelName(m_TriangleKernel) << "\n";
 	}
 
 #pragma region Scene Helpers
@@ -135,8 +423,10 @@ namespace dae {
 		TriangleMesh m{};
 		m.cullMode = cullMode;
 		m.materialIndex = materialIndex;
+		m.traversal = m_MeshTraversal;
+		m.triangleKernel = m_TriangleKernel;
 
-		m_TriangleMeshGeometries.emplace_back(m);
+		m_TriangleMeshGeometries.emplace_back(std::move(m));
 		return &m_TriangleMeshGeometries.back();
 	}
 
@@ -167,232 +457,574 @@ namespace dae {
 	unsigned char Scene::AddMaterial(Material* pMaterial)
 	{
 		m_Materials.push_back(pMaterial);
+		m_MaterialTable.push_back(pMaterial->GetData());
 		return static_cast<unsigned char>(m_Materials.size() - 1);
 	}
 #pragma endregion
 #pragma endregion
 
-#pragma region SCENE W1
-	void Scene_W1::Initialize()
+#pragma region SCENE FILE
+	namespace
+	{
+		bool ReadVector3(std::istringstream& stream, Vector3& value)
+		{
+			return static_cast<bool>(stream >> value.x >> value.y >> value.z);
+		}
+
+		bool ReadColor(std::istringstream& stream, ColorRGB& value)
+		{
+			return static_cast<bool>(stream >> value.r >> value.g >> value.b);
+		}
+
+		bool FindName(const std::vector<std::string>& names, const std::string& name, uint32_t& index)
+		{
+			const auto it = std::find(names.begin(), names.end(), name);
+			if (it == names.end())
+				return false;
+
+			index = static_cast<uint32_t>(it - names.begin());
+			return true;
+		}
+
+		bool ReadMaterial(std::istringstream& stream, const std::vector<std::string>& materialNames, unsigned char& materialIndex, std::string& error)
+		{
+			std::string name{};
+			uint32_t index{};
+			if (!(stream >> name) || !FindName(materialNames, name, index))
+			{
+				error = "unknown material '" + name + "'";
+				return false;
+			}
+
+			materialIndex = static_cast<unsigned char>(index);
+			return true;
+		}
+	}
+
+	Scene_File::Scene_File(const std::string& filename) :
+		m_Filename(filename)
 	{
-				//default: Material id0 >> SolidColor Material (RED)
-		constexpr unsigned char matId_Solid_Red = 0;
-		const unsigned char matId_Solid_Blue = AddMaterial(new Material_SolidColor{ colors::Blue });
+		sceneName = filename;
+	}
 
-		const unsigned char matId_Solid_Yellow = AddMaterial(new Material_SolidColor{ colors::Yellow });
-		const unsigned char matId_Solid_Green = AddMaterial(new Material_SolidColor{ colors::Green });
-		const unsigned char matId_Solid_Magenta = AddMaterial(new Material_SolidColor{ colors::Magenta });
+	bool Scene_File::Load()
+	{
+		std::ifstream file(m_Filename);
+		if (!file)
+		{
+			std::cout << "Could not open scene file " << m_Filename << "\n";
+			return false;
+		}
+
+		// Material 0 is the red every scene starts with
+		std::vector<std::string> materialNames{ "default" };
+		std::vector<std::string> meshNames{};
 
-		//Spheres
-		AddSphere({ 25.f, 0.f, 100.f }, 50.f, matId_Solid_Blue);
-		AddSphere({ -25.f, 0.f, 100.f }, 50.f, matId_Solid_Red);
+		std::string line{};
+		std::string error{};
+		for (uint32_t lineNumber{ 1 }; std::getline(file, line); ++lineNumber)
+		{
+			if (!ParseLine(line, materialNames, meshNames, error))
+			{
+				std::cout << m_Filename << ":" << lineNumber << ": " << error << "\n";
+				return false;
+			}
+		}
 
-		//Plane
-		AddPlane({ -75.f, 0.f, 0.f }, { 1.f, 0.f,0.f }, matId_Solid_Green);
-		AddPlane({ 75.f, 0.f, 0.f }, { -1.f, 0.f,0.f }, matId_Solid_Green);
-		AddPlane({ 0.f, -75.f, 0.f }, { 0.f, 1.f,0.f }, matId_Solid_Yellow);
-		AddPlane({ 0.f, 75.f, 0.f }, { 0.f, -1.f,0.f }, matId_Solid_Yellow);
-		AddPlane({ 0.f, 0.f, 125.f }, { 0.f, 0.f,-1.f }, matId_Solid_Magenta);
+		return LoadMeshes();
 	}
-#pragma endregion
 
-#pragma region SCENE W2
-	void Scene_W2::Initialize()
+	bool Scene_File::ParseLine(const std::string& line, std::vector<std::string>& materialNames, std::vector<std::string>& meshNames, std::string& error)
 	{
-		m_Camera.origin = { 0.f, 3.f, -9.f };
-		m_Camera.fovAngle = 45.0f;
+		std::istringstream stream{ line };
 
-		constexpr unsigned char matId_Solid_Red = 0;
-		const unsigned char matId_Solid_Blue = AddMaterial(new Material_SolidColor{ colors::Blue });
+		std::string command{};
+		if (!(stream >> command) || command[0] == '#')
+			return true;
 
-		const unsigned char matId_Solid_Yellow = AddMaterial(new Material_SolidColor{ colors::Yellow });
-		const unsigned char matId_Solid_Green = AddMaterial(new Material_SolidColor{ colors::Green });
-		const unsigned char matId_Solid_Magenta = AddMaterial(new Material_SolidColor{ colors::Magenta });
+		if (command == "camera")
+		{
+			// camera x y z [fov degrees] [pitch degrees] [yaw degrees]
+			if (!ReadVector3(stream, m_FileCamera.origin))
+			{
+				error = "camera needs an origin";
+				return false;
+			}
 
-		//Plane
-		AddPlane({ -5.f, 0.f, 0.f }, { 1.f, 0.f,0.f }, matId_Solid_Green);
-		AddPlane({ 5.f, 0.f, 0.f }, { -1.f, 0.f,0.f }, matId_Solid_Green);
-		AddPlane({ 0.f, 0.f, 0.f }, { 0.f, 1.f,0.f }, matId_Solid_Yellow);
-		AddPlane({ 0.f, 10.f, 0.f }, { 0.f, -1.f,0.f }, matId_Solid_Yellow);
-		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f,-1.f }, matId_Solid_Magenta);
+			std::string option{};
+			while (stream >> option)
+			{
+				if (option[0] == '#')
+					break;
+
+				float value{};
+				if (!(stream >> value))
+				{
+					error = "camera " + option + " needs a value";
+					return false;
+				}
+
+				if (option == "fov")
+				{
+					m_FileCamera.fovAngle = value;
+					m_FileCamera.fov = tanf(value * TO_RADIANS / 2.f);
+				}
+				else if (option == "pitch")
+				{
+					m_FileCamera.totalPitch = value;
+				}
+				else if (option == "yaw")
+				{
+					m_FileCamera.totalYaw = value;
+				}
+				else
+				{
+					error = "unknown camera option '" + option + "'";
+					return false;
+				}
+			}
 
-		//Spheres
-		AddSphere({ -1.75f, 1.f, 0.f }, .75f, matId_Solid_Red);
-		AddSphere({ 0.f, 1.f, 0.f }, .75f, matId_Solid_Blue);
-		AddSphere({ 1.75f, 1.f, 0.f }, .75f, matId_Solid_Red);
-		AddSphere({ -1.75f, 3.f, 0.f }, .75f, matId_Solid_Blue);
-		AddSphere({ 0.f, 3.f, 0.f }, .75f, matId_Solid_Red);
-		AddSphere({ 1.75f, 3.f, 0.f }, .75f, matId_Solid_Blue);
+			m_HasCamera = true;
+		}
+		else if (command == "material")
+		{
+			// material name solid|lambert|phong|cooktorrance r g b [parameters]
+			std::string name{}, type{};
+			ColorRGB color{};
+			if (!(stream >> name >> type) || !ReadColor(stream, color))
+			{
+				error = "material needs a name, a type and a color";
+				return false;
+			}
 
-		AddPointLight({ 0.f, 5.f, -5.f }, 70.f, colors::White);
-	}
+			uint32_t existingIndex{};
+			if (FindName(materialNames, name, existingIndex))
+			{
+				error = "material '" + name + "' is defined twice";
+				return false;
+			}
 
-#pragma endregion
-#pragma region SCENE W3
-	void Scene_W3::Initialize()
-	{
-		m_Camera.origin = { 0.f, 3.f, -9.f };
-		m_Camera.fovAngle = 45.0f;
-
-		const unsigned char matCT_GrayRoughMetal = AddMaterial(new Material_CookTorrence({.972f, .960f, .915f}, 1.f, 1.f));
-		const unsigned char matCT_GrayMediumMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, .6f));
-		const unsigned char matCT_GraySmoothMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, .1f));
-		const unsigned char matCT_GrayRoughPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, 1.f));
-		const unsigned char matCT_GrayMediumPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, .6f));
-		const unsigned char matCT_GraySmoothPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, .1f));
-
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ .49f, .57f, .57f }, 1.f));
-		const auto matLamber_GrayRedPhong = AddMaterial(new Material_LambertPhong{ colors::Red, 0.5f, 0.5f, 50.f });
-		const auto matLamber_GrayBluePhong = AddMaterial(new Material_LambertPhong{ colors::Blue, 0.5f, 0.5f, 50.f });
-		const auto matLamber_GrayYellowPhong = AddMaterial(new Material_LambertPhong{ colors::Yellow, 0.5f, 0.5f, 50.f });
-
-		//Plane
-		AddPlane({ -5.f, 0.f, 0.f }, { 1.f, 0.f,0.f }, matLambert_GrayBlue);
-		AddPlane({ 5.f, 0.f, 0.f }, { -1.f, 0.f,0.f }, matLambert_GrayBlue);
-		AddPlane({ 0.f, 0.f, 0.f }, { 0.f, 1.f,0.f }, matLambert_GrayBlue);
-		AddPlane({ 0.f, 10.f, 0.f }, { 0.f, -1.f,0.f }, matLambert_GrayBlue);
-		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f,-1.f }, matLambert_GrayBlue);
-
-		//Spheres
-		AddSphere({ -1.75f, 1.f, 0.f }, .75f, matCT_GrayRoughMetal);
-		AddSphere({ 0.f, 1.f, 0.f }, .75f, matCT_GrayMediumMetal);
-		AddSphere({ 1.75f, 1.f, 0.f }, .75f, matCT_GraySmoothMetal);
-
-		AddSphere({ -1.75f, 3.f, 0.f }, .75f, matCT_GrayRoughPlastic);
-		AddSphere({ 0.f, 3.f, 0.f }, .75f, matCT_GrayMediumPlastic);
-		AddSphere({ 1.75f, 3.f, 0.f }, .75f, matCT_GraySmoothPlastic);
-
-		AddSphere({ -1.75f, 5.f, 0.f }, .75f, matLamber_GrayYellowPhong);
-		AddSphere({ 0.f, 5.f, 0.f }, .75f, matLamber_GrayRedPhong);
-		AddSphere({ 1.75f, 5.f, 0.f }, .75f, matLamber_GrayBluePhong);
-
-		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, ColorRGB{1.f, .61f, .45f});
-		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, ColorRGB{1.f, .8f, .45f});
-		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, ColorRGB{.34f, .47f, .68f});
-	}
-#pragma endregion
+			// Material indices are stored in an unsigned char
+			if (materialNames.size() > UCHAR_MAX)
+			{
+				error = "a scene can't have more than 256 materials";
+				return false;
+			}
 
+			std::unique_ptr<Material> pMaterial{};
+			if (type == "solid")
+			{
+				pMaterial = std::make_unique<Material_SolidColor>(color);
+			}
+			else if (type == "lambert")
+			{
+				float diffuseReflectance{};
+				if (stream >> diffuseReflectance)
+					pMaterial = std::make_unique<Material_Lambert>(color, diffuseReflectance);
+			}
+			else if (type == "phong")
+			{
+				float diffuseReflectance{}, specularReflectance{}, phongExponent{};
+				if (stream >> diffuseReflectance >> specularReflectance >> phongExponent)
+					pMaterial = std::make_unique<Material_LambertPhong>(color, diffuseReflectance, specularReflectance, phongExponent);
+			}
+			else if (type == "cooktorrance")
+			{
+				float metalness{}, roughness{};
+				if (stream >> metalness >> roughness)
+					pMaterial = std::make_unique<Material_CookTorrence>(color, metalness, roughness);
+			}
+			else
+			{
+				error = "unknown material type '" + type + "'";
+				return false;
+			}
 
-	void Scene_W4_ReferenceScene::Initialize()
-	{
-		m_Camera.origin = { 0.f, 3.f, -9.f };
-		m_Camera.fovAngle = 45.0f;
+			if (!pMaterial)
+			{
+				error = type + " material '" + name + "' is missing parameters";
+				return false;
+			}
 
-		const unsigned char matCT_GrayRoughMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, 1.f));
-		const unsigned char matCT_GrayMediumMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, .6f));
-		const unsigned char matCT_GraySmoothMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, .1f));
-		const unsigned char matCT_GrayRoughPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, 1.f));
-		const unsigned char matCT_GrayMediumPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, .6f));
-		const unsigned char matCT_GraySmoothPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, .1f));
+			materialNames.push_back(name);
+			m_FileMaterials.push_back(std::move(pMaterial));
+		}
+		else if (command == "sphere")
+		{
+			// sphere x y z radius material
+			Sphere sphere{};
+			if (!ReadVector3(stream, sphere.origin) || !(stream >> sphere.radius))
+			{
+				error = "sphere needs an origin and a radius";
+				return false;
+			}
 
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ .49f, .57f, .57f }, 1.f));
-		const auto matLamber_GrayRedPhong = AddMaterial(new Material_LambertPhong{ colors::Red, 0.5f, 0.5f, 50.f });
-		const auto matLamber_GrayBluePhong = AddMaterial(new Material_LambertPhong{ colors::Blue, 0.5f, 0.5f, 50.f });
-		const auto matLamber_GrayYellowPhong = AddMaterial(new Material_LambertPhong{ colors::Yellow, 0.5f, 0.5f, 50.f });\
+			if (!ReadMaterial(stream, materialNames, sphere.materialIndex, error))
+				return false;
 
-		const auto matLambert_White = AddMaterial(new Material_Lambert{ colors::White, 1.f });
+			m_FileSpheres.push_back(sphere);
+		}
+		else if (command == "plane")
+		{
+			// plane x y z nx ny nz material
+			Plane plane{};
+			if (!ReadVector3(stream, plane.origin) || !ReadVector3(stream, plane.normal))
+			{
+				error = "plane needs an origin and a normal";
+				return false;
+			}
 
-		////Plane
-		AddPlane({ -5.f, 0.f, 0.f }, { 1.f, 0.f,0.f }, matLambert_GrayBlue);
-		AddPlane({ 5.f, 0.f, 0.f }, { -1.f, 0.f,0.f }, matLambert_GrayBlue);
-		AddPlane({ 0.f, 0.f, 0.f }, { 0.f, 1.f,0.f }, matLambert_GrayBlue);
-		AddPlane({ 0.f, 10.f, 0.f }, { 0.f, -1.f,0.f }, matLambert_GrayBlue);
-		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f,-1.f }, matLambert_GrayBlue);
+			if (!ReadMaterial(stream, materialNames, plane.materialIndex, error))
+				return false;
 
-		//Spheres
-		AddSphere({ -1.75f, 1.f, 0.f }, .75f, matCT_GrayRoughMetal);
-		AddSphere({ 0.f, 1.f, 0.f }, .75f, matCT_GrayMediumMetal);
-		AddSphere({ 1.75f, 1.f, 0.f }, .75f, matCT_GraySmoothMetal);
+			m_FilePlanes.push_back(plane);
+		}
+		else if (command == "pointlight" || command == "directionallight")
+		{
+			// pointlight x y z intensity r g b, directionallight dx dy dz intensity r g b
+			Light light{};
+			light.type = command == "pointlight" ? LightType::Point : LightType::Directional;
 
-		AddSphere({ -1.75f, 3.f, 0.f }, .75f, matCT_GrayRoughPlastic);
-		AddSphere({ 0.f, 3.f, 0.f }, .75f, matCT_GrayMediumPlastic);
-		AddSphere({ 1.75f, 3.f, 0.f }, .75f, matCT_GraySmoothPlastic);
+			Vector3& position = light.type == LightType::Point ? light.origin : light.direction;
+			if (!ReadVector3(stream, position) || !(stream >> light.intensity) || !ReadColor(stream, light.color))
+			{
+				error = command + " needs a position or direction, an intensity and a color";
+				return false;
+			}
 
-		// CW winding order
-		const Triangle baseTriangle = { Vector3(-.75f, 1.5f, 0.f), Vector3(.75f, 0.f, 0.f), Vector3(-.75f, 0.f, 0.f) };
-		
-		m_pMeshes[0] = AddTriangleMesh(TriangleCullMode::BackFaceCulling, matLambert_White);
-		m_pMeshes[0]->AppendTriangle(baseTriangle, true);
-		m_pMeshes[0]->Translate({ -1.75f, 4.5f, 0.f });
-		m_pMeshes[0]->CalculateNormals();
-		m_pMeshes[0]->UpdateTransforms();
-		m_pMeshes[0]->UpdateAABB();
+			m_FileLights.push_back(light);
+		}
+		else if (command == "mesh")
+		{
+			// mesh name obj file [bvh sah|lbvh], relative to the scene file
+			// mesh name triangle x0 y0 z0 x1 y1 z1 x2 y2 z2
+			std::string name{}, type{};
+			uint32_t existingIndex{};
+			if (!(stream >> name >> type) || FindName(meshNames, name, existingIndex))
+			{
+				error = "mesh needs a new name and a type";
+				return false;
+			}
 
-		m_pMeshes[1] = AddTriangleMesh(TriangleCullMode::FrontFaceCulling, matLambert_White);
-		m_pMeshes[1]->AppendTriangle(baseTriangle, true);
-		m_pMeshes[1]->Translate({ 0.f, 4.5f, 0.f });
-		m_pMeshes[1]->CalculateNormals();
-		m_pMeshes[1]->UpdateTransforms();
-		m_pMeshes[1]->UpdateAABB();
+			MeshData mesh{};
+			if (type == "obj")
+			{
+				std::string filename{};
+				if (!(stream >> filename))
+				{
+					error = "obj mesh '" + name + "' needs a file";
+					return false;
+				}
+
+				mesh.filename = (std::filesystem::path(m_Filename).parent_path() / filename).string();
+
+				std::string option{};
+				if (stream >> option && option[0] != '#')
+				{
+					std::string builder{};
+					stream >> builder;
+
+					if (option == "bvh" && builder == "sah")
+						mesh.bvhBuilder = BVHBuilder::SAH;
+					else if (option == "bvh" && builder == "lbvh")
+						mesh.bvhBuilder = BVHBuilder::LBVH;
+					else
+					{
+						error = "obj mesh '" + name + "' has an invalid option, only bvh sah|lbvh is known";
+						return false;
+					}
+				}
+			}
+			else if (type == "triangle")
+			{
+				Vector3 v0{}, v1{}, v2{};
+				if (!ReadVector3(stream, v0) || !ReadVector3(stream, v1) || !ReadVector3(stream, v2))
+				{
+					error = "triangle mesh '" + name + "' needs 3 vertices";
+					return false;
+				}
+
+				const Triangle triangle{ v0, v1, v2 };
+				mesh.positions = { triangle.v0, triangle.v1, triangle.v2 };
+				mesh.normals = { triangle.normal };
+				mesh.indices = { 0, 1, 2 };
+			}
+			else
+			{
+				error = "unknown mesh type '" + type + "'";
+				return false;
+			}
 
-		m_pMeshes[2] = AddTriangleMesh(TriangleCullMode::NoCulling, matLambert_White);
-		m_pMeshes[2]->AppendTriangle(baseTriangle, true);
-		m_pMeshes[2]->Translate({ 1.75f, 4.5f, 0.f });
-		m_pMeshes[2]->CalculateNormals();
-		m_pMeshes[2]->UpdateTransforms();
-		m_pMeshes[2]->UpdateAABB();
+			meshNames.push_back(name);
+			m_FileMeshes.push_back(std::move(mesh));
+		}
+		else if (command == "instance")
+		{
+			// instance mesh material [cull back|front|none] [translate x y z] [yaw degrees] [scale x y z] [spin]
+			Instance instance{};
+
+			std::string meshName{};
+			if (!(stream >> meshName) || !FindName(meshNames, meshName, instance.meshIndex))
+			{
+				error = "unknown mesh '" + meshName + "'";
+				return false;
+			}
 
-		
+			if (!ReadMaterial(stream, materialNames, instance.materialIndex, error))
+				return false;
 
-		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, ColorRGB{ 1.f, .61f, .45f });
-		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, ColorRGB{ 1.f, .8f, .45f });
-		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, ColorRGB{ .34f, .47f, .68f });
+			std::string option{};
+			while (stream >> option)
+			{
+				if (option[0] == '#')
+					break;
+
+				bool isValid{ true };
+
+				if (option == "cull")
+				{
+					std::string cullMode{};
+					stream >> cullMode;
+
+					if (cullMode == "back")
+						instance.cullMode = TriangleCullMode::BackFaceCulling;
+					else if (cullMode == "front")
+						instance.cullMode = TriangleCullMode::FrontFaceCulling;
+					else if (cullMode == "none")
+						instance.cullMode = TriangleCullMode::NoCulling;
+					else
+						isValid = false;
+				}
+				else if (option == "translate")
+				{
+					isValid = ReadVector3(stream, instance.translation);
+				}
+				else if (option == "yaw")
+				{
+					isValid = static_cast<bool>(stream >> instance.yaw);
+					instance.yaw *= TO_RADIANS;
+				}
+				else if (option == "scale")
+				{
+					isValid = ReadVector3(stream, instance.scale);
+				}
+				else if (option == "spin")
+				{
+					instance.isSpinning = true;
+				}
+				else if (option == "twist")
+				{
+					isValid = static_cast<bool>(stream >> instance.twist);
+					instance.twist *= TO_RADIANS;
+				}
+				else
+				{
+					error = "unknown instance option '" + option + "'";
+					return false;
+				}
+
+				if (!isValid)
+				{
+					error = "instance " + option + " has an invalid value";
+					return false;
+				}
+			}
+
+			m_FileInstances.push_back(instance);
+		}
+		else
+		{
+			error = "unknown command '" + command + "'";
+			return false;
+		}
+
+		std::string extra{};
+		if (stream >> extra && extra[0] != '#')
+		{
+			error = "unexpected '" + extra + "' after " + command;
+			return false;
+		}
+
+		return true;
 	}
 
-	void Scene_W4_ReferenceScene::Update(Timer* pTimer)
+	bool Scene_File::LoadMeshes()
 	{
-		Scene::Update(pTimer);
-		
-		const auto yawAngle = (cos(pTimer->GetTotal()) + 1.f) / 2.f * PI_2;
-		for (const auto m : m_pMeshes)
+		std::vector<uint32_t> objMeshes{};
+		for (uint32_t i{}; i < m_FileMeshes.size(); ++i)
+		{
+			if (!m_FileMeshes[i].filename.empty())
+				objMeshes.push_back(i);
+		}
+
+		if (objMeshes.empty())
+			return true;
+
+		// One task per mesh, every load splits its own file and bvh build over the same pool from inside its task
+		const uint32_t meshCount = static_cast<uint32_t>(objMeshes.size());
+		ThreadPool threadPool{};
+
+		std::vector<uint8_t> isLoaded(meshCount);
+		threadPool.Dispatch(meshCount, [&](uint32_t i)
 		{
-			m->RotateY(yawAngle);
-			m->UpdateTransforms();
+			MeshData& mesh = m_FileMeshes[objMeshes[i]];
+			isLoaded[i] = MeshLoader::LoadOBJ(mesh.filename, mesh.positions, mesh.normals, mesh.indices, &mesh.bvh, mesh.bvhBuilder, &threadPool);
+		});
+
+		for (uint32_t i{}; i < meshCount; ++i)
+		{
+			if (!isLoaded[i])
+			{
+				std::cout << m_Filename << ": could not load mesh " << m_FileMeshes[objMeshes[i]].filename << "\n";
+				return false;
+			}
 		}
+
+		return true;
 	}
 
-	void Scene_W4_BunnyScene::Initialize()
+	void Scene_File::Initialize()
 	{
-		m_Camera.origin = { 0.f, 3.f, -9.f };
-		m_Camera.fovAngle = 45.0f;
+		if (m_HasCamera)
+			m_Camera = m_FileCamera;
 
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ .49f, 0.57f, 0.57f }, 1.f));
-		const auto matLambert_Gray = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		// Material indices were handed out in file order after the default material
+		for (std::unique_ptr<Material>& pMaterial : m_FileMaterials)
+			AddMaterial(pMaterial.release());
+		m_FileMaterials.clear();
 
-		//Plane
-		AddPlane({ -5.f, 0.f, 0.f }, { 1.f, 0.f,0.f }, matLambert_GrayBlue);
-		AddPlane({ 5.f, 0.f, 0.f }, { -1.f, 0.f,0.f }, matLambert_GrayBlue);
-		AddPlane({ 0.f, 0.f, 0.f }, { 0.f, 1.f,0.f }, matLambert_GrayBlue);
-		AddPlane({ 0.f, 10.f, 0.f }, { 0.f, -1.f,0.f }, matLambert_GrayBlue);
-		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f,-1.f }, matLambert_GrayBlue);
+		for (const Plane& plane : m_FilePlanes)
+			AddPlane(plane.origin, plane.normal, plane.materialIndex);
 
-		pMesh = AddTriangleMesh(TriangleCullMode::BackFaceCulling, matLambert_Gray);
-		Utils::ParseOBJ("Resources/lowpoly_bunny2.obj",
-			pMesh->positions,
-			pMesh->normals,
-			pMesh->indices);
-		//pMesh->CalculateNormals();
-		
-		pMesh->Scale({ 2.f, 2.f, 2.f });
+		for (const Sphere& sphere : m_FileSpheres)
+			AddSphere(sphere.origin, sphere.radius, sphere.materialIndex);
 
-		pMesh->UpdateAABB();
-		pMesh->UpdateTransforms();
+		for (uint32_t instanceIndex{}; instanceIndex < m_FileInstances.size(); ++instanceIndex)
+		{
+			const Instance& instance = m_FileInstances[instanceIndex];
+			const MeshData& mesh = m_FileMeshes[instance.meshIndex];
+			const bool isTwisting = instance.twist != 0.f;
+
+			TriangleMesh* pMesh = AddTriangleMesh(instance.cullMode, instance.materialIndex);
+			pMesh->isInstanced = !isTwisting;
+			pMesh->positions = mesh.positions;
+			pMesh->normals = mesh.normals;
+			pMesh->indices = mesh.indices;
+			// Same object space triangles, UpdateTransforms only builds a bvh when this one is missing
+			if (!isTwisting)
+				pMesh->bvh = mesh.bvh;
+
+			pMesh->Translate(instance.translation);
+			pMesh->RotateY(instance.yaw);
+			pMesh->Scale(instance.scale);
+
+			pMesh->UpdateAABB();
+			pMesh->UpdateTransforms();
 
-		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, ColorRGB{ 1.f, .61f, .45f });
-		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, ColorRGB{ 1.f, .8f, .45f });
-		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, ColorRGB{ .34f, .47f, .68f });
+			const uint32_t meshIndex = static_cast<uint32_t>(m_TriangleMeshGeometries.size() - 1);
+
+			if (instance.isSpinning)
+				m_SpinningMeshes.push_back(meshIndex);
+
+			if (isTwisting)
+				m_TwistingMeshes.push_back({ meshIndex, instanceIndex, pMesh->minAABB, pMesh->maxAABB });
+
+			if (instance.isSpinning || isTwisting)
+				m_AnimatedMeshes.push_back(meshIndex);
+		}
+
+		if (!m_TwistingMeshes.empty())
+		{
+			m_pThreadPool = std::make_unique<ThreadPool>();
+			m_pRebuildThread = std::make_unique<BackgroundThread>("BVH Rebuild");
+		}
+
+		for (const Light& light : m_FileLights)
+		{
+			if (light.type == LightType::Point)
+				AddPointLight(light.origin, light.intensity, light.color);
+			else
+				AddDirectionalLight(light.direction, light.intensity, light.color);
+		}
+
+		m_IsAnimated = !m_AnimatedMeshes.empty();
 	}
 
-	void Scene_W4_BunnyScene::Update(Timer* pTimer)
+	void Scene_File::Update(Timer* pTimer)
 	{
+		PROFILE_ZONE("Scene::Update");
+
 		Scene::Update(pTimer);
 
-		pMesh->RotateY((cos(pTimer->GetTotal()) + 1.f) / 2.f * PI_2);
+		const float yawAngle = (cos(pTimer->GetTotal()) + 1.f) / 2.f * PI_2;
+		for (const uint32_t meshIndex : m_SpinningMeshes)
+		{
+			m_TriangleMeshGeometries[meshIndex].RotateY(yawAngle);
+		}
+
+		const float twistAmount = sin(pTimer->GetTotal());
+		for (const TwistingMesh& twistingMesh : m_TwistingMeshes)
+		{
+			TwistMesh(twistingMesh, twistAmount * m_FileInstances[twistingMesh.instanceIndex].twist);
+		}
 
-		pMesh->UpdateTransforms();
+		for (const uint32_t meshIndex : m_AnimatedMeshes)
+		{
+			m_TriangleMeshGeometries[meshIndex].UpdateTransforms(m_pThreadPool.get(), m_pRebuildThread.get());
+		}
 	}
-}
 
+	void Scene_File::TwistMesh(const TwistingMesh& twistingMesh, float twistAngle)
+	{
+		PROFILE_ZONE("Scene::TwistMesh");
 
+		TriangleMesh& mesh = m_TriangleMeshGeometries[twistingMesh.meshIndex];
+		const std::vector<Vector3>& restPositions = m_FileMeshes[m_FileInstances[twistingMesh.instanceIndex].meshIndex].positions;
 
+		const Vector3 center = (twistingMesh.minAABB + twistingMesh.maxAABB) * 0.5f;
+		const float height = std::max(twistingMesh.maxAABB.y - twistingMesh.minAABB.y, FLT_MIN);
 
+		// Rotated around the vertical axis through the center, the bottom stays put and the top turns twistAngle
+		constexpr uint32_t chunkSize{ 4096 };
+		const uint32_t vertexCount = static_cast<uint32_t>(restPositions.size());
+		m_pThreadPool->Dispatch((vertexCount + chunkSize - 1) / chunkSize, [&](uint32_t chunk)
+		{
+			const uint32_t end = std::min(vertexCount, (chunk + 1) * chunkSize);
+			for (uint32_t i{ chunk * chunkSize }; i < end; ++i)
+			{
+				const Vector3& position = restPositions[i];
+				const float angle = twistAngle * (position.y - twistingMesh.minAABB.y) / height;
+				const float cosAngle = cos(angle);
+				const float sinAngle = sin(angle);
+
+				const float x = position.x - center.x;
+				const float z = position.z - center.z;
+				mesh.positions[i] = Vector3{ center.x + cosAngle * x + sinAngle * z, position.y, center.z - sinAngle * x + cosAngle * z };
+			}
+		});
+
+		mesh.CalculateNormals();
+		mesh.UpdateAABB();
+	}
+#pragma endregion
+
+	Scene* CreateScene(const std::string& sceneName)
+	{
+		// The scenes that used to be compiled in
+		std::string filename{ sceneName };
+		for (const char* pBuiltInScene : { "W1", "W2", "W3", "W4_Reference", "W4_Bunny" })
+		{
+			if (sceneName == pBuiltInScene)
+				filename = "Resources/" + sceneName + ".scene";
+		}
+
+		Scene_File* pScene = new Scene_File(filename);
+		if (!pScene->Load())
+		{
+			delete pScene;
+			return nullptr;
+		}
+
+		return pScene;
+	}
+}
@@ -1,10 +1,13 @@
 #pragma once
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "Math.h"
 #include "DataTypes.h"
 #include "Camera.h"
+#include "Material.h"
+#include "ThreadPool.h"
 
 namespace dae
 {
@@ -36,16 +39,42 @@ namespace dae
 		Camera& GetCamera() { return m_Camera; }
 		void GetClosestHit(const Ray& ray, HitRecord& closestHit) const;
 		bool DoesHit(const Ray& ray) const;
+		// Shadow ray towards light lightIndex, tests what blocked that light last on this thread before anything else
+		bool IsOccluded(const Ray& ray, uint32_t lightIndex) const;
+
+		// Top level objects that can be inside the frustum, the index list for the packet GetClosestHit
+		void GatherVisibleObjects(const Frustum& frustum, std::vector<uint32_t>& objectIndices) const;
+		// Planes and the given objects only, every lane of hitRecords keeps its closest hit
+		void GetClosestHit(const RayPacket& packet, const std::vector<uint32_t>& objectIndices, HitRecord (&hitRecords)[RayPacket::Size]) const;
+
+		// Objects move by themselves every Update, progressive rendering can't accumulate samples
+		bool IsAnimated() const { return m_IsAnimated; }
+
+		// Refits (or rebuilds) the top level bvh, call once per frame after the objects moved
+		void UpdateTopLevelBVH();
 
 		const std::vector<Plane>& GetPlaneGeometries() const { return m_PlaneGeometries; }
 		const std::vector<Sphere>& GetSphereGeometries() const { return m_SphereGeometries; }
 		const std::vector<Light>& GetLights() const { return m_Lights; }
-		const std::vector<Material*> GetMaterials() const { return m_Materials; }
+		const std::vector<Material*>& GetMaterials() const { return m_Materials; }
+		// Same materials by value, indexed by materialIndex
+		const std::vector<MaterialData>& GetMaterialTable() const { return m_MaterialTable; }
 
 		// custom
 		void EnableMoller(bool value) { m_UsingMoller = value; std::cout << "Moller :" << value << "\n"; };
 		bool IsMoller() { return m_UsingMoller; };
 
+		void SetMeshTraversal(MeshTraversal traversal);
+		void CycleMeshTraversal();
+		MeshTraversal GetMeshTraversal() const { return m_MeshTraversal; }
+		// Traversal memory of all meshes over their triangle count, see TriangleMesh::GetTraversalMemoryUsage
+		float GetMeshBytesPerTriangle() const;
+
+		// Unsupported kernels are ignored
+		void SetTriangleKernel(TriangleKernel kernel);
+		void CycleTriangleKernel();
+		TriangleKernel GetTriangleKernel() const { return m_TriangleKernel; }
+
 	protected:
 		std::string	sceneName;
 
@@ -54,10 +83,49 @@ namespace dae
 		std::vector<TriangleMesh> m_TriangleMeshGeometries{};
 		std::vector<Light> m_Lights{};
 		std::vector<Material*> m_Materials{};
+		std::vector<MaterialData> m_MaterialTable{};
 
 		std::vector<Triangle> m_Triangles{};
 
+		// Top level acceleration structure over spheres and meshes, planes are unbounded and tested separately
+		enum class ObjectType : uint8_t
+		{
+			Sphere,
+			TriangleMesh,
+			// Never in the top level bvh, only to remember which object a closest hit came from
+			Plane
+		};
+
+		struct ObjectReference
+		{
+			ObjectType type{};
+			uint32_t index{};
+		};
+
+		// The only place a closest hit query builds its HitRecord, once it knows which candidate won
+		void FillHitRecord(const ObjectReference& object, const Ray& ray, const HitCandidate& candidate, HitRecord& hitRecord) const;
+
+		// A plane or a top level object
+		struct Occluder
+		{
+			bool isPlane{};
+			uint32_t index{ UINT32_MAX };
+		};
+
+		bool IsOccludedBy(const Occluder& occluder, const Ray& ray) const;
+		// Stores what was hit in occluder, skip is not tested again
+		bool FindOccluder(const Ray& ray, const Occluder& skip, Occluder& occluder) const;
+		// One per light on the calling thread, starts over when the thread renders another scene
+		std::vector<Occluder>& GetLastOccluders() const;
+
+		std::vector<ObjectReference> m_TopLevelObjects{};
+		std::vector<Vector3> m_ObjectMinBounds{};
+		std::vector<Vector3> m_ObjectMaxBounds{};
+		BVH m_TopLevelBVH{};
+		float m_TopLevelBuildCost{};
+
 		Camera m_Camera{};
+		bool m_IsAnimated{ false };
 
 		Sphere* AddSphere(const Vector3& origin, float radius, unsigned char materialIndex = 0);
 		Plane* AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex = 0);
@@ -69,85 +137,94 @@ namespace dae
 
 		// custom
 		bool m_UsingMoller{ true };
+		MeshTraversal m_MeshTraversal{ MeshTraversal::BVH };
+		TriangleKernel m_TriangleKernel{ GetBestTriangleKernel() };
 	};
 
-	//+++++++++++++++++++++++++++++++++++++++++
-	//WEEK 1 Test Scene
-	class Scene_W1 final : public Scene
-	{
-	public:
-		Scene_W1() = default;
-		~Scene_W1() override = default;
-
-		Scene_W1(const Scene_W1&) = delete;
-		Scene_W1(Scene_W1&&) noexcept = delete;
-		Scene_W1& operator=(const Scene_W1&) = delete;
-		Scene_W1& operator=(Scene_W1&&) noexcept = delete;
-
-		void Initialize() override;
-	};
-
-	class Scene_W2 final : public Scene
-	{
-	public:
-		Scene_W2() = default;
-		~Scene_W2() override = default;
-
-		Scene_W2(const Scene_W2&) = delete;
-		Scene_W2(Scene_W2&&) noexcept = delete;
-		Scene_W2& operator=(const Scene_W2&) = delete;
-		Scene_W2& operator=(Scene_W2&&) noexcept = delete;
-
-		void Initialize() override;
-	};
-
-	class Scene_W3 final : public Scene
+	/**
+	 * \brief Scene described by a text file, see Resources/W3.scene for the format.
+	 * Load parses the file and loads its meshes in parallel, Initialize then adds everything through the Add* helpers.
+	 */
+	class Scene_File final : public Scene
 	{
 	public:
-		Scene_W3() = default;
-		~Scene_W3() override = default;
+		explicit Scene_File(const std::string& filename);
+		~Scene_File() override = default;
 
-		Scene_W3(const Scene_W3&) = delete;
-		Scene_W3(Scene_W3&&) noexcept = delete;
-		Scene_W3& operator=(const Scene_W3&) = delete;
-		Scene_W3& operator=(Scene_W3&&) noexcept = delete;
+		Scene_File(const Scene_File&) = delete;
+		Scene_File(Scene_File&&) noexcept = delete;
+		Scene_File& operator=(const Scene_File&) = delete;
+		Scene_File& operator=(Scene_File&&) noexcept = delete;
 
-		void Initialize() override;
-	};
-
-	class Scene_W4_ReferenceScene final : public Scene
-	{
-	public:
-		Scene_W4_ReferenceScene() = default;
-		~Scene_W4_ReferenceScene() override = default;
-
-		Scene_W4_ReferenceScene(const Scene_W4_ReferenceScene&) = delete;
-		Scene_W4_ReferenceScene(Scene_W4_ReferenceScene&&) noexcept = delete;
-		Scene_W4_ReferenceScene& operator=(const Scene_W4_ReferenceScene&) = delete;
-		Scene_W4_ReferenceScene& operator=(Scene_W4_ReferenceScene&&) noexcept = delete;
+		// Prints the first error with its line number and returns false
+		bool Load();
 
 		void Initialize() override;
 		void Update(Timer* pTimer) override;
 
 	private:
-		TriangleMesh* m_pMeshes[3]{nullptr};
+		struct MeshData
+		{
+			std::string filename{};
+			std::vector<Vector3> positions{};
+			std::vector<Vector3> normals{};
+			std::vector<int> indices{};
+			BVH bvh{};
+			BVHBuilder bvhBuilder{ BVHBuilder::SAH };
+		};
+
+		struct Instance
+		{
+			uint32_t meshIndex{};
+			unsigned char materialIndex{};
+			TriangleCullMode cullMode{ TriangleCullMode::BackFaceCulling };
+			Vector3 translation{};
+			float yaw{};
+			Vector3 scale{ 1.f, 1.f, 1.f };
+			// Swings around the y axis over time like the week 4 scenes
+			bool isSpinning{};
+			// Radians the top turns relative to the bottom at the peak of the twist, 0 keeps the mesh rigid
+			float twist{};
+		};
+
+		// A twisting instance moves its vertices every frame, so it can't be instanced
+		struct TwistingMesh
+		{
+			uint32_t meshIndex{};
+			uint32_t instanceIndex{};
+			// Untwisted bounds, the axis runs through the middle of the mesh
+			Vector3 minAABB{};
+			Vector3 maxAABB{};
+		};
+
+		std::string m_Filename{};
+
+		bool m_HasCamera{};
+		Camera m_FileCamera{};
+		std::vector<std::unique_ptr<Material>> m_FileMaterials{};
+		std::vector<Sphere> m_FileSpheres{};
+		std::vector<Plane> m_FilePlanes{};
+		std::vector<Light> m_FileLights{};
+		std::vector<MeshData> m_FileMeshes{};
+		std::vector<Instance> m_FileInstances{};
+
+		// Indices into m_TriangleMeshGeometries, pointers would not survive the vector growing
+		std::vector<uint32_t> m_SpinningMeshes{};
+		std::vector<TwistingMesh> m_TwistingMeshes{};
+		// Spinning or twisting, every one gets a single UpdateTransforms per frame
+		std::vector<uint32_t> m_AnimatedMeshes{};
+
+		// Twists the vertices and refits the bvhs of twisting meshes, only created when there are any
+		std::unique_ptr<ThreadPool> m_pThreadPool{};
+		// Rebuilds the bvh of a twisting mesh once refitting made it too slow to trace, alongside m_pThreadPool
+		std::unique_ptr<BackgroundThread> m_pRebuildThread{};
+
+		bool ParseLine(const std::string& line, std::vector<std::string>& materialNames, std::vector<std::string>& meshNames, std::string& error);
+		bool LoadMeshes();
+		void TwistMesh(const TwistingMesh& twistingMesh, float twistAngle);
 	};
 
-	class Scene_W4_BunnyScene final : public Scene
-	{
-	public:
-		Scene_W4_BunnyScene() = default;
-		~Scene_W4_BunnyScene() override = default;
-
-		Scene_W4_BunnyScene(const Scene_W4_BunnyScene&) = delete;
-		Scene_W4_BunnyScene(Scene_W4_BunnyScene&&) noexcept = delete;
-		Scene_W4_BunnyScene& operator=(const Scene_W4_BunnyScene&) = delete;
-		Scene_W4_BunnyScene& operator=(Scene_W4_BunnyScene&&) noexcept = delete;
-
-		void Initialize() override;
-		void Update(Timer* pTimer) override;
-
-	private:
-		TriangleMesh* pMesh{nullptr};
-	};
+	//Creates a scene from a .scene file, W1, W2, W3, W4_Reference and W4_Bunny are short for Resources/<name>.scene.
+	//Returns nullptr when the file is missing or invalid
+	Scene* CreateScene(const std::string& sceneName);
 }
@@ -0,0 +1,19 @@
+#pragma once
+
+// Platform checks for the files with hand written simd paths, SIMD_X86 is defined where SSE and AVX intrinsics exist
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC emits AVX intrinsics without /arch:AVX, gcc and clang only inside functions that ask for them
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX __attribute__((target("avx")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX
+#define TARGET_AVX2
+#endif
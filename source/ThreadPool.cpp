@@ -0,0 +1,245 @@
+#include "ThreadPool.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace dae
+{
+	namespace
+	{
+		// Pool and index of the worker running on this thread, threads outside a pool act as its worker 0
+		thread_local const ThreadPool* t_pWorkerPool{ nullptr };
+		thread_local uint32_t t_WorkerIndex{ 0 };
+
+		uint64_t GetTimeNs()
+		{
+			return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count());
+		}
+	}
+
+	ThreadPool::ThreadPool(uint32_t threadCount)
+	{
+		threadCount = std::max(threadCount, 1u);
+
+		m_Workers.reserve(threadCount);
+		for (uint32_t i{}; i < threadCount; ++i)
+			m_Workers.emplace_back(std::make_unique<Worker>());
+
+		// Worker 0 is the dispatching thread, it does not get a thread of its own
+		for (uint32_t i{ 1 }; i < threadCount; ++i)
+			m_Workers[i]->thread = std::thread(&ThreadPool::WorkerLoop, this, i);
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard lock{ m_WakeMutex };
+			m_IsStopping = true;
+		}
+		m_WakeCondition.notify_all();
+
+		for (const auto& pWorker : m_Workers)
+		{
+			if (pWorker->thread.joinable())
+				pWorker->thread.join();
+		}
+	}
+
+	std::vector<ThreadPool::WorkerStats> ThreadPool::GetWorkerStats() const
+	{
+		std::vector<WorkerStats> stats{};
+		stats.reserve(m_Workers.size());
+
+		for (const auto& pWorker : m_Workers)
+		{
+			WorkerStats& workerStats = stats.emplace_back();
+			workerStats.busyNs = pWorker->busyNs.load(std::memory_order_relaxed);
+			workerStats.idleNs = pWorker->idleNs.load(std::memory_order_relaxed);
+			workerStats.tasksExecuted = pWorker->tasksExecuted.load(std::memory_order_relaxed);
+			workerStats.tasksStolen = pWorker->tasksStolen.load(std::memory_order_relaxed);
+		}
+
+		return stats;
+	}
+
+	void ThreadPool::ResetWorkerStats()
+	{
+		for (const auto& pWorker : m_Workers)
+		{
+			pWorker->busyNs.store(0, std::memory_order_relaxed);
+			pWorker->idleNs.store(0, std::memory_order_relaxed);
+			pWorker->tasksExecuted.store(0, std::memory_order_relaxed);
+			pWorker->tasksStolen.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void ThreadPool::PrintWorkerStats() const
+	{
+		const std::vector<WorkerStats> stats = GetWorkerStats();
+
+		std::cout << "**THREAD POOL STATS** (" << stats.size() << " threads)\n";
+		for (size_t i{}; i < stats.size(); ++i)
+		{
+			const uint64_t totalNs = std::max<uint64_t>(stats[i].busyNs + stats[i].idleNs, 1);
+			const float busyPercentage = 100.f * static_cast<float>(stats[i].busyNs) / static_cast<float>(totalNs);
+
+			std::cout << ">> WORKER " << i
+				<< " BUSY = " << stats[i].busyNs / 1000000 << "ms (" << busyPercentage << "%)"
+				<< " IDLE = " << stats[i].idleNs / 1000000 << "ms"
+				<< " TASKS = " << stats[i].tasksExecuted
+				<< " STOLEN = " << stats[i].tasksStolen << "\n";
+		}
+	}
+
+	void ThreadPool::DispatchImpl(uint32_t count, TaskFunction pFunction, void* pContext)
+	{
+		if (count == 0)
+			return;
+
+		std::atomic<uint32_t> remaining{ count };
+
+		// Counted before they are pushed, so a worker popping early never sees the counter underflow
+		{
+			std::lock_guard lock{ m_WakeMutex };
+			m_QueuedTasks.fetch_add(count, std::memory_order_release);
+		}
+
+		// Hand out contiguous ranges so neighbouring tasks stay on the same worker until someone steals them
+		const uint32_t workerCount = GetThreadCount();
+		for (uint32_t w{}; w < workerCount; ++w)
+		{
+			const uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(count) * w / workerCount);
+			const uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(count) * (w + 1) / workerCount);
+
+			Worker& worker = *m_Workers[w];
+			std::lock_guard lock{ worker.mutex };
+
+			// Pushed in reverse because the owner pops from the back
+			for (uint32_t index{ end }; index-- > begin;)
+				worker.tasks.push_back({ pFunction, pContext, index, &remaining });
+		}
+
+		m_WakeCondition.notify_all();
+
+		// Help out until every task of this dispatch has finished
+		// A task of this pool dispatching again, like a mesh load parsing its file, helps out as the worker it runs on
+		// A worker of another pool is worker 0 here
+		const uint32_t workerIndex = t_pWorkerPool == this ? t_WorkerIndex : 0;
+		uint64_t idleStart = GetTimeNs();
+
+		while (remaining.load(std::memory_order_acquire) > 0)
+		{
+			Task task{};
+			const bool isOwnTask = PopTask(workerIndex, task);
+
+			if (isOwnTask || StealTask(workerIndex, task))
+			{
+				m_Workers[workerIndex]->idleNs.fetch_add(GetTimeNs() - idleStart, std::memory_order_relaxed);
+				RunTask(workerIndex, task, !isOwnTask);
+				idleStart = GetTimeNs();
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+
+		m_Workers[workerIndex]->idleNs.fetch_add(GetTimeNs() - idleStart, std::memory_order_relaxed);
+	}
+
+	void ThreadPool::WorkerLoop(uint32_t workerIndex)
+	{
+		t_pWorkerPool = this;
+		t_WorkerIndex = workerIndex;
+		PROFILE_THREAD_NAME("Worker " + std::to_string(workerIndex));
+
+		uint64_t idleStart = GetTimeNs();
+
+		while (true)
+		{
+			Task task{};
+			const bool isOwnTask = PopTask(workerIndex, task);
+
+			if (isOwnTask || StealTask(workerIndex, task))
+			{
+				m_Workers[workerIndex]->idleNs.fetch_add(GetTimeNs() - idleStart, std::memory_order_relaxed);
+				RunTask(workerIndex, task, !isOwnTask);
+				idleStart = GetTimeNs();
+				continue;
+			}
+
+			std::unique_lock lock{ m_WakeMutex };
+			m_WakeCondition.wait(lock, [this] { return m_IsStopping || m_QueuedTasks.load(std::memory_order_acquire) > 0; });
+
+			if (m_IsStopping)
+				break;
+		}
+	}
+
+	bool ThreadPool::PopTask(uint32_t workerIndex, Task& task)
+	{
+		Worker& worker = *m_Workers[workerIndex];
+		std::lock_guard lock{ worker.mutex };
+
+		if (worker.head == worker.tasks.size())
+			return false;
+
+		task = worker.tasks.back();
+		worker.tasks.pop_back();
+
+		// Keep the capacity around, the next dispatch reuses it without allocating
+		if (worker.head == worker.tasks.size())
+		{
+			worker.tasks.clear();
+			worker.head = 0;
+		}
+
+		m_QueuedTasks.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	bool ThreadPool::StealTask(uint32_t workerIndex, Task& task)
+	{
+		const uint32_t workerCount = GetThreadCount();
+
+		for (uint32_t offset{ 1 }; offset < workerCount; ++offset)
+		{
+			Worker& victim = *m_Workers[(workerIndex + offset) % workerCount];
+			std::lock_guard lock{ victim.mutex };
+
+			if (victim.head == victim.tasks.size())
+				continue;
+
+			task = victim.tasks[victim.head++];
+
+			if (victim.head == victim.tasks.size())
+			{
+				victim.tasks.clear();
+				victim.head = 0;
+			}
+
+			m_QueuedTasks.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		return false;
+	}
+
+	void ThreadPool::RunTask(uint32_t workerIndex, const Task& task, bool isStolen)
+	{
+		Worker& worker = *m_Workers[workerIndex];
+		const uint64_t startTime = GetTimeNs();
+
+		task.pFunction(task.pContext, task.index);
+
+		worker.busyNs.fetch_add(GetTimeNs() - startTime, std::memory_order_relaxed);
+		worker.tasksExecuted.fetch_add(1, std::memory_order_relaxed);
+		if (isStolen)
+			worker.tasksStolen.fetch_add(1, std::memory_order_relaxed);
+
+		task.pRemaining->fetch_sub(1, std::memory_order_acq_rel);
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace dae
+{
+	/**
+	 * \brief Persistent pool of worker threads with one task deque per worker.
+	 * Workers pop their own tasks from the back and steal from the front of the other deques when they run dry.
+	 * The thread that dispatches work takes part as worker 0 until all of its tasks are done.
+	 */
+	class ThreadPool final
+	{
+	public:
+		struct WorkerStats
+		{
+			uint64_t busyNs{};
+			uint64_t idleNs{};
+			uint64_t tasksExecuted{};
+			uint64_t tasksStolen{};
+		};
+
+		explicit ThreadPool(uint32_t threadCount = std::thread::hardware_concurrency());
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool(ThreadPool&&) noexcept = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		ThreadPool& operator=(ThreadPool&&) noexcept = delete;
+
+		/**
+		 * \brief Runs task(index) for every index in [0, count) and returns when all of them are done
+		 * \param task callable taking an uint32_t, it is not copied so no allocation happens per dispatch
+		 */
+		template <typename Task>
+		void Dispatch(uint32_t count, Task&& task)
+		{
+			using TaskType = std::remove_reference_t<Task>;
+			DispatchImpl(count, [](void* pContext, uint32_t index) { (*static_cast<TaskType*>(pContext))(index); }, &task);
+		}
+
+		uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_Workers.size()); }
+		std::vector<WorkerStats> GetWorkerStats() const;
+		void ResetWorkerStats();
+		void PrintWorkerStats() const;
+
+	private:
+		using TaskFunction = void(*)(void*, uint32_t);
+
+		struct Task
+		{
+			TaskFunction pFunction{};
+			void* pContext{};
+			uint32_t index{};
+			std::atomic<uint32_t>* pRemaining{};
+		};
+
+		// Cache line aligned so workers never share a line when updating their counters
+		struct alignas(64) Worker
+		{
+			std::mutex mutex{};
+			std::vector<Task> tasks{};
+			size_t head{};
+
+			std::atomic<uint64_t> busyNs{};
+			std::atomic<uint64_t> idleNs{};
+			std::atomic<uint64_t> tasksExecuted{};
+			std::atomic<uint64_t> tasksStolen{};
+
+			std::thread thread{};
+		};
+
+		std::vector<std::unique_ptr<Worker>> m_Workers{};
+
+		std::mutex m_WakeMutex{};
+		std::condition_variable m_WakeCondition{};
+		std::atomic<uint32_t> m_QueuedTasks{};
+		bool m_IsStopping{ false };
+
+		void DispatchImpl(uint32_t count, TaskFunction pFunction, void* pContext);
+		void WorkerLoop(uint32_t workerIndex);
+		bool PopTask(uint32_t workerIndex, Task& task);
+		bool StealTask(uint32_t workerIndex, Task& task);
+		void RunTask(uint32_t workerIndex, const Task& task, bool isStolen);
+	};
+}
@@ -18,6 +18,8 @@ namespace dae
 		Timer& operator=(Timer&&) noexcept = delete;
 
 		void StartBenchmark(int numFrames = 10);
+		//Simulated clock, every Update advances exactly timeStep seconds. 0 goes back to the real clock
+		void SetFixedTimeStep(float timeStep) { m_FixedTimeStep = timeStep; }
 
 		void Reset();
 		void Start();
@@ -46,6 +48,7 @@ namespace dae
 		float m_SecondsPerCount = 0.0f;
 		float m_ElapsedUpperBound = 0.03f;
 		float m_FPSTimer = 0.0f;
+		float m_FixedTimeStep = 0.0f;
 
 		bool m_IsStopped = true;
 		bool m_ForceElapsedUpperBound = false;
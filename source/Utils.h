@@ -1,9 +1,13 @@
 #pragma once
+#include <bit>
 #include <cassert>
 #include <complex>
 #include <fstream>
+#include <type_traits>
+#include <immintrin.h>
 #include "Math.h"
 #include "DataTypes.h"
+#include "RenderStats.h"
 
 #define Moller
 
@@ -13,8 +17,10 @@ namespace dae
 	{
 #pragma region Sphere HitTest
 		//SPHERE HIT-TESTS
-		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitCandidate& candidate)
 		{
+			RENDER_STATS_ADD(sphereTests, 1);
+
 			// We calculate the vector between the sphere and camera (defaulted at 0,0,0)
 			const Vector3 rayOriginToCameraSphere{sphere.origin - ray.origin };
 
@@ -39,82 +45,115 @@ namespace dae
 				return false;
 			}
 
-			hitRecord.didHit = true;
+			candidate.t = t;
+			return true;
+		}
 
-			if (ignoreHitRecord)
-				return true;
-			
+		inline void FillHitRecord_Sphere(const Sphere& sphere, const Ray& ray, const HitCandidate& candidate, HitRecord& hitRecord)
+		{
+			hitRecord.didHit = true;
 			hitRecord.materialIndex = sphere.materialIndex;
-			hitRecord.t = t;
-			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.t = candidate.t;
+			hitRecord.origin = ray.origin + candidate.t * ray.direction;
 			hitRecord.normal = Vector3(sphere.origin, hitRecord.origin).Normalized();
+		}
+
+		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			HitCandidate candidate{};
+			if (!HitTest_Sphere(sphere, ray, candidate))
+				return false;
+
+			hitRecord.didHit = true;
+
+			if (!ignoreHitRecord)
+				FillHitRecord_Sphere(sphere, ray, candidate, hitRecord);
+
 			return true;
 		}
 
 		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Sphere(sphere, ray, temp, true);
+			HitCandidate temp{};
+			return HitTest_Sphere(sphere, ray, temp);
 		}
 #pragma endregion
 #pragma region Plane HitTest
 		//PLANE HIT-TESTS
-		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitCandidate& candidate)
 		{
+			RENDER_STATS_ADD(planeTests, 1);
+
 			const float t = Vector3::Dot(Vector3{ ray.origin, plane.origin }, plane.normal) / Vector3::Dot(ray.direction, plane.normal);
 
 			if (t >= ray.min && t <= ray.max)
 			{
-				hitRecord.didHit = true;
-				if (ignoreHitRecord)
-					return true;
-
-				hitRecord.t = t;
-				hitRecord.materialIndex = plane.materialIndex;
-				hitRecord.normal = plane.normal;
-				hitRecord.origin = ray.origin + t * ray.direction;
-
+				candidate.t = t;
 				return true;
 			}
 
-			hitRecord.didHit = false;
 			return false;
 		}
 
+		inline void FillHitRecord_Plane(const Plane& plane, const Ray& ray, const HitCandidate& candidate, HitRecord& hitRecord)
+		{
+			hitRecord.didHit = true;
+			hitRecord.t = candidate.t;
+			hitRecord.materialIndex = plane.materialIndex;
+			hitRecord.normal = plane.normal;
+			hitRecord.origin = ray.origin + candidate.t * ray.direction;
+		}
+
+		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			HitCandidate candidate{};
+			if (!HitTest_Plane(plane, ray, candidate))
+			{
+				hitRecord.didHit = false;
+				return false;
+			}
+
+			hitRecord.didHit = true;
+
+			if (!ignoreHitRecord)
+				FillHitRecord_Plane(plane, ray, candidate, hitRecord);
+
+			return true;
+		}
+
 		inline bool HitTest_Plane(const Plane& plane, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Plane(plane, ray, temp, true);
+			HitCandidate temp{};
+			return HitTest_Plane(plane, ray, temp);
 		}
 #pragma endregion
 #pragma region Triangle HitTest
 		//TRIANGLE HIT-TESTS
-		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		// Only sets candidate.t, which triangle it was is up to the caller. The edges are vertex1 - vertex0 and vertex2 - vertex0
+		inline bool HitTest_Triangle(const Vector3& vertex0, const Vector3& edge1, const Vector3& edge2, const Vector3& normal,
+			TriangleCullMode cullMode, const Ray& ray, HitCandidate& candidate)
 		{
+			RENDER_STATS_ADD(triangleTests, 1);
+
 			constexpr float EPSILON = 0.0000001f;
 
-			float normalViewDot = Vector3::Dot(triangle.normal, ray.direction);
+			float normalViewDot = Vector3::Dot(normal, ray.direction);
 
 			// if our ray is perpendicular to the normal it will never hit.
 			if (std::abs(normalViewDot) < EPSILON)
 				return false;
 
 			// Skip calculations depending on cull mode
-			if (triangle.cullMode == TriangleCullMode::FrontFaceCulling && normalViewDot < 0)
+			if (cullMode == TriangleCullMode::FrontFaceCulling && normalViewDot < 0)
 				return false;
 
 			// Skip calculations depending on cull mode
-			if (triangle.cullMode == TriangleCullMode::BackFaceCulling && normalViewDot > 0)
+			if (cullMode == TriangleCullMode::BackFaceCulling && normalViewDot > 0)
 				return false;
 
-			Vector3 vertex0 = triangle.v0;
-			Vector3 vertex1 = triangle.v1;
-			Vector3 vertex2 = triangle.v2;
-			Vector3 edge1{}, edge2{}, h{}, s{}, q{};
+			Vector3 h{}, s{}, q{};
 
 			float a{}, f{}, u{}, v{};
-			edge1 = vertex1 - vertex0;
-			edge2 = vertex2 - vertex0;
 			h = Vector3::Cross(ray.direction, edge2);
 			a = Vector3::Dot(edge1, h);
 
@@ -139,28 +178,100 @@ namespace dae
 			if (t < ray.min || t > ray.max)
 				return false;
 
-			if (ignoreHitRecord)
-				return true;
+			candidate.t = t;
+			return true;
+		}
+
+		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitCandidate& candidate)
+		{
+			return HitTest_Triangle(triangle.v0, triangle.v1 - triangle.v0, triangle.v2 - triangle.v0, triangle.normal,
+				triangle.cullMode, ray, candidate);
+		}
 
-			hitRecord.origin = ray.origin + (t * ray.direction);
+		inline bool HitTest_Triangle(const TriangleRecord& record, TriangleCullMode cullMode, const Ray& ray, HitCandidate& candidate)
+		{
+			return HitTest_Triangle(record.v0, record.edge1, record.edge2, record.normal, cullMode, ray, candidate);
+		}
+
+		inline void FillHitRecord_Triangle(const Triangle& triangle, const Ray& ray, const HitCandidate& candidate, HitRecord& hitRecord)
+		{
+			hitRecord.origin = ray.origin + (candidate.t * ray.direction);
 			hitRecord.normal = triangle.normal;
 			hitRecord.didHit = true;
 			hitRecord.materialIndex = triangle.materialIndex;
-			hitRecord.t = t;
+			hitRecord.t = candidate.t;
+		}
+
+		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			HitCandidate candidate{};
+			if (!HitTest_Triangle(triangle, ray, candidate))
+				return false;
+
+			if (!ignoreHitRecord)
+				FillHitRecord_Triangle(triangle, ray, candidate, hitRecord);
 
 			return true;
 		}
 
 		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Triangle(triangle, ray, temp, true);
+			HitCandidate temp{};
+			return HitTest_Triangle(triangle, ray, temp);
+		}
+
+		// Same test without a stored normal, the winding of the vertices decides which side faces the ray
+		inline bool HitTest_Triangle(const Vector3& vertex0, const Vector3& vertex1, const Vector3& vertex2, TriangleCullMode cullMode,
+			const Ray& ray, HitCandidate& candidate)
+		{
+			RENDER_STATS_ADD(triangleTests, 1);
+
+			constexpr float EPSILON = 0.0000001f;
+
+			const Vector3 edge1 = vertex1 - vertex0;
+			const Vector3 edge2 = vertex2 - vertex0;
+			const Vector3 h = Vector3::Cross(ray.direction, edge2);
+
+			// Negative when the ray looks at the back of the triangle (normal = edge1 x edge2)
+			const float a = Vector3::Dot(edge1, h);
+
+			if (cullMode == TriangleCullMode::BackFaceCulling && a < EPSILON)
+				return false;
+
+			if (cullMode == TriangleCullMode::FrontFaceCulling && a > -EPSILON)
+				return false;
+
+			if (a > -EPSILON && a < EPSILON)
+				return false; // parallel to triangle
+
+			const float f = 1.0f / a;
+			const Vector3 s = ray.origin - vertex0;
+			const float u = f * Vector3::Dot(s, h);
+
+			if (u < 0.0f || u > 1.0f)
+				return false;
+
+			const Vector3 q = Vector3::Cross(s, edge1);
+			const float v = f * Vector3::Dot(ray.direction, q);
+
+			if (v < 0.0f || (u + v) > 1.0f)
+				return false;
+
+			const float t = f * Vector3::Dot(edge2, q);
+
+			if (t < ray.min || t > ray.max)
+				return false;
+
+			candidate.t = t;
+			return true;
 		}
 #pragma endregion
 #pragma region TriangeMesh HitTest
 
 		inline bool SlabTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
 		{
+			RENDER_STATS_ADD(aabbTests, 1);
+
 			float tx1 = (mesh.transformedMinAABB.x - ray.origin.x) / ray.direction.x;
 			float tx2 = (mesh.transformedMaxAABB.x - ray.origin.x) / ray.direction.x;
 
@@ -182,65 +293,592 @@ namespace dae
 			return tmax > 0 && tmax >= tmin;
 		}
 
-		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false, bool usingMoller = true)
+		inline bool SlabTest_AABB(const Vector3& minAABB, const Vector3& maxAABB, const Ray& ray, const Vector3& inverseDirection, float& tEntry)
 		{
-			if (!SlabTest_TriangleMesh(mesh, ray))
+			RENDER_STATS_ADD(aabbTests, 1);
+
+			const float tx1 = (minAABB.x - ray.origin.x) * inverseDirection.x;
+			const float tx2 = (maxAABB.x - ray.origin.x) * inverseDirection.x;
+
+			float tmin = std::min(tx1, tx2);
+			float tmax = std::max(tx1, tx2);
+
+			const float ty1 = (minAABB.y - ray.origin.y) * inverseDirection.y;
+			const float ty2 = (maxAABB.y - ray.origin.y) * inverseDirection.y;
+
+			tmin = std::max(tmin, std::min(ty1, ty2));
+			tmax = std::min(tmax, std::max(ty1, ty2));
+
+			const float tz1 = (minAABB.z - ray.origin.z) * inverseDirection.z;
+			const float tz2 = (maxAABB.z - ray.origin.z) * inverseDirection.z;
+
+			tmin = std::max(tmin, std::min(tz1, tz2));
+			tmax = std::min(tmax, std::max(tz1, tz2));
+
+			tEntry = tmin;
+			return tmax >= std::max(tmin, ray.min) && tmin <= ray.max;
+		}
+
+		// Meshes report the index of the triangle they hit, FillHitRecord_TriangleMesh looks its normal up afterwards.
+		// anyHit returns the first hit found instead of the closest one
+		inline bool HitTest_TriangleMesh_Linear(const TriangleMesh& mesh, const Ray& ray, HitCandidate& candidate, bool anyHit = false)
+		{
+			HitCandidate closest{};
+			HitCandidate record{};
+
+			for (const TriangleRecord& triangle : mesh.triangleRecords)
 			{
+				if (!HitTest_Triangle(triangle, mesh.cullMode, ray, record))
+					continue;
+
+				if (anyHit)
+				{
+					candidate = HitCandidate{ record.t, triangle.triangleIndex };
+					return true;
+				}
+
+				if (record.t < closest.t)
+					closest = HitCandidate{ record.t, triangle.triangleIndex };
+			}
+
+			if (closest.primitiveIndex == HitCandidate::InvalidPrimitive)
+				return false;
+
+			candidate = closest;
+			return true;
+		}
+
+		/**
+		 * \brief Visits the leaves of a bvh front to back
+		 * \param ray ray to trace, onLeaf shrinks ray.max when it finds a closer hit so farther nodes get culled
+		 * \param onLeaf bool(uint32_t first, uint32_t count), the range of the leaf in the primitive index list,
+		 * returning true stops the traversal
+		 * \return true when onLeaf stopped the traversal
+		 */
+		template <typename LeafFunction>
+		bool TraverseBVHLeaves(const BVH& bvh, Ray& ray, LeafFunction&& onLeaf)
+		{
+			const std::vector<BVHNode>& nodes = bvh.GetNodes();
+
+			if (nodes.empty())
 				return false;
+
+			const Vector3 inverseDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+			float tEntry{};
+			if (!SlabTest_AABB(nodes[0].minAABB, nodes[0].maxAABB, ray, inverseDirection, tEntry))
+				return false;
+
+			uint32_t nodeStack[BVH::MaxDepth + 1];
+			float entryStack[BVH::MaxDepth + 1];
+			uint32_t stackSize{};
+
+			nodeStack[stackSize] = 0;
+			entryStack[stackSize++] = tEntry;
+
+			while (stackSize > 0)
+			{
+				--stackSize;
+				if (entryStack[stackSize] > ray.max)
+					continue;
+
+				const BVHNode& node = nodes[nodeStack[stackSize]];
+				RENDER_STATS_ADD(nodeVisits, 1);
+
+				if (node.IsLeaf())
+				{
+					if (onLeaf(node.leftFirst, node.primitiveCount))
+						return true;
+
+					continue;
+				}
+
+				float tLeft{}, tRight{};
+				const BVHNode& left = nodes[node.leftFirst];
+				const BVHNode& right = nodes[node.leftFirst + 1];
+				const bool hitLeft = SlabTest_AABB(left.minAABB, left.maxAABB, ray, inverseDirection, tLeft);
+				const bool hitRight = SlabTest_AABB(right.minAABB, right.maxAABB, ray, inverseDirection, tRight);
+
+				// Push the far child first so the near child is visited first
+				if (hitLeft && hitRight)
+				{
+					const bool leftIsNear = tLeft <= tRight;
+
+					nodeStack[stackSize] = leftIsNear ? node.leftFirst + 1 : node.leftFirst;
+					entryStack[stackSize++] = leftIsNear ? tRight : tLeft;
+					nodeStack[stackSize] = leftIsNear ? node.leftFirst : node.leftFirst + 1;
+					entryStack[stackSize++] = leftIsNear ? tLeft : tRight;
+				}
+				else if (hitLeft)
+				{
+					nodeStack[stackSize] = node.leftFirst;
+					entryStack[stackSize++] = tLeft;
+				}
+				else if (hitRight)
+				{
+					nodeStack[stackSize] = node.leftFirst + 1;
+					entryStack[stackSize++] = tRight;
+				}
 			}
 
-			Triangle triangle{};
-			int normalCounter{};
-			HitRecord record{};
+			return false;
+		}
+
+		/**
+		 * \brief Visits the leaves of a WideBVH or a CompactBVH, same contract as TraverseBVHLeaves.
+		 * The children of a node are ordered by the signs of the ray direction instead of by their entry distance
+		 */
+		template <typename Tree, typename LeafFunction>
+		bool TraverseWideBVHLeaves(const Tree& bvh, Ray& ray, LeafFunction&& onLeaf)
+		{
+			using Node = typename Tree::Node;
+			constexpr uint32_t width{ static_cast<uint32_t>(std::extent_v<decltype(Node::children)>) };
+
+			const std::vector<Node>& nodes = bvh.GetNodes();
+
+			if (nodes.empty())
+				return false;
+
+			const Vector3 inverseDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+			const uint32_t isNegative[3]{ ray.direction.x < 0.f, ray.direction.y < 0.f, ray.direction.z < 0.f };
+
+			// Nodes and leaves share the stack, a leaf is visited when it is popped so it stays in order with the nodes.
+			// The root has no bounds of its own, the mesh slab test already covers it
+			uint32_t childStack[Tree::MaxStackSize];
+			float entryStack[Tree::MaxStackSize];
+			uint32_t stackSize{};
 
-			int vertexCount{};
-			int normalCount{};
+			childStack[stackSize] = 0;
+			entryStack[stackSize++] = ray.min;
 
-			for (int index{}; index < mesh.indices.size(); index++)
+			alignas(32) float tEntries[width];
+
+			while (stackSize > 0)
 			{
-				vertexCount++;
+				--stackSize;
+				if (entryStack[stackSize] > ray.max)
+					continue;
+
+				const uint32_t child = childStack[stackSize];
+				RENDER_STATS_ADD(nodeVisits, 1);
 
-				if (vertexCount == 3)
+				if (Tree::IsLeaf(child))
 				{
-					triangle.normal = mesh.transformedNormals[normalCount];
-					triangle.v0 = mesh.transformedPositions[mesh.indices[index - 2]];
-					triangle.v1 = mesh.transformedPositions[mesh.indices[index - 1]];
-					triangle.v2 = mesh.transformedPositions[mesh.indices[index]];
+					const WideBVHLeaf leaf = bvh.GetLeaf(child);
+					if (onLeaf(leaf.first, leaf.count))
+						return true;
+
+					continue;
+				}
 
-					triangle.cullMode = mesh.cullMode;
-					triangle.materialIndex = mesh.materialIndex;
+				const Node& node = nodes[child];
+				RENDER_STATS_ADD(aabbTests, std::popcount(static_cast<uint32_t>(node.occupiedMask)));
 
-					vertexCount = 0;
-					normalCount++;
+				const uint32_t hitMask = Tree::IntersectChildren(node, ray.origin, inverseDirection, ray.min, ray.max, tEntries);
+				if (hitMask == 0)
+					continue;
 
-					bool hasHit = HitTest_Triangle(triangle, ray, hitRecord, ignoreHitRecord);
+				if (std::has_single_bit(hitMask))
+				{
+					const uint32_t slot = std::countr_zero(hitMask);
+					childStack[stackSize] = node.children[slot];
+					entryStack[stackSize++] = tEntries[slot];
+					continue;
+				}
+
+				// Push the far children first so the near ones are visited first
+				for (uint32_t order{ width }; order-- > 0;)
+				{
+					const uint32_t slot = WideBVH<width>::GetOrderedSlot(node.splitAxes, order, isNegative);
+					if ((hitMask & (1u << slot)) == 0)
+						continue;
 
-					if (hasHit && ignoreHitRecord)
-					{
+					childStack[stackSize] = node.children[slot];
+					entryStack[stackSize++] = tEntries[slot];
+				}
+			}
+
+			return false;
+		}
+
+		// Leaves of the bvh the traversal of the mesh asks for, same contract as TraverseBVHLeaves
+		template <typename LeafFunction>
+		bool TraverseMeshBVHLeaves(const TriangleMesh& mesh, Ray& ray, LeafFunction&& onLeaf)
+		{
+			if (mesh.traversal == MeshTraversal::Compact && mesh.compactBVH.IsBuilt())
+				return TraverseWideBVHLeaves(mesh.compactBVH, ray, onLeaf);
+
+			if (mesh.traversal == MeshTraversal::BVH4 && mesh.bvh4.IsBuilt())
+				return TraverseWideBVHLeaves(mesh.bvh4, ray, onLeaf);
+
+			if (mesh.traversal == MeshTraversal::BVH8 && mesh.bvh8.IsBuilt())
+				return TraverseWideBVHLeaves(mesh.bvh8, ray, onLeaf);
+
+			return TraverseBVHLeaves(mesh.bvh, ray, onLeaf);
+		}
+
+		/**
+		 * \brief Visits the leaf primitives of a bvh front to back
+		 * \param ray ray to trace, onPrimitive shrinks ray.max when it finds a closer hit so farther nodes get culled
+		 * \param onPrimitive bool(uint32_t primitiveIndex), returning true stops the traversal
+		 * \return true when onPrimitive stopped the traversal
+		 */
+		template <typename PrimitiveFunction>
+		bool TraverseBVH(const BVH& bvh, Ray& ray, PrimitiveFunction&& onPrimitive)
+		{
+			const std::vector<uint32_t>& primitiveIndices = bvh.GetPrimitiveIndices();
+
+			return TraverseBVHLeaves(bvh, ray, [&](uint32_t first, uint32_t count)
+			{
+				for (uint32_t i{}; i < count; ++i)
+				{
+					if (onPrimitive(primitiveIndices[first + i]))
 						return true;
-					}
+				}
+
+				return false;
+			});
+		}
 
+		inline bool HitTest_TriangleMesh_BVH(const TriangleMesh& mesh, const Ray& ray, HitCandidate& candidate, bool anyHit = false)
+		{
+			// Baked in leaf order, a leaf is a contiguous range of records
+			assert(mesh.triangleRecords.size() == mesh.bvh.GetPrimitiveIndices().size());
+			const TriangleRecord* pRecords = mesh.triangleRecords.data();
+
+			// Every closer hit shrinks the ray, so nodes and triangles behind it get culled
+			Ray closestRay{ ray };
+			HitCandidate closest{};
+
+			TraverseMeshBVHLeaves(mesh, closestRay, [&](uint32_t first, uint32_t count)
+			{
+				for (const TriangleRecord* pTriangle{ pRecords + first }; pTriangle != pRecords + first + count; ++pTriangle)
+				{
+					if (!HitTest_Triangle(*pTriangle, mesh.cullMode, closestRay, closest))
+						continue;
 
-					if (hitRecord.t < record.t && hasHit)
-					{
-						record = hitRecord;
-					}
+					closest.primitiveIndex = pTriangle->triangleIndex;
+					closestRay.max = closest.t;
+					if (anyHit)
+						return true;
 				}
+
+				return false;
+			});
+
+			if (closest.primitiveIndex == HitCandidate::InvalidPrimitive)
+				return false;
+
+			candidate = closest;
+			return true;
+		}
+
+		// Reads the triangles packed in the compact bvh, the primitive index list is only looked at for the closest hit
+		inline bool HitTest_TriangleMesh_Compact(const TriangleMesh& mesh, const Ray& ray, HitCandidate& candidate, bool anyHit = false)
+		{
+			const std::vector<Vector3>& positions = mesh.isInstanced ? mesh.positions : mesh.transformedPositions;
+			const CompactBVH& compactBVH = mesh.compactBVH;
+
+			Ray closestRay{ ray };
+			HitCandidate closest{};
+			// Position of the closest hit in leaf order
+			uint32_t hitPosition{ HitCandidate::InvalidPrimitive };
+
+			TraverseWideBVHLeaves(compactBVH, closestRay, [&](uint32_t first, uint32_t count)
+			{
+				for (uint32_t position{ first }; position < first + count; ++position)
+				{
+					const Vector3& v0 = positions[compactBVH.GetVertexIndex(position, 0)];
+					const Vector3& v1 = positions[compactBVH.GetVertexIndex(position, 1)];
+					const Vector3& v2 = positions[compactBVH.GetVertexIndex(position, 2)];
+
+					if (!HitTest_Triangle(v0, v1, v2, mesh.cullMode, closestRay, closest))
+						continue;
+
+					hitPosition = position;
+					closestRay.max = closest.t;
+					if (anyHit)
+						return true;
+				}
+
+				return false;
+			});
+
+			if (hitPosition == HitCandidate::InvalidPrimitive)
+				return false;
+
+			candidate = HitCandidate{ closest.t, mesh.bvh.GetPrimitiveIndices()[hitPosition] };
+			return true;
+		}
+
+		inline bool HitTest_TriangleMesh_Packed(const TriangleMesh& mesh, const Ray& ray, HitCandidate& candidate, bool anyHit = false)
+		{
+			const PackedTriangles& packedTriangles = mesh.packedTriangles;
+
+			uint32_t hitLane{ PackedTriangles::InvalidLane };
+			float hitT{ ray.max };
+
+			// Lanes are in leaf order, so every leaf is one call into the kernel
+			const auto intersectLanes = [&](uint32_t first, uint32_t count)
+			{
+				RENDER_STATS_ADD(triangleTests, count);
+
+				const uint32_t lane = packedTriangles.Intersect(mesh.triangleKernel, first, count, ray.origin, ray.direction, ray.min, hitT, anyHit);
+				if (lane == PackedTriangles::InvalidLane)
+					return false;
+
+				hitLane = lane;
+				return anyHit;
+			};
+
+			if (mesh.traversal != MeshTraversal::Linear && mesh.bvh.IsBuilt())
+			{
+				Ray closestRay{ ray };
+				TraverseMeshBVHLeaves(mesh, closestRay, [&](uint32_t first, uint32_t count)
+				{
+					const bool stop = intersectLanes(first, count);
+					closestRay.max = hitT;
+					return stop;
+				});
 			}
+			else
+			{
+				intersectLanes(0, packedTriangles.GetTriangleCount());
+			}
+
+			if (hitLane == PackedTriangles::InvalidLane)
+				return false;
+
+			candidate = HitCandidate{ hitT, packedTriangles.GetTriangleIndex(hitLane) };
+			return true;
+		}
+
+		// Ray is in the space of the mesh vertices (object space when instanced)
+		inline bool HitTest_TriangleMesh_Triangles(const TriangleMesh& mesh, const Ray& ray, HitCandidate& candidate, bool anyHit = false)
+		{
+			if (mesh.triangleKernel != TriangleKernel::Scalar && mesh.packedTriangles.IsPacked())
+				return HitTest_TriangleMesh_Packed(mesh, ray, candidate, anyHit);
+
+			if (mesh.traversal == MeshTraversal::Compact && mesh.compactBVH.IsBuilt())
+				return HitTest_TriangleMesh_Compact(mesh, ray, candidate, anyHit);
 
-			if (record.didHit)
+			const bool useBVH = mesh.traversal != MeshTraversal::Linear && mesh.bvh.IsBuilt();
+
+			return useBVH ? HitTest_TriangleMesh_BVH(mesh, ray, candidate, anyHit)
+				: HitTest_TriangleMesh_Linear(mesh, ray, candidate, anyHit);
+		}
+
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitCandidate& candidate, bool anyHit = false)
+		{
+			if (!SlabTest_TriangleMesh(mesh, ray))
 			{
-				hitRecord = record;
-				return true;
+				return false;
 			}
 
-			return false;
+			if (!mesh.isInstanced)
+				return HitTest_TriangleMesh_Triangles(mesh, ray, candidate, anyHit);
+
+			// The direction is not normalized again so t stays the same in both spaces
+			Ray objectRay{ ray };
+			objectRay.origin = mesh.inverseTransform.TransformPoint(ray.origin);
+			objectRay.direction = mesh.inverseTransform.TransformVector(ray.direction);
+
+			return HitTest_TriangleMesh_Triangles(mesh, objectRay, candidate, anyHit);
+		}
+
+		// Ray in world space, the one the candidate was found with
+		inline void FillHitRecord_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, const HitCandidate& candidate, HitRecord& hitRecord)
+		{
+			hitRecord.origin = ray.origin + candidate.t * ray.direction;
+			hitRecord.normal = mesh.isInstanced ? mesh.rotationTransform.TransformVector(mesh.normals[candidate.primitiveIndex])
+				: mesh.transformedNormals[candidate.primitiveIndex];
+			hitRecord.didHit = true;
+			hitRecord.materialIndex = mesh.materialIndex;
+			hitRecord.t = candidate.t;
+		}
+
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false, bool usingMoller = true)
+		{
+			HitCandidate candidate{};
+			if (!HitTest_TriangleMesh(mesh, ray, candidate, ignoreHitRecord))
+				return false;
+
+			if (!ignoreHitRecord)
+				FillHitRecord_TriangleMesh(mesh, ray, candidate, hitRecord);
+
+			return true;
 		}
 
 		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, bool usingMoller = true)
 		{
-			HitRecord temp{};
-			return HitTest_TriangleMesh(mesh, ray, temp, true, usingMoller);
+			HitCandidate temp{};
+			return HitTest_TriangleMesh(mesh, ray, temp, true);
+		}
+#pragma endregion
+#pragma region Occlusion HitTest
+		//OCCLUSION TESTS
+		//Is anything between ray.min and ray.max, no hit record is filled in and nothing past the answer is computed
+		inline bool Occludes_Sphere(const Sphere& sphere, const Ray& ray)
+		{
+			RENDER_STATS_ADD(sphereTests, 1);
+
+			const Vector3 rayOriginToSphere{ sphere.origin - ray.origin };
+			const float projectedLength = Vector3::Dot(rayOriginToSphere, ray.direction);
+			const float distanceSquared = rayOriginToSphere.SqrMagnitude() - projectedLength * projectedLength;
+			const float radiusSquared = sphere.radius * sphere.radius;
+
+			if (distanceSquared > radiusSquared)
+				return false;
+
+			const float t = projectedLength - std::sqrtf(radiusSquared - distanceSquared);
+			return t >= ray.min && t <= ray.max;
+		}
+
+		inline bool Occludes_Plane(const Plane& plane, const Ray& ray)
+		{
+			RENDER_STATS_ADD(planeTests, 1);
+
+			const float t = Vector3::Dot(Vector3{ ray.origin, plane.origin }, plane.normal) / Vector3::Dot(ray.direction, plane.normal);
+			return t >= ray.min && t <= ray.max;
+		}
+
+		inline bool Occludes_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
+		{
+			// Stops at the first triangle it hits, whichever that is
+			HitCandidate unusedCandidate{};
+			return HitTest_TriangleMesh(mesh, ray, unusedCandidate, true);
+		}
+#pragma endregion
+#pragma region Packet HitTest
+		//PACKET HIT-TESTS
+		//A lane takes a hit when it is closer than the candidate it already has, returns the mask of lanes that did
+		inline uint32_t HitTest_Sphere(const Sphere& sphere, const RayPacket& packet, HitCandidate (&candidates)[RayPacket::Size])
+		{
+			RENDER_STATS_ADD(sphereTests, std::popcount(packet.activeMask));
+
+			// Every ray starts at the same origin, so only the projection differs per lane
+			const Vector3 rayOriginToSphere{ sphere.origin - packet.origin };
+			const float sphereDistanceSquared = rayOriginToSphere.SqrMagnitude();
+			const float radiusSquared = sphere.radius * sphere.radius;
+
+			const __m128 projectedLength = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(_mm_set1_ps(rayOriginToSphere.x), _mm_load_ps(packet.directionX)),
+				_mm_mul_ps(_mm_set1_ps(rayOriginToSphere.y), _mm_load_ps(packet.directionY))),
+				_mm_mul_ps(_mm_set1_ps(rayOriginToSphere.z), _mm_load_ps(packet.directionZ)));
+
+			const __m128 distanceSquared = _mm_sub_ps(_mm_set1_ps(sphereDistanceSquared), _mm_mul_ps(projectedLength, projectedLength));
+			const __m128 t = _mm_sub_ps(projectedLength, _mm_sqrt_ps(_mm_sub_ps(_mm_set1_ps(radiusSquared), distanceSquared)));
+
+			const __m128 closestT = _mm_setr_ps(candidates[0].t, candidates[1].t, candidates[2].t, candidates[3].t);
+			__m128 hasHit = _mm_cmple_ps(distanceSquared, _mm_set1_ps(radiusSquared));
+			hasHit = _mm_and_ps(hasHit, _mm_and_ps(_mm_cmpge_ps(t, _mm_set1_ps(packet.min)), _mm_cmplt_ps(t, closestT)));
+
+			const uint32_t hitMask = static_cast<uint32_t>(_mm_movemask_ps(hasHit)) & packet.activeMask;
+			if (hitMask == 0)
+				return 0;
+
+			alignas(16) float hitT[RayPacket::Size];
+			_mm_store_ps(hitT, t);
+
+			for (uint32_t lane{}; lane < RayPacket::Size; ++lane)
+			{
+				if ((hitMask & (1u << lane)) == 0)
+					continue;
+
+				candidates[lane] = HitCandidate{ hitT[lane] };
+			}
+
+			return hitMask;
+		}
+
+		inline uint32_t HitTest_Plane(const Plane& plane, const RayPacket& packet, HitCandidate (&candidates)[RayPacket::Size])
+		{
+			RENDER_STATS_ADD(planeTests, std::popcount(packet.activeMask));
+
+			const float originDistance = Vector3::Dot(Vector3{ packet.origin, plane.origin }, plane.normal);
+
+			const __m128 normalDirectionDot = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(_mm_load_ps(packet.directionX), _mm_set1_ps(plane.normal.x)),
+				_mm_mul_ps(_mm_load_ps(packet.directionY), _mm_set1_ps(plane.normal.y))),
+				_mm_mul_ps(_mm_load_ps(packet.directionZ), _mm_set1_ps(plane.normal.z)));
+
+			const __m128 t = _mm_div_ps(_mm_set1_ps(originDistance), normalDirectionDot);
+
+			const __m128 closestT = _mm_setr_ps(candidates[0].t, candidates[1].t, candidates[2].t, candidates[3].t);
+			const __m128 hasHit = _mm_and_ps(_mm_cmpge_ps(t, _mm_set1_ps(packet.min)), _mm_cmplt_ps(t, closestT));
+
+			const uint32_t hitMask = static_cast<uint32_t>(_mm_movemask_ps(hasHit)) & packet.activeMask;
+			if (hitMask == 0)
+				return 0;
+
+			alignas(16) float hitT[RayPacket::Size];
+			_mm_store_ps(hitT, t);
+
+			for (uint32_t lane{}; lane < RayPacket::Size; ++lane)
+			{
+				if ((hitMask & (1u << lane)) == 0)
+					continue;
+
+				candidates[lane] = HitCandidate{ hitT[lane] };
+			}
+
+			return hitMask;
+		}
+
+		// Mask of the lanes that pass the bounds of the mesh, no lane the single ray test accepts gets rejected
+		inline uint32_t SlabTest_TriangleMesh(const TriangleMesh& mesh, const RayPacket& packet)
+		{
+			RENDER_STATS_ADD(aabbTests, std::popcount(packet.activeMask));
+
+			const __m128 directionX = _mm_load_ps(packet.directionX);
+			const __m128 directionY = _mm_load_ps(packet.directionY);
+			const __m128 directionZ = _mm_load_ps(packet.directionZ);
+
+			const __m128 tx1 = _mm_div_ps(_mm_set1_ps(mesh.transformedMinAABB.x - packet.origin.x), directionX);
+			const __m128 tx2 = _mm_div_ps(_mm_set1_ps(mesh.transformedMaxAABB.x - packet.origin.x), directionX);
+
+			__m128 tmin = _mm_min_ps(tx1, tx2);
+			__m128 tmax = _mm_max_ps(tx1, tx2);
+
+			const __m128 ty1 = _mm_div_ps(_mm_set1_ps(mesh.transformedMinAABB.y - packet.origin.y), directionY);
+			const __m128 ty2 = _mm_div_ps(_mm_set1_ps(mesh.transformedMaxAABB.y - packet.origin.y), directionY);
+
+			tmin = _mm_max_ps(tmin, _mm_min_ps(ty1, ty2));
+			tmax = _mm_min_ps(tmax, _mm_max_ps(ty1, ty2));
+
+			const __m128 tz1 = _mm_div_ps(_mm_set1_ps(mesh.transformedMinAABB.z - packet.origin.z), directionZ);
+			const __m128 tz2 = _mm_div_ps(_mm_set1_ps(mesh.transformedMaxAABB.z - packet.origin.z), directionZ);
+
+			tmin = _mm_max_ps(tmin, _mm_min_ps(tz1, tz2));
+			tmax = _mm_min_ps(tmax, _mm_max_ps(tz1, tz2));
+
+			// Rejecting instead of accepting lets lanes with a NaN through
+			const __m128 isMiss = _mm_or_ps(_mm_cmple_ps(tmax, _mm_setzero_ps()), _mm_cmplt_ps(tmax, tmin));
+			return ~static_cast<uint32_t>(_mm_movemask_ps(isMiss)) & packet.activeMask;
+		}
+
+		inline uint32_t HitTest_TriangleMesh(const TriangleMesh& mesh, const RayPacket& packet, HitCandidate (&candidates)[RayPacket::Size])
+		{
+			const uint32_t boundsMask = SlabTest_TriangleMesh(mesh, packet);
+			uint32_t hitMask{};
+
+			// Triangles are traced per lane, only the rays that reach the bounds get that far
+			for (uint32_t lane{}; lane < RayPacket::Size; ++lane)
+			{
+				if ((boundsMask & (1u << lane)) == 0)
+					continue;
+
+				const Ray ray{ packet.origin, packet.GetDirection(lane), packet.min, candidates[lane].t };
+
+				HitCandidate candidate{};
+				if (HitTest_TriangleMesh(mesh, ray, candidate) && candidate.t < candidates[lane].t)
+				{
+					candidates[lane] = candidate;
+					hitMask |= 1u << lane;
+				}
+			}
+
+			return hitMask;
 		}
 #pragma endregion
 	}
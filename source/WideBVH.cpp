@@ -0,0 +1,280 @@
+#include "WideBVH.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "PackedTriangles.h"
+#include "Simd.h"
+
+namespace dae
+{
+	namespace
+	{
+#ifdef SIMD_X86
+		// 4 children, the streams of a node are 16 byte aligned
+		uint32_t IntersectChildrenSSE(const float* pMinX, const float* pMinY, const float* pMinZ,
+			const float* pMaxX, const float* pMaxY, const float* pMaxZ,
+			const Vector3& origin, const Vector3& inverseDirection, float tMin, float tMax, float* pEntries)
+		{
+			const __m128 originX = _mm_set1_ps(origin.x);
+			const __m128 originY = _mm_set1_ps(origin.y);
+			const __m128 originZ = _mm_set1_ps(origin.z);
+			const __m128 inverseDirectionX = _mm_set1_ps(inverseDirection.x);
+			const __m128 inverseDirectionY = _mm_set1_ps(inverseDirection.y);
+			const __m128 inverseDirectionZ = _mm_set1_ps(inverseDirection.z);
+
+			const __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(pMinX), originX), inverseDirectionX);
+			const __m128 tx2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(pMaxX), originX), inverseDirectionX);
+			const __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(pMinY), originY), inverseDirectionY);
+			const __m128 ty2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(pMaxY), originY), inverseDirectionY);
+			const __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(pMinZ), originZ), inverseDirectionZ);
+			const __m128 tz2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(pMaxZ), originZ), inverseDirectionZ);
+
+			const __m128 entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_min_ps(tz1, tz2));
+			const __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_max_ps(tz1, tz2));
+
+			// Same rule as GeometryUtils::SlabTest_AABB
+			const __m128 isHit = _mm_and_ps(_mm_cmpge_ps(exit, _mm_max_ps(entry, _mm_set1_ps(tMin))), _mm_cmple_ps(entry, _mm_set1_ps(tMax)));
+
+			_mm_store_ps(pEntries, entry);
+			return static_cast<uint32_t>(_mm_movemask_ps(isHit));
+		}
+
+		TARGET_AVX uint32_t IntersectChildrenAVX(const WideBVHNode<8>& node,
+			const Vector3& origin, const Vector3& inverseDirection, float tMin, float tMax, float* pEntries)
+		{
+			const __m256 originX = _mm256_set1_ps(origin.x);
+			const __m256 originY = _mm256_set1_ps(origin.y);
+			const __m256 originZ = _mm256_set1_ps(origin.z);
+			const __m256 inverseDirectionX = _mm256_set1_ps(inverseDirection.x);
+			const __m256 inverseDirectionY = _mm256_set1_ps(inverseDirection.y);
+			const __m256 inverseDirectionZ = _mm256_set1_ps(inverseDirection.z);
+
+			const __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minX), originX), inverseDirectionX);
+			const __m256 tx2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxX), originX), inverseDirectionX);
+			const __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minY), originY), inverseDirectionY);
+			const __m256 ty2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxY), originY), inverseDirectionY);
+			const __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minZ), originZ), inverseDirectionZ);
+			const __m256 tz2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxZ), originZ), inverseDirectionZ);
+
+			const __m256 entry = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)), _mm256_min_ps(tz1, tz2));
+			const __m256 exit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)), _mm256_max_ps(tz1, tz2));
+
+			const __m256 isHit = _mm256_and_ps(_mm256_cmp_ps(exit, _mm256_max_ps(entry, _mm256_set1_ps(tMin)), _CMP_GE_OQ),
+				_mm256_cmp_ps(entry, _mm256_set1_ps(tMax), _CMP_LE_OQ));
+
+			_mm256_store_ps(pEntries, entry);
+			return static_cast<uint32_t>(_mm256_movemask_ps(isHit));
+		}
+#else
+		uint32_t IntersectChildrenScalar(const float* pMinX, const float* pMinY, const float* pMinZ,
+			const float* pMaxX, const float* pMaxY, const float* pMaxZ, uint32_t count,
+			const Vector3& origin, const Vector3& inverseDirection, float tMin, float tMax, float* pEntries)
+		{
+			uint32_t hitMask{};
+			for (uint32_t i{}; i < count; ++i)
+			{
+				const float tx1 = (pMinX[i] - origin.x) * inverseDirection.x;
+				const float tx2 = (pMaxX[i] - origin.x) * inverseDirection.x;
+				const float ty1 = (pMinY[i] - origin.y) * inverseDirection.y;
+				const float ty2 = (pMaxY[i] - origin.y) * inverseDirection.y;
+				const float tz1 = (pMinZ[i] - origin.z) * inverseDirection.z;
+				const float tz2 = (pMaxZ[i] - origin.z) * inverseDirection.z;
+
+				const float entry = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2));
+				const float exit = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2));
+
+				pEntries[i] = entry;
+				if (exit >= std::max(entry, tMin) && entry <= tMax)
+					hitMask |= 1u << i;
+			}
+
+			return hitMask;
+		}
+#endif
+	}
+
+	template <uint32_t Width>
+	uint32_t CollapseBinaryLevels(const std::vector<BVHNode>& binaryNodes, uint32_t binaryIndex, uint32_t (&slots)[Width])
+	{
+		constexpr uint32_t EmptySlot{ WideBVHNode<Width>::EmptySlot };
+
+		// 1 based, the slots are heap[Width, 2 * Width)
+		uint32_t heap[2 * Width];
+		std::fill(std::begin(heap), std::end(heap), EmptySlot);
+		heap[1] = binaryIndex;
+
+		uint32_t splitAxes{};
+		for (uint32_t position{ 1 }; position < Width; ++position)
+		{
+			if (heap[position] == EmptySlot)
+				continue;
+
+			const BVHNode& binaryNode = binaryNodes[heap[position]];
+			if (binaryNode.IsLeaf())
+			{
+				heap[position * 2] = heap[position];
+				continue;
+			}
+
+			const uint32_t leftIndex = binaryNode.leftFirst;
+			const uint32_t rightIndex = binaryNode.leftFirst + 1;
+			const BVHNode& left = binaryNodes[leftIndex];
+			const BVHNode& right = binaryNodes[rightIndex];
+
+			// The binary tree does not keep its split axes, the axis the children are furthest apart on stands in for it
+			const Vector3 offset = (right.minAABB + right.maxAABB) - (left.minAABB + left.maxAABB);
+			int axis{};
+			for (int a{ 1 }; a < 3; ++a)
+			{
+				if (std::abs(offset[a]) > std::abs(offset[axis]))
+					axis = a;
+			}
+
+			const bool isLeftLower = offset[axis] >= 0.f;
+			heap[position * 2] = isLeftLower ? leftIndex : rightIndex;
+			heap[position * 2 + 1] = isLeftLower ? rightIndex : leftIndex;
+			splitAxes |= static_cast<uint32_t>(axis) << (2 * (position - 1));
+		}
+
+		std::copy(heap + Width, heap + 2 * Width, slots);
+		return splitAxes;
+	}
+
+	template <uint32_t Width>
+	void WideBVH<Width>::Build(const BVH& bvh)
+	{
+		Clear();
+
+		const std::vector<BVHNode>& binaryNodes = bvh.GetNodes();
+		if (binaryNodes.empty())
+			return;
+
+		// Every node takes the place of at least one binary node with 2 children
+		m_Nodes.reserve(binaryNodes.size() / 2 + 1);
+		m_Leaves.reserve(binaryNodes.size() / 2 + 1);
+		m_BinarySlots.reserve((binaryNodes.size() / 2 + 1) * Width);
+
+		CollapseNode(binaryNodes, 0);
+	}
+
+	template <uint32_t Width>
+	void WideBVH<Width>::Refit(const BVH& bvh)
+	{
+		const std::vector<BVHNode>& binaryNodes = bvh.GetNodes();
+
+		for (size_t nodeIndex{}; nodeIndex < m_Nodes.size(); ++nodeIndex)
+		{
+			Node& node = m_Nodes[nodeIndex];
+			const uint32_t* pSlots = m_BinarySlots.data() + nodeIndex * Width;
+
+			for (uint32_t slot{}; slot < Width; ++slot)
+			{
+				if (pSlots[slot] == Node::EmptySlot)
+					continue;
+
+				const BVHNode& child = binaryNodes[pSlots[slot]];
+				node.minX[slot] = child.minAABB.x;
+				node.minY[slot] = child.minAABB.y;
+				node.minZ[slot] = child.minAABB.z;
+				node.maxX[slot] = child.maxAABB.x;
+				node.maxY[slot] = child.maxAABB.y;
+				node.maxZ[slot] = child.maxAABB.z;
+			}
+		}
+	}
+
+	template <uint32_t Width>
+	void WideBVH<Width>::Clear()
+	{
+		m_Nodes.clear();
+		m_Leaves.clear();
+		m_BinarySlots.clear();
+	}
+
+	template <uint32_t Width>
+	uint32_t WideBVH<Width>::IntersectChildren(const Node& node, const Vector3& origin, const Vector3& inverseDirection,
+		float tMin, float tMax, float (&tEntries)[Width])
+	{
+#ifdef SIMD_X86
+		if constexpr (Width == 8)
+		{
+			// Every cpu with AVX2 has AVX, the triangle kernels already check for it
+			static const bool hasAVX = IsTriangleKernelSupported(TriangleKernel::AVX2);
+			if (hasAVX)
+				return IntersectChildrenAVX(node, origin, inverseDirection, tMin, tMax, tEntries) & node.occupiedMask;
+		}
+
+		uint32_t hitMask{};
+		for (uint32_t first{}; first < Width; first += 4)
+		{
+			hitMask |= IntersectChildrenSSE(node.minX + first, node.minY + first, node.minZ + first,
+				node.maxX + first, node.maxY + first, node.maxZ + first,
+				origin, inverseDirection, tMin, tMax, tEntries + first) << first;
+		}
+#else
+		const uint32_t hitMask = IntersectChildrenScalar(node.minX, node.minY, node.minZ, node.maxX, node.maxY, node.maxZ, Width,
+			origin, inverseDirection, tMin, tMax, tEntries);
+#endif
+
+		return hitMask & node.occupiedMask;
+	}
+
+	template <uint32_t Width>
+	uint32_t WideBVH<Width>::CollapseNode(const std::vector<BVHNode>& binaryNodes, uint32_t binaryIndex)
+	{
+		uint32_t slots[Width];
+		const uint32_t splitAxes = CollapseBinaryLevels(binaryNodes, binaryIndex, slots);
+
+		// Filled in locally, collapsing the children below grows m_Nodes
+		Node node{};
+		constexpr float emptyBound{ std::numeric_limits<float>::infinity() };
+		std::fill(std::begin(node.minX), std::end(node.minX), emptyBound);
+		std::fill(std::begin(node.minY), std::end(node.minY), emptyBound);
+		std::fill(std::begin(node.minZ), std::end(node.minZ), emptyBound);
+		std::fill(std::begin(node.maxX), std::end(node.maxX), emptyBound);
+		std::fill(std::begin(node.maxY), std::end(node.maxY), emptyBound);
+		std::fill(std::begin(node.maxZ), std::end(node.maxZ), emptyBound);
+		std::fill(std::begin(node.children), std::end(node.children), Node::EmptySlot);
+		node.splitAxes = splitAxes;
+
+		const uint32_t nodeIndex = static_cast<uint32_t>(m_Nodes.size());
+		m_Nodes.emplace_back();
+		m_BinarySlots.insert(m_BinarySlots.end(), std::begin(slots), std::end(slots));
+
+		for (uint32_t slot{}; slot < Width; ++slot)
+		{
+			const uint32_t childIndex = slots[slot];
+			if (childIndex == Node::EmptySlot)
+				continue;
+
+			const BVHNode& child = binaryNodes[childIndex];
+			node.minX[slot] = child.minAABB.x;
+			node.minY[slot] = child.minAABB.y;
+			node.minZ[slot] = child.minAABB.z;
+			node.maxX[slot] = child.maxAABB.x;
+			node.maxY[slot] = child.maxAABB.y;
+			node.maxZ[slot] = child.maxAABB.z;
+			node.occupiedMask |= 1u << slot;
+
+			if (child.IsLeaf())
+			{
+				node.children[slot] = Node::LeafFlag | static_cast<uint32_t>(m_Leaves.size());
+				m_Leaves.push_back({ child.leftFirst, child.primitiveCount });
+			}
+			else
+			{
+				node.children[slot] = CollapseNode(binaryNodes, childIndex);
+			}
+		}
+
+		m_Nodes[nodeIndex] = node;
+		return nodeIndex;
+	}
+
+	template uint32_t CollapseBinaryLevels<4>(const std::vector<BVHNode>&, uint32_t, uint32_t (&)[4]);
+	template uint32_t CollapseBinaryLevels<8>(const std::vector<BVHNode>&, uint32_t, uint32_t (&)[8]);
+	template class WideBVH<4>;
+	template class WideBVH<8>;
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+#include "BVH.h"
+#include "Vector3.h"
+
+namespace dae
+{
+	/**
+	 * \brief Node of a WideBVH. The bounds of all children are stored per axis, so one simd slab test covers every child.
+	 * 4 wide it is 2 cache lines, 8 wide 4.
+	 */
+	template <uint32_t Width>
+	struct alignas(64) WideBVHNode
+	{
+		static constexpr uint32_t LeafFlag{ 0x80000000u };
+		static constexpr uint32_t EmptySlot{ UINT32_MAX };
+
+		float minX[Width];
+		float minY[Width];
+		float minZ[Width];
+		float maxX[Width];
+		float maxY[Width];
+		float maxZ[Width];
+
+		// Node index, LeafFlag | leaf index or EmptySlot
+		uint32_t children[Width];
+		// Bit per slot that holds a child
+		uint32_t occupiedMask;
+		// Axis of every binary split the node was collapsed from, 2 bits each in heap order (the top split first).
+		// The lower side of a split is in the lower slots
+		uint32_t splitAxes;
+	};
+
+	static_assert(sizeof(WideBVHNode<4>) == 128, "A 4 wide node should fill 2 cache lines");
+	static_assert(sizeof(WideBVHNode<8>) == 256, "An 8 wide node should fill 4 cache lines");
+
+	// Primitive range in the primitive index list of the binary bvh
+	struct WideBVHLeaf
+	{
+		uint32_t first{};
+		uint32_t count{};
+	};
+
+	/**
+	 * \brief Collapses the top log2(Width) levels of the binary subtree at binaryIndex into one wide node.
+	 * The levels form a complete tree in 1 based heap order with the slots as its last level,
+	 * a leaf above the last level moves down along the lower side and leaves the slots next to it empty
+	 * \param slots receives the binary node of every slot or WideBVHNode::EmptySlot
+	 * \return the split axes, see WideBVHNode::splitAxes
+	 */
+	template <uint32_t Width>
+	uint32_t CollapseBinaryLevels(const std::vector<BVHNode>& binaryNodes, uint32_t binaryIndex, uint32_t (&slots)[Width]);
+
+	/**
+	 * \brief BVH with 4 or 8 children per node, collapsed from a binary BVH.
+	 * Every node replaces log2(Width) levels of the binary tree, so a ray visits far fewer nodes
+	 * and tests the children of each with a single SSE (4 wide) or AVX (8 wide) slab test.
+	 */
+	template <uint32_t Width>
+	class WideBVH final
+	{
+	public:
+		static_assert(Width == 4 || Width == 8, "Only 4 and 8 wide nodes have a simd slab test");
+
+		using Node = WideBVHNode<Width>;
+
+		// Binary levels collapsed into one node
+		static constexpr uint32_t Levels{ std::countr_zero(Width) };
+		// Every node on the way down defers at most Width - 1 children
+		static constexpr uint32_t MaxStackSize{ (BVH::MaxDepth / Levels + 1) * (Width - 1) + 1 };
+
+		// Leaves keep the primitive ranges of bvh, whatever is stored in its leaf order (packed triangles) stays valid
+		void Build(const BVH& bvh);
+		// Copies the child bounds of bvh after it was refitted, its topology has to be the one it was built from
+		void Refit(const BVH& bvh);
+		void Clear();
+
+		bool IsBuilt() const { return !m_Nodes.empty(); }
+
+		const std::vector<Node>& GetNodes() const { return m_Nodes; }
+		const std::vector<WideBVHLeaf>& GetLeaves() const { return m_Leaves; }
+		// child is an entry of Node::children
+		static bool IsLeaf(uint32_t child) { return (child & Node::LeafFlag) != 0; }
+		WideBVHLeaf GetLeaf(uint32_t child) const { return m_Leaves[child & ~Node::LeafFlag]; }
+		// Bytes of the nodes and leaves, the primitive index list stays with the binary bvh
+		size_t GetMemoryUsage() const { return m_Nodes.size() * sizeof(Node) + m_Leaves.size() * sizeof(WideBVHLeaf); }
+
+		/**
+		 * \brief Slab tests a ray against every child of node
+		 * \param tEntries receives the distance the ray enters each child at
+		 * \return mask of the children the ray passes through between tMin and tMax
+		 */
+		static uint32_t IntersectChildren(const Node& node, const Vector3& origin, const Vector3& inverseDirection,
+			float tMin, float tMax, float (&tEntries)[Width]);
+
+		/**
+		 * \brief Slot a ray visits order-th. Both sides of a split are visited lower side first,
+		 * unless the ray goes down the axis of that split
+		 * \param isNegative per axis, 1 when the ray direction is negative along it
+		 */
+		static uint32_t GetOrderedSlot(uint32_t splitAxes, uint32_t order, const uint32_t (&isNegative)[3])
+		{
+			uint32_t position{ 1 };
+			for (uint32_t level{}; level < Levels; ++level)
+			{
+				const uint32_t axis = (splitAxes >> (2 * (position - 1))) & 3u;
+				const uint32_t side = ((order >> (Levels - 1 - level)) & 1u) ^ isNegative[axis];
+				position = position * 2 + side;
+			}
+
+			return position - Width;
+		}
+
+	private:
+		std::vector<Node> m_Nodes{};
+		std::vector<WideBVHLeaf> m_Leaves{};
+		// Binary node of every slot, Width per node, only Refit reads it
+		std::vector<uint32_t> m_BinarySlots{};
+
+		uint32_t CollapseNode(const std::vector<BVHNode>& binaryNodes, uint32_t binaryIndex);
+	};
+
+	extern template uint32_t CollapseBinaryLevels<4>(const std::vector<BVHNode>&, uint32_t, uint32_t (&)[4]);
+	extern template uint32_t CollapseBinaryLevels<8>(const std::vector<BVHNode>&, uint32_t, uint32_t (&)[8]);
+	extern template class WideBVH<4>;
+	extern template class WideBVH<8>;
+}
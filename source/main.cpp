@@ -6,32 +6,406 @@
 
 //Standard includes
 #include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
 
 //Project includes
 #include "Timer.h"
 #include "Renderer.h"
 #include "Scene.h"
+#include "Benchmark.h"
+#include "Profiler.h"
 
 using namespace dae;
 
+struct LaunchOptions
+{
+	bool isHeadless{ false };
+	bool isBenchmark{ false };
+	bool printStats{ false };
+	//Empty means the default scene, or every scene when benchmarking
+	std::string sceneName{};
+	uint32_t width{ 640 };
+	uint32_t height{ 480 };
+	//0 means the default: 1 frame headless, 60 frames per scene when benchmarking
+	uint32_t frameCount{ 0 };
+	std::string outputPath{ "RayTracing_Buffer.bmp" };
+	std::string reportPath{ "benchmark" };
+	uint32_t threadCount{ 0 };
+	uint32_t tileSize{ 16 };
+	uint32_t maxSampleCount{ 256 };
+	float errorThreshold{ 0.005f };
+	Renderer::HeatmapMode heatmapMode{ Renderer::HeatmapMode::Off };
+	//Empty keeps the traversal of the scene, a benchmark runs every scene once per traversal
+	std::vector<MeshTraversal> traversals{};
+	//Empty means no trace is written when a headless or benchmark run ends
+	std::string tracePath{};
+};
+
+void PrintUsage()
+{
+	std::cout << "Usage: RayTracer [--headless] [--benchmark] [--scene name[,name...]] [--width N] [--height N]\n"
+		<< "                 [--frames N] [--output file.bmp] [--report name] [--threads N] [--tile N]\n"
+		<< "                 [--max-samples N] [--error-threshold X] [--stats] [--heatmap nodes|triangles|time]\n"
+		<< "                 [--trace file.json] [--traversal linear|bvh|bvh4|bvh8|compact[,...]|all]\n"
+		<< "  --scene     W1, W2, W3, W4_Reference, W4_Bunny or the path of a .scene file, a comma separated list\n"
+		<< "              renders every scene in turn when headless or benchmarking\n"
+		<< "  --headless  render without a window and write every frame to --output\n"
+		<< "  --benchmark render every scene (or --scene) along a fixed camera path without a window\n"
+		<< "              and write <report>_<timestamp>.json/.csv\n"
+		<< "  --frames    frames to render, frame numbers are appended to --output when > 1\n"
+		<< "  --threads   render threads, 0 uses every hardware thread\n"
+		<< "  --max-samples      samples per pixel a still view accumulates at most\n"
+		<< "  --error-threshold  adaptive sampling stops a tile once its pixels are this close to converged\n"
+		<< "  --stats     print the ray and intersection counters of every frame, F1 toggles them in the window\n"
+		<< "  --heatmap   color pixels by bvh nodes visited, triangles tested or time spent instead of shading, H cycles it\n"
+		<< "  --trace     record from the start and write a Chrome trace of the last frames when a headless or benchmark run ends\n"
+		<< "              P starts recording in the window, pressing it again writes the trace\n"
+		<< "  --traversal mesh traversal to render with, F4 cycles it. A benchmark takes a comma separated list or all and runs every scene with each\n";
+}
+
+std::vector<std::string> SplitList(const std::string& list)
+{
+	std::vector<std::string> names{};
+
+	size_t start{};
+	while (start <= list.size())
+	{
+		const size_t end = std::min(list.find(',', start), list.size());
+		if (end > start)
+			names.push_back(list.substr(start, end - start));
+
+		start = end + 1;
+	}
+
+	return names;
+}
+
+bool ParseMeshTraversals(const std::string& value, std::vector<MeshTraversal>& traversals)
+{
+	const std::vector<MeshTraversal> allTraversals{ MeshTraversal::Linear, MeshTraversal::BVH, MeshTraversal::BVH4, MeshTraversal::BVH8,
+		MeshTraversal::Compact };
+	if (value == "all")
+	{
+		traversals = allTraversals;
+		return true;
+	}
+
+	traversals.clear();
+	for (const std::string& name : SplitList(value))
+	{
+		const auto it = std::find_if(allTraversals.begin(), allTraversals.end(), [&name](MeshTraversal traversal)
+		{
+			std::string traversalName{ GetMeshTraversalName(traversal) };
+			std::transform(traversalName.begin(), traversalName.end(), traversalName.begin(), [](char c) { return static_cast<char>(std::tolower(c)); });
+			return traversalName == name;
+		});
+
+		if (it == allTraversals.end())
+			return false;
+
+		traversals.push_back(*it);
+	}
+
+	return !traversals.empty();
+}
+
+bool ParseLaunchOptions(int argc, char* args[], LaunchOptions& options)
+{
+	for (int i{ 1 }; i < argc; ++i)
+	{
+		const std::string argument{ args[i] };
+
+		if (argument == "--headless")
+		{
+			options.isHeadless = true;
+			continue;
+		}
+
+		if (argument == "--benchmark")
+		{
+			options.isBenchmark = true;
+			continue;
+		}
+
+		if (argument == "--stats")
+		{
+			//Said once here instead of every frame
+			if (!RenderStatsEnabled)
+				std::cout << "--stats: unavailable, the counters are compiled out of this build (NO_RENDER_STATS)\n";
+
+			options.printStats = RenderStatsEnabled;
+			continue;
+		}
+
+		//Every other option takes a value
+		if (i + 1 >= argc)
+			return false;
+
+		const std::string value{ args[++i] };
+
+		try
+		{
+			if (argument == "--scene")
+				options.sceneName = value;
+			else if (argument == "--width")
+				options.width = std::stoul(value);
+			else if (argument == "--height")
+				options.height = std::stoul(value);
+			else if (argument == "--frames")
+				options.frameCount = std::stoul(value);
+			else if (argument == "--output")
+				options.outputPath = value;
+			else if (argument == "--report")
+				options.reportPath = value;
+			else if (argument == "--threads")
+				options.threadCount = std::stoul(value);
+			else if (argument == "--tile")
+				options.tileSize = std::stoul(value);
+			else if (argument == "--max-samples")
+				options.maxSampleCount = std::stoul(value);
+			else if (argument == "--error-threshold")
+				options.errorThreshold = std::stof(value);
+			else if (argument == "--trace")
+				options.tracePath = value;
+			else if (argument == "--heatmap" && value == "nodes")
+				options.heatmapMode = Renderer::HeatmapMode::NodeVisits;
+			else if (argument == "--heatmap" && value == "triangles")
+				options.heatmapMode = Renderer::HeatmapMode::TriangleTests;
+			else if (argument == "--heatmap" && value == "time")
+				options.heatmapMode = Renderer::HeatmapMode::Time;
+			else if (argument == "--traversal")
+			{
+				if (!ParseMeshTraversals(value, options.traversals))
+					return false;
+			}
+			else
+				return false;
+		}
+		catch (const std::exception&)
+		{
+			return false;
+		}
+	}
+
+	//Only a benchmark renders with more than one traversal
+	if (!options.isBenchmark && options.traversals.size() > 1)
+		return false;
+
+	return options.width > 0 && options.height > 0;
+}
+
+std::string InsertBeforeExtension(const std::string& path, const std::string& suffix)
+{
+	const size_t extensionStart = path.find_last_of('.');
+	if (extensionStart == std::string::npos || path.find_first_of("/\\", extensionStart) != std::string::npos)
+		return path + suffix;
+
+	return path.substr(0, extensionStart) + suffix + path.substr(extensionStart);
+}
+
+std::string GetFramePath(const std::string& outputPath, uint32_t frame, uint32_t frameCount)
+{
+	if (frameCount <= 1)
+		return outputPath;
+
+	//render.bmp >> render_0003.bmp
+	std::string frameNumber = std::to_string(frame);
+	frameNumber.insert(0, frameNumber.size() < 4 ? 4 - frameNumber.size() : 0, '0');
+
+	return InsertBeforeExtension(outputPath, "_" + frameNumber);
+}
+
+void ConfigureRenderer(Renderer* pRenderer, const LaunchOptions& options)
+{
+	if (options.threadCount > 0)
+		pRenderer->SetThreadCount(options.threadCount);
+
+	pRenderer->SetTileSize(options.tileSize);
+	pRenderer->SetAdaptiveSampling(options.errorThreshold, options.maxSampleCount);
+
+	if (options.heatmapMode != Renderer::HeatmapMode::Off)
+		pRenderer->SetHeatmapMode(options.heatmapMode);
+}
+
+int RenderHeadless(const LaunchOptions& options, Renderer& renderer, const std::string& sceneName, const std::string& outputPath)
+{
+	const std::unique_ptr<Scene> pScene{ CreateScene(sceneName) };
+	if (!pScene)
+	{
+		std::cout << "Unknown scene: " << sceneName << std::endl;
+		return 1;
+	}
+
+	pScene->Initialize();
+	if (!options.traversals.empty())
+		pScene->SetMeshTraversal(options.traversals.front());
+
+	renderer.ResetAccumulation();
+
+	Timer timer{};
+	const uint32_t frameCount = std::max(options.frameCount, 1u);
+
+	std::cout << "Rendering " << sceneName << " at " << options.width << "x" << options.height
+		<< ", " << frameCount << " frame(s)" << std::endl;
+
+	timer.Start();
+	for (uint32_t frame{}; frame < frameCount; ++frame)
+	{
+		PROFILE_ZONE_VALUE("Frame", frame);
+
+		pScene->Update(&timer);
+		renderer.Render(pScene.get());
+		timer.Update();
+
+		const std::string framePath = GetFramePath(outputPath, frame, frameCount);
+		if (renderer.SaveBufferToImage(framePath))
+		{
+			std::cout << "Something went wrong. " << framePath << " not saved!" << std::endl;
+			return 1;
+		}
+
+		std::cout << "Frame " << frame << ": " << timer.GetElapsed() * 1000.f << " ms >> " << framePath << std::endl;
+		if (options.printStats)
+			renderer.PrintFrameStats();
+	}
+	timer.Stop();
+
+	return 0;
+}
+
+int RunHeadless(const LaunchOptions& options)
+{
+	Renderer renderer{ options.width, options.height };
+	ConfigureRenderer(&renderer, options);
+
+	//Several scenes each get their name appended to the output: render.bmp >> render_W3.bmp
+	const std::vector<std::string> sceneNames = SplitList(options.sceneName);
+	for (const std::string& sceneName : sceneNames)
+	{
+		const std::string sceneStem = std::filesystem::path(sceneName).stem().string();
+		const std::string outputPath = sceneNames.size() > 1 ? InsertBeforeExtension(options.outputPath, "_" + sceneStem) : options.outputPath;
+
+		if (RenderHeadless(options, renderer, sceneName, outputPath) != 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+int RunBenchmark(const LaunchOptions& options)
+{
+	Renderer renderer{ options.width, options.height };
+	ConfigureRenderer(&renderer, options);
+
+	std::vector<std::string> sceneNames{ "W1", "W2", "W3", "W4_Reference", "W4_Bunny" };
+	if (!options.sceneName.empty())
+		sceneNames = SplitList(options.sceneName);
+
+	Benchmark benchmark{ options.frameCount > 0 ? options.frameCount : 60 };
+	if (!benchmark.Run(&renderer, sceneNames, options.traversals))
+		return 1;
+
+	benchmark.PrintResults();
+	return benchmark.WriteReport(options.reportPath) ? 0 : 1;
+}
+
+void WriteTrace(const LaunchOptions& options)
+{
+	if (!options.tracePath.empty())
+		Profiler::WriteChromeTrace(options.tracePath);
+}
+
 void ShutDown(SDL_Window* pWindow)
 {
 	SDL_DestroyWindow(pWindow);
 	SDL_Quit();
 }
 
+void BenchmarkMeshTraversal(const Renderer* pRenderer, Scene* pScene, int numFrames)
+{
+	std::cout << "**TRAVERSAL BENCHMARK STARTED**\n";
+
+	const MeshTraversal previousTraversal = pScene->GetMeshTraversal();
+	const TriangleKernel previousKernel = pScene->GetTriangleKernel();
+	const float secondsPerCount = 1.f / static_cast<float>(SDL_GetPerformanceFrequency());
+
+	std::ofstream fileStream("benchmark_traversal.txt");
+	fileStream << "FRAMES = " << numFrames << std::endl;
+
+	//Render the same frame with every traversal and triangle kernel, the scene is not updated in between
+	for (const MeshTraversal traversal : { MeshTraversal::Linear, MeshTraversal::BVH, MeshTraversal::BVH4, MeshTraversal::BVH8, MeshTraversal::Compact })
+	{
+		for (const TriangleKernel kernel : { TriangleKernel::Scalar, TriangleKernel::SSE, TriangleKernel::AVX2 })
+		{
+			if (!IsTriangleKernelSupported(kernel))
+				continue;
+
+			pScene->SetMeshTraversal(traversal);
+			pScene->SetTriangleKernel(kernel);
+
+			const uint64_t startTime = SDL_GetPerformanceCounter();
+			for (int frame{}; frame < numFrames; ++frame)
+				pRenderer->Render(pScene);
+
+			const float avgMs = static_cast<float>(SDL_GetPerformanceCounter() - startTime) * secondsPerCount * 1000.f / static_cast<float>(numFrames);
+
+			const float bytesPerTriangle = pScene->GetMeshBytesPerTriangle();
+
+			std::cout << ">> " << GetMeshTraversalName(traversal) << " " << GetTriangleKernelName(kernel) << " = " << avgMs << " ms/frame, "
+				<< bytesPerTriangle << " bytes/triangle" << std::endl;
+			fileStream << GetMeshTraversalName(traversal) << " " << GetTriangleKernelName(kernel) << " = " << avgMs << " " << bytesPerTriangle << std::endl;
+		}
+	}
+
+	pScene->SetMeshTraversal(previousTraversal);
+	pScene->SetTriangleKernel(previousKernel);
+	std::cout << "**TRAVERSAL BENCHMARK FINISHED**\n";
+}
+
 int main(int argc, char* args[])
 {
-	//Unreferenced parameters
-	(void)argc;
-	(void)args;
+	LaunchOptions options{};
+	if (!ParseLaunchOptions(argc, args, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	PROFILE_THREAD_NAME("Main");
+
+	//Zones are only kept while capturing
+	if (!options.tracePath.empty())
+		Profiler::StartCapture();
+
+	if (options.isBenchmark)
+	{
+		const int result = RunBenchmark(options);
+		WriteTrace(options);
+		return result;
+	}
+
+	if (options.sceneName.empty())
+		options.sceneName = "W4_Bunny";
+
+	if (options.isHeadless)
+	{
+		const int result = RunHeadless(options);
+		WriteTrace(options);
+		return result;
+	}
 
 	//Create window + surfaces
 	SDL_Init(SDL_INIT_VIDEO);
 	SDL_SetRelativeMouseMode(SDL_FALSE);
 
-	const uint32_t width = 640;
-	const uint32_t height = 480;
+	const uint32_t width = options.width;
+	const uint32_t height = options.height;
 
 	SDL_Window* pWindow = SDL_CreateWindow(
 		"RayTracer - Six Arne 2DAE-08",
@@ -45,18 +419,32 @@ int main(int argc, char* args[])
 	//Initialize "framework"
 	const auto pTimer = new Timer();
 	const auto pRenderer = new Renderer(pWindow);
+	ConfigureRenderer(pRenderer, options);
 
-	const auto pScene = new Scene_W4_BunnyScene();
+	const auto pScene = CreateScene(options.sceneName);
+	if (!pScene)
+	{
+		std::cout << "Unknown scene: " << options.sceneName << std::endl;
+		delete pRenderer;
+		delete pTimer;
+		ShutDown(pWindow);
+		return 1;
+	}
 	pScene->Initialize();
+	if (!options.traversals.empty())
+		pScene->SetMeshTraversal(options.traversals.front());
 
 	//Start loop
 	pTimer->Start();
 	float printTimer = 0.f;
 	bool isLooping = true;
 	bool takeScreenshot = false;
+	bool printStats = options.printStats;
 
 	while (isLooping)
 	{
+		PROFILE_ZONE("Frame");
+
 		//--------- Get input events ---------
 		SDL_Event e;
 		while (SDL_PollEvent(&e))
@@ -69,12 +457,47 @@ int main(int argc, char* args[])
 			case SDL_KEYUP:
 				if(e.key.keysym.scancode == SDL_SCANCODE_X)
 					takeScreenshot = true;
+				if (e.key.keysym.scancode == SDL_SCANCODE_F1)
+				{
+					//Without counters it only prints that they are unavailable
+					printStats = RenderStatsEnabled && !printStats;
+					if (!RenderStatsEnabled)
+						pRenderer->PrintFrameStats();
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_H)
+					pRenderer->CycleHeatmapMode();
+				if (e.key.keysym.scancode == SDL_SCANCODE_P)
+				{
+					if (Profiler::IsCapturing())
+					{
+						Profiler::WriteChromeTrace(options.tracePath.empty() ? "RayTracing_Trace.json" : options.tracePath);
+						Profiler::StopCapture();
+					}
+					else
+					{
+						Profiler::StartCapture();
+					}
+				}
 				if (e.key.keysym.scancode == SDL_SCANCODE_F2)
 					pRenderer->ToggleShadows();
 				if (e.key.keysym.scancode == SDL_SCANCODE_F3)
 					pRenderer->CycleLightingMode();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F4)
+					pScene->CycleMeshTraversal();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F5)
+					pScene->CycleTriangleKernel();
 				if (e.key.keysym.scancode == SDL_SCANCODE_F6)
 					pTimer->StartBenchmark(10);
+				if (e.key.keysym.scancode == SDL_SCANCODE_F7)
+					BenchmarkMeshTraversal(pRenderer, pScene, 10);
+				if (e.key.keysym.scancode == SDL_SCANCODE_F8)
+					pRenderer->PrintThreadStats();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F9)
+					pRenderer->TogglePacketTracing();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F10)
+					pRenderer->ToggleAccumulation();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F11)
+					pRenderer->ToggleAdaptiveSampling();
 				break;
 			}
 		}
@@ -93,6 +516,8 @@ int main(int argc, char* args[])
 		{
 			printTimer = 0.f;
 			std::cout << "dFPS: " << pTimer->GetdFPS() << std::endl;
+			if (printStats)
+				pRenderer->PrintFrameStats();
 		}
 
 		//Save screenshot after full render